@@ -18,6 +18,25 @@
  *      - add receive timeout handling
  *      - add support of hardflow setting
  * V1.3 - modify rs485 configuration in ioctl, add support for sysfs debug
+ * V1.4 - add rs485 bus address demultiplexer
+ *      - add per port serdev child nodes
+ *      - add raw bulk device with mmap'd rx ring
+ *      - add console and kgdb poll support
+ *      - add tracepoints for spi transactions and irq handling
+ *      - add latency histograms in debugfs
+ *      - add data path and spi transaction statistics
+ *      - add spi bus utilisation meter
+ *      - add perf pmu for driver events
+ *      - add spi register traffic recorder
+ *      - add loopback benchmark in debugfs
+ *      - add spi error retry and chip re-initialisation
+ *      - add spi fault injection
+ *      - add interrupt watchdog
+ *      - add interrupt storm mitigation
+ *      - add spi clock calibration up to spi-max-frequency
+ *      - add prebuilt spi messages for the register and FIFO accesses
+ *      - add exclusive spi bus ownership for an irq pass
+ *      - add regmap register layer with cache
  */
 
 #define DEBUG
@@ -28,26 +47,45 @@
 
 #include <linux/bitops.h>
 #include <linux/clk.h>
+#include <linux/completion.h>
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/gpio.h>
 #include <linux/i2c.h>
 #include <linux/spi/spi.h>
+#include <linux/regmap.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/serial_core.h>
 #include <linux/serial.h>
+#include <linux/console.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/serial_reg.h>
 #include <linux/tty.h>
 #include <linux/tty_flip.h>
 #include <linux/uaccess.h>
 #include <linux/irq.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/idr.h>
+#include <linux/perf_event.h>
+#include <linux/fault-inject.h>
 #include "linux/version.h"
 
+#define CREATE_TRACE_POINTS
+#include "ch432_trace.h"
+
 #define DRIVER_AUTHOR "WCH"
 #define DRIVER_DESC   "SPI serial driver for ch432."
-#define VERSION_DESC  "V1.3 On 2024.07"
+#define VERSION_DESC  "V1.4 On 2026.10"
 
 #ifndef PORT_SC16IS7XX
 #define PORT_SC16IS7XX 128
@@ -83,6 +121,7 @@
 #define CH43X_IER_THRI_BIT (1 << 1) /* Enable TX holding register interrupt */
 #define CH43X_IER_RLSI_BIT (1 << 2) /* Enable RX line status interrupt */
 #define CH43X_IER_MSI_BIT  (1 << 3) /* Enable Modem status interrupt */
+#define CH43X_IER_INT_MASK (CH43X_IER_RDI_BIT | CH43X_IER_THRI_BIT | CH43X_IER_RLSI_BIT | CH43X_IER_MSI_BIT)
 
 /* IER enhanced register bits */
 #define CH43X_IER_RESET_BIT    (1 << 7) /* Enable Soft reset */
@@ -96,6 +135,7 @@
 #define CH43X_FCR_TXRESET_BIT (1 << 2) /* Reset TX FIFO */
 #define CH43X_FCR_RXLVLL_BIT  (1 << 6) /* RX Trigger level LSB */
 #define CH43X_FCR_RXLVLH_BIT  (1 << 7) /* RX Trigger level MSB */
+#define CH43X_RX_TRIG	      8	       /* bytes in the FIFO at RDI, as set with CH43X_FCR_RXLVLH_BIT */
 
 /* IIR register bits */
 #define CH43X_IIR_NO_INT_BIT (1 << 0) /* No interrupts pending */
@@ -174,15 +214,316 @@
 #define CH43X_FIFO_SIZE (16)
 #define CH43X_REG_SHIFT 2
 
+/* spi clock calibration at probe */
+#define CH43X_SPI_DEFAULT_HZ 20000000 /* highest clock tried without spi-max-frequency */
+#define CH43X_SPI_CAL_ROUNDS 4	      /* pattern test passes per clock step */
+#define CH43X_SPI_CAL_READS  256      /* SPR reads timed at the chosen clock */
+
+/* spi error handling */
+#define CH43X_SPI_RETRIES      2  /* extra attempts of a failed register access */
+#define CH43X_RECOVER_TRIES    5  /* re-init attempts of a recovery round */
+#define CH43X_RECOVER_WAIT_MS  2  /* between re-init attempts and after a soft reset */
+#define CH43X_RECOVER_RETRY_MS 50 /* next round while the chip stays unreachable */
+
+#define CH43X_MAX_PORTS        2  /* uarts of the largest chip */
+#define CH43X_IRQ_MAX_LOOPS    32 /* interrupt sources served per port and pass */
+#define CH43X_IRQ_MAX_ROUNDS   4  /* rounds over the ports per pass */
+#define CH43X_RX_DR_READS      4  /* LSR reads for DR after an rx source before the source is dropped */
+#define CH43X_WATCHDOG_CHARS   32 /* two FIFOs, longer than any pause of a working irq */
+#define CH43X_WATCHDOG_IDLE_MS 50 /* watchdog period once no data moved for as long */
+
+/* interrupt storms: a source this busy is masked in IER and polled instead */
+#define CH43X_STORM_EVENTS    50 /* interrupts of one source ... */
+#define CH43X_STORM_WINDOW_MS 10 /* ... within this window */
+#define CH43X_STORM_POLL_MS   10 /* poll period while masked */
+#define CH43X_STORM_QUIET     10 /* quiet polls before the interrupt is enabled again */
+
+/* regmap registers of a port, see ch43x_regmap_init */
+#define CH43X_REGMAP_STRIDE 16
+#define CH43X_REGMAP_FCR    8
+#define CH43X_REGMAP_DLL    9
+#define CH43X_REGMAP_DLH    10
+
+/* an irq pass owns the spi bus, other devices on the controller wait at most about this long */
+#define CH43X_BUS_HOLD_MAX_US 100
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0))
+#define ch43x_spi_ctlr(spi) ((spi)->controller)
+#else
+#define ch43x_spi_ctlr(spi) ((spi)->master)
+#endif
+
 #define IOCTL_MAGIC	 'W'
 #define IOCTL_CMD_GRS485 _IOR(IOCTL_MAGIC, 0x86, uint16_t)
 #define IOCTL_CMD_SRS485 _IOW(IOCTL_MAGIC, 0x87, uint16_t)
 
+#define CH43X_CONSOLE_FIFO_SIZE 4096
+
+/* log2 latency histograms, bucket i counts [2^(i-1), 2^i) ns */
+#define CH43X_HIST_BUCKETS 32
+
+/* RS485 address demultiplexer */
+#define CH43X_DEMUX_FIFO_SIZE  4096 /* data bytes queued per address */
+#define CH43X_DEMUX_MAX_FRAMES 64   /* frames queued per address */
+#define CH43X_DEMUX_GAP_CHARS  12   /* rx trigger level + RTOI delay */
+#define CH43X_DEMUX_FRAME_LEN  0x7fff /* frames entry: length of the frame */
+#define CH43X_DEMUX_FRAME_ERR  0x8000 /* frames entry: line error in the frame */
+
+/* Raw bulk device */
+#define CH43X_RAW_RING_SIZE (256 * 1024) /* mmap'd rx ring, power of 2 */
+#define CH43X_RAW_TX_SIZE   4096
+
 struct ch43x_devtype {
 	char name[10];
 	int nr_uart;
 };
 
+struct ch43x_hist {
+	u64 bucket[CH43X_HIST_BUCKETS];
+	u64 count;
+	u64 max;
+};
+
+enum {
+	CH43X_LAT_IRQ_THREAD, /* hard irq to irq thread start */
+	CH43X_LAT_RX_DRAIN,   /* irq thread start to rx FIFO drained */
+	CH43X_LAT_RX_PUSH,    /* rx FIFO drained to data pushed to tty */
+	CH43X_LAT_TX_REFILL,  /* THRI seen to tx FIFO refilled */
+	CH43X_LAT_NR,
+};
+
+static const char *const ch43x_lat_names[CH43X_LAT_NR] = {
+	"irq_to_thread", "thread_to_drained", "drained_to_push", "thri_to_refill",
+};
+
+/* what an spi transaction is for */
+enum {
+	CH43X_SPI_RX,	  /* RHR reads */
+	CH43X_SPI_TX,	  /* THR writes */
+	CH43X_SPI_CTRL,	  /* configuration registers */
+	CH43X_SPI_STATUS, /* IIR, LSR, MSR reads */
+	CH43X_SPI_NR,
+};
+
+static const char *const ch43x_spi_names[CH43X_SPI_NR] = { "rx", "tx", "ctrl", "status" };
+
+struct ch43x_stats {
+	u64 rx_bytes;
+	u64 rx_passes;
+	u64 rx_max_pass;
+	u64 tx_bytes;
+	u64 tx_refills;
+	u64 spi_msgs[CH43X_SPI_NR];
+	u64 spi_xfers[CH43X_SPI_NR];
+	u64 irqs;	       /* interrupt sources handled */
+	u64 overruns;	       /* LSR OE seen */
+	u64 spi_retries;       /* spi messages sent again after an error */
+	u64 spi_errors;	       /* register accesses failed after all retries */
+	u64 recoveries;	       /* port re-initialised from the shadow registers */
+	u64 recover_failures;  /* recovery rounds that could not reach the chip */
+	u64 chip_resets;       /* soft resets done by a recovery */
+	u64 irq_loop_limits;   /* passes cut at CH43X_IRQ_MAX_LOOPS sources */
+	u64 rx_no_data;	       /* rx sources without DR, a corrupted IIR */
+	u64 irq_lost;	       /* pending interrupts found by the watchdog */
+	u64 watchdog_polls;    /* IIR reads of the watchdog */
+	u64 msi_storms;	       /* modem status interrupt masked for a storm */
+	u64 rls_storms;	       /* line status interrupt masked for a storm */
+	u64 storm_polls;       /* polls of a masked source */
+};
+
+/* interrupt sources that can storm */
+enum {
+	CH43X_STORM_MSI, /* a floating or noisy modem line */
+	CH43X_STORM_RLS, /* a flood of line errors, e.g. a noisy RS485 bus */
+	CH43X_STORM_NR,
+};
+
+static const u8 ch43x_storm_ier[CH43X_STORM_NR] = { CH43X_IER_MSI_BIT, CH43X_IER_RLSI_BIT };
+static const char *const ch43x_storm_names[CH43X_STORM_NR] = { "modem status", "line status" };
+
+struct ch43x_storm {
+	u64 window;	     /* start of the counting window */
+	unsigned int events; /* interrupts in the window */
+	unsigned int quiet;  /* polls in a row without activity */
+	bool masked;
+};
+
+/* faults injected at the register layer, set up in debugfs */
+struct ch43x_faults {
+	struct fault_attr fail_spi;	/* spi message fails with -EIO */
+	struct fault_attr corrupt_read; /* one bit of the data read flips */
+	struct fault_attr delay_spi;	/* spi message completes delay_us late */
+	struct fault_attr drop_irq;	/* INT edge does not wake the irq thread */
+	u32 delay_us;
+	u8 flip; /* bit to flip next */
+};
+
+/* register values last written by the driver, restored after spi errors */
+struct ch43x_shadow {
+	u8 ier;
+	u8 fcr;
+	u8 lcr;
+	u8 mcr;
+	u8 spr;
+	u8 dll;
+	u8 dlh;
+};
+
+/* spi bus time of a chip, per purpose and per second over the last minute */
+#define CH43X_BUSLOAD_SLOTS 60
+
+struct ch43x_busload {
+	u64 busy_ns[CH43X_SPI_NR];
+	u64 msgs[CH43X_SPI_NR];
+	u64 slot_ns[CH43X_BUSLOAD_SLOTS];
+	u64 slot_sec; /* second of the newest slot */
+	struct ch43x_hist hold; /* spi bus held by an irq pass, per hold */
+	u64 hold_yields;	/* holds cut at bus_hold_max_us */
+};
+
+/*
+ * spi register traffic recorder, dumped through debugfs as a ch43x_rec_header
+ * followed by the entries, oldest first. tools/ch43x_replay.c reads it.
+ */
+#define CH43X_REC_MAGIC	  0x32333443 /* "C432" */
+#define CH43X_REC_VERSION 1
+#define CH43X_REC_MAX	  (1 << 20) /* entries */
+
+#define CH43X_REC_WRITE (1 << 0)
+#define CH43X_REC_BURST (1 << 1) /* RHR/THR burst, val is the first byte */
+
+struct ch43x_rec_header {
+	__u32 magic;
+	__u16 version;
+	__u16 entry_size;
+	__u32 uartclk;
+	__u32 nr_uart;
+	__u64 entries; /* entries in this dump */
+	__u64 lost;    /* older entries overwritten */
+};
+
+struct ch43x_rec_entry {
+	__u64 ns;     /* start of the spi message, ktime */
+	__u32 spi_ns; /* duration of the spi message */
+	__u16 len;
+	__u8 port;
+	__u8 reg;
+	__u8 flags;
+	__u8 val;
+	__u8 reserved[6];
+};
+
+struct ch43x_rec {
+	struct ch43x_rec_entry *ent;
+	u32 size; /* power of 2 */
+	u64 head; /* entries recorded so far */
+};
+
+struct ch43x_demux_node {
+	struct miscdevice misc;
+	struct kref kref;
+	struct kfifo data;
+	DECLARE_KFIFO(frames, u16, CH43X_DEMUX_MAX_FRAMES);
+	wait_queue_head_t wait;
+	struct mutex read_lock;
+	unsigned int partial; /* bytes left of the frame being read */
+	bool dead;
+	u8 addr;
+	char name[20];
+};
+
+struct ch43x_demux {
+	struct ch43x_demux_node *node[256];
+	struct ch43x_demux_node *cur; /* owner of the frame being received */
+	spinlock_t lock;
+	struct hrtimer gap_timer;
+	ktime_t gap;
+	unsigned int len;
+	bool in_frame;
+	bool bad; /* line error in the frame being received */
+	bool enabled;
+	unsigned long frames;
+	unsigned long dropped;
+	unsigned long errors;
+};
+
+/*
+ * Header in the first page of the raw device mapping, the rx data follows at
+ * offset PAGE_SIZE. head is advanced by the driver, tail by the reader, both
+ * are free running and taken modulo size.
+ */
+struct ch43x_raw_ring {
+	__u32 head;
+	__u32 tail;
+	__u32 size;
+	__u32 overruns; /* bytes dropped because the ring was full */
+	__u32 breaks; /* breaks received, they are not stored */
+	__u32 frame_errors; /* bytes stored with a framing error */
+	__u32 parity_errors; /* bytes stored with a parity error */
+	__u32 fifo_overruns; /* RX FIFO overruns reported by the chip */
+};
+
+struct ch43x_raw {
+	struct miscdevice misc;
+	struct ch43x_raw_ring *ring;
+	unsigned char *data;
+	u32 head;
+	struct kfifo tx;
+	wait_queue_head_t wait;
+	struct mutex lock;
+	bool open;
+	char name[16];
+};
+
+/* Loopback benchmark */
+#define CH43X_BENCH_ECHOS 1000
+
+struct ch43x_bench {
+	struct mutex lock; /* one run at a time, protects the result */
+	bool active;	   /* data path diverted to the benchmark */
+	bool streaming;	   /* tx keeps sending the pattern, under s->mutex */
+	u8 tx_seq;
+	u8 rx_seq;
+	u64 sent;
+	u64 received;
+	u64 errors; /* bytes out of sequence */
+	/* single byte echo */
+	bool echo_wait;
+	u8 echo_byte;
+	u64 echo_ts;
+	struct completion echo_done;
+	/* result of the last run */
+	bool valid;
+	unsigned int baud;
+	u64 ns;
+	u64 res_sent;
+	u64 res_received;
+	u64 res_errors;
+	u64 res_overruns;
+	u64 echo_lost;
+	struct ch43x_hist rtt;
+};
+
+/*
+ * Prebuilt spi messages of a port, one transfer each with the command byte
+ * first. Built once at probe and optimised where the spi core supports it,
+ * the transfers are never changed afterwards, only the buffer contents.
+ * Used under mutex_bus_access.
+ */
+struct ch43x_msg {
+	struct spi_message m;
+	struct spi_transfer t;
+};
+
+struct ch43x_msgs {
+	u8 *tx; /* command byte and data, 1 + CH43X_FIFO_SIZE */
+	u8 *rx; /* separate allocation, rx DMA does not share a cacheline with tx */
+	struct ch43x_msg reg;			   /* register read or write, full duplex */
+	struct ch43x_msg rx_burst[CH43X_FIFO_SIZE]; /* RHR burst of index + 1 bytes */
+	struct ch43x_msg tx_burst[CH43X_FIFO_SIZE]; /* THR burst of index + 1 bytes */
+	bool optimized;
+};
+
 struct ch43x_one {
 	struct uart_port port;
 	struct work_struct tx_work;
@@ -191,8 +532,21 @@ struct ch43x_one {
 	struct work_struct stop_tx_work;
 	struct serial_rs485 rs485;
 	unsigned char msr_reg;
+	unsigned char lsr_err; /* OE/PE/FE/BI an LSR read cleared before the rx path saw them */
 	unsigned char ier;
 	unsigned char mcr_force;
+	struct ch43x_demux demux;
+	struct ch43x_raw raw;
+	struct device *node_dev; /* port->dev carrying the serdev child node, or NULL */
+	struct ch43x_hist lat[CH43X_LAT_NR];
+	struct ch43x_stats stats;
+	u64 char_ns; /* one 10 bit character at the current baud rate */
+	struct ch43x_storm storm[CH43X_STORM_NR]; /* under mutex_irq */
+	struct delayed_work storm_work;
+	u32 storm_errors; /* line errors counted at the last storm poll */
+	struct ch43x_shadow shadow; /* under mutex_bus_access */
+	struct ch43x_msgs msgs;
+	struct ch43x_bench bench;
 };
 
 struct ch43x_port {
@@ -202,919 +556,3714 @@ struct ch43x_port {
 	struct mutex mutex_bus_access;
 	struct clk *clk;
 	struct spi_device *spi_dev;
+	struct regmap *regmap;
 	unsigned char buf[65536];
+	DECLARE_KFIFO(console_fifo, unsigned char, CH43X_CONSOLE_FIFO_SIZE);
+	spinlock_t console_lock;
+	struct work_struct console_work;
+	u64 irq_ts;    /* hard irq time, cleared by the irq thread */
+	u64 thread_ts; /* start of the current irq thread pass */
+	struct dentry *debugfs;
+	struct ch43x_busload busload;
+	u32 spi_hz;	       /* clock chosen by the calibration */
+	u32 spi_max_hz;	       /* highest clock allowed, spi-max-frequency */
+	u32 spi_failed_hz;     /* lowest clock that failed the pattern test, 0 if none */
+	u32 reg_reads_per_sec; /* measured SPR reads at spi_hz */
+	s64 msg_saved_ns;      /* cpu time a prebuilt message saves per register read */
+	u64 irq_passes; /* irq thread runs */
+	struct ch43x_rec *rec; /* set while recording, under mutex_bus_access */
+	struct delayed_work recover_work;
+	bool running;	 /* probed, spi errors start a recovery */
+	bool recovering; /* recover_work is restoring the chip */
+	struct mutex mutex_irq; /* one service pass at a time, irq thread or watchdog */
+	struct hrtimer watchdog;
+	struct work_struct watchdog_work;
+	u64 wd_passes;	     /* irq_passes at the last watchdog tick */
+	u64 wd_bytes;	     /* bytes moved until the last watchdog tick */
+	u64 wd_active_until; /* data moved recently, check at the short period */
+	struct task_struct *bus_owner; /* irq pass holding mutex_bus_access and the spi bus */
+	u64 bus_hold_ts;	       /* start of the current hold */
+	u32 bus_hold_max_us;
+#ifdef CONFIG_FAULT_INJECTION_DEBUG_FS
+	struct ch43x_faults faults;
+#endif
+#ifdef CONFIG_PERF_EVENTS
+	struct pmu pmu;
+	int pmu_id;
+	char pmu_name[16];
+#endif
 	struct ch43x_one p[0];
 };
 
-struct ch43x_port *g_ch43x_port;
 
 #define to_ch43x_one(p, e) ((container_of((p), struct ch43x_one, e)))
-#ifdef USE_SPI_MODE
-static u8 ch43x_port_read(struct uart_port *port, u8 reg)
-{
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	unsigned char cmd;
-	ssize_t status;
-	u8 result;
 
-	mutex_lock(&s->mutex_bus_access);
-	cmd = 0xFD & ((reg + port->line * 0x08) << CH43X_REG_SHIFT);
+/*
+ * Pure helpers of the register layer and the line setup, kept free of bus
+ * access so they can be checked on their own.
+ */
 
-	status = spi_write_then_read(s->spi_dev, &cmd, 1, &result, 1);
-	mutex_unlock(&s->mutex_bus_access);
-	if (status < 0) {
-		dev_err(&s->spi_dev->dev, "Failed to ch43x_port_read error code %ld\n", (unsigned long)status);
-	}
-	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x, data:0x%2x\n", __func__, reg + port->line * 0x08, result);
+/* SPI command byte of a register access, refer CH432DS1.PDF */
+static inline u8 ch43x_cmd_read(u8 line, u8 reg)
+{
+	return 0xFD & ((reg + line * 0x08) << CH43X_REG_SHIFT);
+}
 
-	return result;
+static inline u8 ch43x_cmd_write(u8 line, u8 reg)
+{
+	return 0x02 | ((reg + line * 0x08) << CH43X_REG_SHIFT);
 }
 
-static u8 ch43x_port_read_specify(struct uart_port *port, u8 portnum, u8 reg)
+static inline unsigned long ch43x_baud_divisor(unsigned long uartclk, int baud)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	unsigned char cmd;
-	ssize_t status;
-	u8 result;
+	return uartclk / 16 / baud;
+}
 
-	mutex_lock(&s->mutex_bus_access);
-	cmd = 0xFD & ((reg + portnum * 0x08) << CH43X_REG_SHIFT);
+/* LCR value for the word size, parity and stop bits of cflag */
+static u8 ch43x_termios_lcr(tcflag_t cflag)
+{
+	u8 lcr;
 
-	status = spi_write_then_read(s->spi_dev, &cmd, 1, &result, 1);
-	mutex_unlock(&s->mutex_bus_access);
-	if (status < 0) {
-		dev_err(&s->spi_dev->dev, "Failed to ch43x_port_read error code %ld\n", (unsigned long)status);
+	switch (cflag & CSIZE) {
+	case CS5:
+		lcr = CH43X_LCR_WORD_LEN_5;
+		break;
+	case CS6:
+		lcr = CH43X_LCR_WORD_LEN_6;
+		break;
+	case CS7:
+		lcr = CH43X_LCR_WORD_LEN_7;
+		break;
+	default:
+		lcr = CH43X_LCR_WORD_LEN_8;
+		break;
 	}
-	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x, data:0x%2x\n", __func__, reg + portnum * 0x08, result);
 
-	return result;
-}
+	if (cflag & PARENB) {
+		lcr |= CH43X_LCR_PARITY_BIT;
+		if (cflag & CMSPAR)
+			lcr |= (cflag & PARODD) ? CH43X_LCR_MARKPARITY_BIT : CH43X_LCR_SPACEPARITY_BIT;
+		else
+			lcr |= (cflag & PARODD) ? CH43X_LCR_ODDPARITY_BIT : CH43X_LCR_EVENPARITY_BIT;
+	}
 
-static void ch43x_port_write(struct uart_port *port, u8 reg, u8 val)
-{
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	unsigned char spi_buf[2];
-	ssize_t status;
+	if (cflag & CSTOPB)
+		lcr |= CH43X_LCR_STOPLEN_BIT; /* 2 stops */
 
-	mutex_lock(&s->mutex_bus_access);
-	spi_buf[0] = 0x02 | ((reg + port->line * 0x08) << CH43X_REG_SHIFT);
+	return lcr;
+}
 
-	spi_buf[1] = val;
+/* tty flag of a received char, lsr is already masked with read_status_mask */
+static unsigned int ch43x_lsr_flag(unsigned int lsr)
+{
+	if (lsr & CH43X_LSR_BI_BIT)
+		return TTY_BREAK;
+	if (lsr & CH43X_LSR_PE_BIT)
+		return TTY_PARITY;
+	if (lsr & CH43X_LSR_FE_BIT)
+		return TTY_FRAME;
+
+	return TTY_NORMAL;
+}
 
-	status = spi_write(s->spi_dev, spi_buf, 2);
-	if (status < 0) {
-		dev_err(&s->spi_dev->dev, "Failed to ch43x_port_write Err_code %ld\n", (unsigned long)status);
+#ifdef USE_SPI_MODE
+static int ch43x_spi_purpose(u8 reg, bool write)
+{
+	switch (reg) {
+	case CH43X_RHR_REG:
+		return write ? CH43X_SPI_TX : CH43X_SPI_RX;
+	case CH43X_IIR_REG:
+		return write ? CH43X_SPI_CTRL : CH43X_SPI_STATUS;
+	case CH43X_LSR_REG:
+	case CH43X_MSR_REG:
+		return CH43X_SPI_STATUS;
+	default:
+		return CH43X_SPI_CTRL;
 	}
-	mutex_unlock(&s->mutex_bus_access);
+}
 
-	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x, data:0x%2x\n", __func__, reg + port->line * 0x08, spi_buf[1]);
+static unsigned int ch43x_busload_slot(u64 sec)
+{
+	return do_div(sec, CH43X_BUSLOAD_SLOTS);
 }
 
-static void ch43x_port_write_spefify(struct uart_port *port, u8 portnum, u8 reg, u8 val)
+/* moves the per second window up to now, called with mutex_bus_access held */
+static void ch43x_busload_advance(struct ch43x_busload *bl, u64 now)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	unsigned char spi_buf[2];
-	ssize_t status;
+	u64 sec = div_u64(now, NSEC_PER_SEC);
+	u64 i;
 
-	mutex_lock(&s->mutex_bus_access);
-	spi_buf[0] = 0x02 | ((reg + portnum * 0x08) << CH43X_REG_SHIFT);
+	if (sec == bl->slot_sec)
+		return;
+	for (i = bl->slot_sec + 1; i <= sec && i <= bl->slot_sec + CH43X_BUSLOAD_SLOTS; i++)
+		bl->slot_ns[ch43x_busload_slot(i)] = 0;
+	bl->slot_sec = sec;
+}
+
+/*
+ * Counts one spi message started at t0 and returns its duration, called with
+ * mutex_bus_access held.
+ */
+static u64 ch43x_spi_account(struct ch43x_port *s, u8 portnum, int purpose, int xfers, u64 t0)
+{
+	struct ch43x_stats *st = &s->p[portnum].stats;
+	struct ch43x_busload *bl = &s->busload;
+	u64 now = ktime_get_ns();
+	u64 ns = now - t0;
 
-	spi_buf[1] = val;
+	st->spi_msgs[purpose]++;
+	st->spi_xfers[purpose] += xfers;
 
-	status = spi_write(s->spi_dev, spi_buf, 2);
-	if (status < 0) {
-		dev_err(&s->spi_dev->dev, "Failed to ch43x_port_write Err_code %ld\n", (unsigned long)status);
-	}
-	mutex_unlock(&s->mutex_bus_access);
+	ch43x_busload_advance(bl, now);
+	bl->slot_ns[ch43x_busload_slot(bl->slot_sec)] += ns;
+	bl->busy_ns[purpose] += ns;
+	bl->msgs[purpose]++;
 
-	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x, data:0x%2x\n", __func__, reg + portnum * 0x08, spi_buf[1]);
+	return ns;
 }
 
-// mask: bit to operate, val: 0 to clear, mask to set
-static void ch43x_port_update(struct uart_port *port, u8 reg, u8 mask, u8 val)
+/* records one spi message, called with mutex_bus_access held */
+static void ch43x_rec_add(struct ch43x_port *s, u8 portnum, u8 reg, u8 flags, u8 val, int len, u64 t0, u64 ns)
 {
-	unsigned int tmp;
+	struct ch43x_rec *rec = s->rec;
+	struct ch43x_rec_entry *e;
 
-	tmp = ch43x_port_read(port, reg);
-	tmp &= ~mask;
-	tmp |= val & mask;
-	ch43x_port_write(port, reg, tmp);
+	if (!rec)
+		return;
+	e = &rec->ent[rec->head++ & (rec->size - 1)];
+	e->ns = t0;
+	e->spi_ns = min_t(u64, ns, U32_MAX);
+	e->len = len;
+	e->port = portnum;
+	e->reg = reg;
+	e->flags = flags;
+	e->val = val;
 }
 
-// mask: bit to operate, val: 0 to clear, mask to set
-static void ch43x_port_update_specify(struct uart_port *port, u8 portnum, u8 reg, u8 mask, u8 val)
+#ifdef CONFIG_FAULT_INJECTION_DEBUG_FS
+/*
+ * Fault injection. Each fault is a fault_attr in ch432-<spi device>/, so
+ * probability, interval, times and space work as for the other kernel fault
+ * types; the delay length is fault_delay_us. Called with mutex_bus_access
+ * held, except ch43x_fault_drop_irq which runs in the hard irq handler.
+ */
+static DECLARE_FAULT_ATTR(ch43x_fault_default);
+
+/* an error to report instead of sending the message, 0 to send it */
+static int ch43x_fault_xfer(struct ch43x_port *s)
 {
-	unsigned int tmp;
+	if (should_fail(&s->faults.delay_spi, 1))
+		usleep_range(s->faults.delay_us, s->faults.delay_us + s->faults.delay_us / 4 + 1);
+	if (should_fail(&s->faults.fail_spi, 1))
+		return -EIO;
 
-	tmp = ch43x_port_read_specify(port, portnum, reg);
-	tmp &= ~mask;
-	tmp |= val & mask;
-	ch43x_port_write_spefify(port, portnum, reg, tmp);
+	return 0;
 }
 
-void ch43x_raw_write(struct uart_port *port, const void *reg, unsigned char *buf, int len)
+static void ch43x_fault_corrupt(struct ch43x_port *s, u8 *buf, int len)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	ssize_t status;
-	struct spi_message m;
-	struct spi_transfer t[2] = {
-		{
-			.tx_buf = reg,
-			.len = 1,
-		},
-		{
-			.tx_buf = buf,
-			.len = len,
-		},
-	};
-	int i;
+	struct ch43x_faults *f = &s->faults;
 
-	mutex_lock(&s->mutex_bus_access);
-	spi_message_init(&m);
-	spi_message_add_tail(&t[0], &m);
-	spi_message_add_tail(&t[1], &m);
-	status = spi_sync(s->spi_dev, &m);
-	if (status < 0) {
-		dev_err(&s->spi_dev->dev, "Failed to ch43x_raw_write Err_code %ld\n", (unsigned long)status);
+	if (len && should_fail(&f->corrupt_read, len)) {
+		buf[f->flip % len] ^= 1 << (f->flip & 7);
+		f->flip++;
 	}
-	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x\n", __func__, *(u8 *)reg);
-	for (i = 0; i < len; i++)
-		dev_vdbg(&s->spi_dev->dev, "\tbuf[%d]:0x%2x\n", i, buf[i]);
+}
 
-	mutex_unlock(&s->mutex_bus_access);
+static bool ch43x_fault_drop_irq(struct ch43x_port *s)
+{
+	return should_fail(&s->faults.drop_irq, 1);
 }
 
-void ch43x_raw_read(struct uart_port *port, unsigned char *buf, int len)
+static void ch43x_fault_init(struct ch43x_port *s)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	unsigned char cmd;
-	ssize_t status;
+	struct ch43x_faults *f = &s->faults;
+
+	f->fail_spi = ch43x_fault_default;
+	f->corrupt_read = ch43x_fault_default;
+	f->delay_spi = ch43x_fault_default;
+	f->drop_irq = ch43x_fault_default;
+	f->delay_us = 1000;
+	fault_create_debugfs_attr("fail_spi", s->debugfs, &f->fail_spi);
+	fault_create_debugfs_attr("corrupt_read", s->debugfs, &f->corrupt_read);
+	fault_create_debugfs_attr("delay_spi", s->debugfs, &f->delay_spi);
+	fault_create_debugfs_attr("drop_irq", s->debugfs, &f->drop_irq);
+	debugfs_create_u32("fault_delay_us", 0644, s->debugfs, &f->delay_us);
+}
+#else
+static inline int ch43x_fault_xfer(struct ch43x_port *s)
+{
+	return 0;
+}
 
-	mutex_lock(&s->mutex_bus_access);
-	cmd = 0xFD & ((CH43X_RHR_REG + port->line * 0x08) << CH43X_REG_SHIFT);
-	status = spi_write_then_read(s->spi_dev, &cmd, 1, buf, len);
-	mutex_unlock(&s->mutex_bus_access);
-	if (status < 0) {
-		dev_err(&s->spi_dev->dev, "Failed to ch43x_raw_read Err_code %ld\n", (unsigned long)status);
-	}
-	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x, len:0x%d\n", __func__, CH43X_RHR_REG + port->line * 0x08, len);
+static inline void ch43x_fault_corrupt(struct ch43x_port *s, u8 *buf, int len)
+{
+}
+
+static inline bool ch43x_fault_drop_irq(struct ch43x_port *s)
+{
+	return false;
+}
+
+static inline void ch43x_fault_init(struct ch43x_port *s)
+{
 }
 #endif
 
-static void ch43x_power(struct uart_port *port, int on)
+/* a failed spi message, true if it should be sent again */
+static bool ch43x_spi_retry(struct ch43x_port *s, u8 portnum, int tries)
 {
-	ch43x_port_update_specify(port, 0, CH43X_IER_REG, CH43X_IER_SLEEP_BIT, on ? 0 : CH43X_IER_SLEEP_BIT);
+	if (tries > CH43X_SPI_RETRIES)
+		return false;
+	s->p[portnum].stats.spi_retries++;
+
+	return true;
 }
 
-static struct ch43x_devtype ch43x_devtype = {
-	.name = "CH43X",
-	.nr_uart = 2,
-};
+/*
+ * A register access failed after all retries, the chip state is unknown from
+ * here on. Called with mutex_bus_access held.
+ */
+static void ch43x_spi_failed(struct ch43x_port *s, u8 portnum, u8 reg, int status)
+{
+	s->p[portnum].stats.spi_errors++;
+	dev_err_ratelimited(&s->spi_dev->dev, "port %d reg 0x%x: spi error %d\n", portnum, reg, status);
+	if (s->running && !s->recovering)
+		schedule_delayed_work(&s->recover_work, 0);
+}
 
-static int ch43x_set_baud(struct uart_port *port, int baud)
+/* keeps the value of a configuration register write, see ch43x_restore_port */
+static void ch43x_shadow_write(struct ch43x_shadow *sh, u8 reg, u8 val)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	u8 lcr;
-	unsigned long clk = port->uartclk;
-	unsigned long div;
+	if (sh->lcr & CH43X_LCR_DLAB_BIT) {
+		if (reg == CH43X_DLL_REG) {
+			sh->dll = val;
+			return;
+		}
+		if (reg == CH43X_DLH_REG) {
+			sh->dlh = val;
+			return;
+		}
+	}
 
-	dev_dbg(&s->spi_dev->dev, "%s - %d\n", __func__, baud);
+	switch (reg) {
+	case CH43X_IER_REG:
+		/* a soft reset is a command, not a setting */
+		if (!(val & CH43X_IER_RESET_BIT))
+			sh->ier = val;
+		break;
+	case CH43X_FCR_REG:
+		sh->fcr = val & ~(CH43X_FCR_RXRESET_BIT | CH43X_FCR_TXRESET_BIT);
+		break;
+	case CH43X_LCR_REG:
+		sh->lcr = val;
+		break;
+	case CH43X_MCR_REG:
+		sh->mcr = val;
+		break;
+	case CH43X_SPR_REG:
+		sh->spr = val;
+		break;
+	}
+}
 
-    /* when use clock multipication */
-    div = clk / 16 / baud;
+/* shadow value of the registers changed with ch43x_port_update */
+static u8 ch43x_shadow_read(const struct ch43x_shadow *sh, u8 reg)
+{
+	switch (reg) {
+	case CH43X_IER_REG:
+		return sh->ier;
+	case CH43X_LCR_REG:
+		return sh->lcr;
+	case CH43X_MCR_REG:
+		return sh->mcr;
+	}
 
-	lcr = ch43x_port_read(port, CH43X_LCR_REG);
+	return 0;
+}
 
-    /* Open the LCR divisors for configuration */
-    ch43x_port_write(port, CH43X_LCR_REG, CH43X_LCR_CONF_MODE_A);
+/*
+ * Register access takes mutex_bus_access, unless the caller is the irq pass
+ * that already owns the bus for its whole run, see ch43x_bus_hold().
+ */
+static void ch43x_bus_lock(struct ch43x_port *s)
+{
+	if (s->bus_owner != current)
+		mutex_lock(&s->mutex_bus_access);
+}
 
-	/* Write the new divisor */
-	ch43x_port_write(port, CH43X_DLH_REG, div / 256);
-	ch43x_port_write(port, CH43X_DLL_REG, div % 256);
+static void ch43x_bus_unlock(struct ch43x_port *s)
+{
+	if (s->bus_owner != current)
+		mutex_unlock(&s->mutex_bus_access);
+}
 
-	/* Put LCR back to the normal mode */
-	ch43x_port_write(port, CH43X_LCR_REG, lcr);
+/* called with mutex_bus_access held, the spi bus is locked only by its owner */
+static int ch43x_spi_sync(struct ch43x_port *s, struct spi_message *m)
+{
+	if (s->bus_owner)
+		return spi_sync_locked(s->spi_dev, m);
+	return spi_sync(s->spi_dev, m);
+}
 
-	return DIV_ROUND_CLOSEST(clk / 16, div);
+/*
+ * regmap of the chip. Each port has CH43X_REGMAP_STRIDE registers: the
+ * eight of the register file, then FCR, DLL and DLH, which share their
+ * address with IIR, RHR/THR and IER on the chip. Giving them their own
+ * regmap register keeps a divisor write out of the cached IER and lets FCR
+ * be write only. The bus below turns a regmap register into the command
+ * byte; regmap locks through ch43x_bus_lock, so an irq pass holding the bus
+ * goes straight through.
+ */
+static inline unsigned int ch43x_regmap_reg(u8 portnum, u8 reg)
+{
+	return portnum * CH43X_REGMAP_STRIDE + reg;
 }
 
-static int ch43x_dump_register(struct uart_port *port)
+/* register of the chip behind a regmap register */
+static inline u8 ch43x_regmap_chip_reg(unsigned int reg)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	u8 lcr;
-	u8 i, reg;
+	switch (reg % CH43X_REGMAP_STRIDE) {
+	case CH43X_REGMAP_FCR:
+		return CH43X_FCR_REG;
+	case CH43X_REGMAP_DLL:
+		return CH43X_DLL_REG;
+	case CH43X_REGMAP_DLH:
+		return CH43X_DLH_REG;
+	}
 
-	lcr = ch43x_port_read(port, CH43X_LCR_REG);
-	ch43x_port_write(port, CH43X_LCR_REG, CH43X_LCR_CONF_MODE_A);
-	dev_vdbg(&s->spi_dev->dev, "******Dump register at LCR=DLAB\n");
-	for (i = 0; i < 1; i++) {
-		reg = ch43x_port_read(port, i);
-		dev_vdbg(&s->spi_dev->dev, "Reg[0x%02x] = 0x%02x\n", i, reg);
+	return reg % CH43X_REGMAP_STRIDE;
+}
+
+static bool ch43x_regmap_volatile(struct device *dev, unsigned int reg)
+{
+	switch (reg % CH43X_REGMAP_STRIDE) {
+	case CH43X_RHR_REG:
+	case CH43X_IIR_REG:
+	case CH43X_LSR_REG:
+	case CH43X_MSR_REG:
+	case CH43X_SPR_REG: /* the SPR test has to reach the chip */
+		return true;
 	}
 
-	ch43x_port_update(port, CH43X_LCR_REG, CH43X_LCR_CONF_MODE_A, 0);
-	dev_vdbg(&s->spi_dev->dev, "******Dump register at LCR=Normal\n");
-	for (i = 0; i < 16; i++) {
-		reg = ch43x_port_read(port, i);
-		dev_vdbg(&s->spi_dev->dev, "Reg[0x%02x] = 0x%02x\n", i, reg);
+	return false;
+}
+
+/* reading pops the rx FIFO or clears interrupt and status bits */
+static bool ch43x_regmap_precious(struct device *dev, unsigned int reg)
+{
+	switch (reg % CH43X_REGMAP_STRIDE) {
+	case CH43X_RHR_REG:
+	case CH43X_IIR_REG:
+	case CH43X_LSR_REG:
+	case CH43X_MSR_REG:
+	case CH43X_REGMAP_DLL: /* the RHR unless DLAB is set */
+	case CH43X_REGMAP_DLH:
+		return true;
 	}
 
-	/* Put LCR back to the normal mode */
-	ch43x_port_write(port, CH43X_LCR_REG, lcr);
+	return false;
+}
 
-	return 0;
+static bool ch43x_regmap_readable(struct device *dev, unsigned int reg)
+{
+	return reg % CH43X_REGMAP_STRIDE <= CH43X_REGMAP_DLH && reg % CH43X_REGMAP_STRIDE != CH43X_REGMAP_FCR;
 }
 
-static int ch43x_spi_test(struct uart_port *port)
+static bool ch43x_regmap_writeable(struct device *dev, unsigned int reg)
 {
-	u8 val;
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	switch (reg % CH43X_REGMAP_STRIDE) {
+	case CH43X_IIR_REG:
+	case CH43X_LSR_REG:
+	case CH43X_MSR_REG:
+		return false;
+	}
 
-	dev_vdbg(&s->spi_dev->dev, "******Uart %d SPR Test Start******\n", port->line);
+	return reg % CH43X_REGMAP_STRIDE <= CH43X_REGMAP_DLH;
+}
 
-	ch43x_port_read(port, CH43X_IIR_REG);
-	ch43x_port_read(port, CH43X_LSR_REG);
+static void ch43x_regmap_lock(void *context)
+{
+	ch43x_bus_lock(context);
+}
 
-	ch43x_port_write(port, CH43X_SPR_REG, 0x55);
-	val = ch43x_port_read(port, CH43X_SPR_REG);
-	if (val != 0x55) {
-		dev_err(&s->spi_dev->dev, "UART %d SPR Test Failed.\n", port->line);
-		return -1;
-	}
+static void ch43x_regmap_unlock(void *context)
+{
+	ch43x_bus_unlock(context);
+}
 
-	ch43x_port_write(port, CH43X_SPR_REG, 0xAA);
-	val = ch43x_port_read(port, CH43X_SPR_REG);
-	if (val != 0xAA) {
-		dev_err(&s->spi_dev->dev, "UART %d SPR Test Failed.\n", port->line);
-		return -1;
+/* called with mutex_bus_access held, retries a failed message */
+static int ch43x_regmap_bus_read(void *context, unsigned int regmap_reg, unsigned int *val)
+{
+	struct ch43x_port *s = context;
+	u8 portnum = regmap_reg / CH43X_REGMAP_STRIDE;
+	u8 reg = ch43x_regmap_chip_reg(regmap_reg);
+	struct ch43x_msgs *mg = &s->p[portnum].msgs;
+	ssize_t status;
+	u8 result = 0;
+	u64 t0, ns;
+	int tries = 0;
+
+	mg->tx[0] = ch43x_cmd_read(portnum, reg);
+	mg->tx[1] = 0;
+
+	do {
+		t0 = ktime_get_ns();
+		status = ch43x_fault_xfer(s) ?: ch43x_spi_sync(s, &mg->reg.m);
+		result = mg->rx[1];
+		if (!status)
+			ch43x_fault_corrupt(s, &result, 1);
+		ns = ch43x_spi_account(s, portnum, ch43x_spi_purpose(reg, false), 1, t0);
+		ch43x_rec_add(s, portnum, reg, 0, result, 1, t0, ns);
+	} while (status < 0 && ch43x_spi_retry(s, portnum, ++tries));
+	if (status < 0) {
+		ch43x_spi_failed(s, portnum, reg, status);
+		return status;
 	}
+	trace_ch43x_reg_read(portnum, reg, result, ns);
+	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x, data:0x%2x\n", __func__, reg + portnum * 0x08, result);
+	/* the read cleared the error bits, whoever read LSR they go to the rx path */
+	if (regmap_reg % CH43X_REGMAP_STRIDE == CH43X_LSR_REG)
+		s->p[portnum].lsr_err |= result & CH43X_LSR_BRK_ERROR_MASK;
+	*val = result;
 
-	dev_vdbg(&s->spi_dev->dev, "******Uart %d SPR Test End******\n", port->line);
 	return 0;
 }
 
-static void ch43x_handle_rx(struct uart_port *port, unsigned int iir)
+/* called with mutex_bus_access held, keeps the shadow of the register */
+static int ch43x_regmap_bus_write(void *context, unsigned int regmap_reg, unsigned int val)
 {
-    struct ch43x_port *s = dev_get_drvdata(port->dev);
-    unsigned int lsr = 0, ch, flag, bytes_read = 0;
-    bool read_lsr = (iir == CH43X_IIR_RLSE_SRC) ? true : false;
+	struct ch43x_port *s = context;
+	u8 portnum = regmap_reg / CH43X_REGMAP_STRIDE;
+	u8 reg = ch43x_regmap_chip_reg(regmap_reg);
+	struct ch43x_one *one = &s->p[portnum];
+	struct ch43x_msgs *mg = &one->msgs;
+	ssize_t status;
+	u64 t0, ns;
+	bool fifo;
+	int tries = 0;
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	/* Only read lsr if there are possible errors in FIFO */
-	if (read_lsr) {
-		lsr = ch43x_port_read(port, CH43X_LSR_REG);
-		/* No errors left in FIFO */
-		if (!(lsr & CH43X_LSR_FIFOE_BIT))
-			read_lsr = false;
-	} else
-		lsr = 0;
+	mg->tx[0] = ch43x_cmd_write(portnum, reg);
+	mg->tx[1] = val;
 
-	/* At lest one error left in FIFO */
-	if (read_lsr) {
-		ch = ch43x_port_read(port, CH43X_RHR_REG);
-		bytes_read = 1;
+	/* a THR byte is not sent twice, the failed message may have reached the FIFO */
+	fifo = regmap_reg % CH43X_REGMAP_STRIDE == CH43X_THR_REG;
+	ch43x_shadow_write(&one->shadow, reg, val);
+	do {
+		t0 = ktime_get_ns();
+		status = ch43x_fault_xfer(s) ?: ch43x_spi_sync(s, &mg->reg.m);
+		ns = ch43x_spi_account(s, portnum, ch43x_spi_purpose(reg, true), 1, t0);
+		ch43x_rec_add(s, portnum, reg, CH43X_REC_WRITE, val, 1, t0, ns);
+	} while (status < 0 && !fifo && ch43x_spi_retry(s, portnum, ++tries));
+	if (status < 0)
+		ch43x_spi_failed(s, portnum, reg, status);
+	trace_ch43x_reg_write(portnum, reg, val, ns);
+	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x, data:0x%2x\n", __func__, reg + portnum * 0x08, val);
+
+	return status < 0 ? status : 0;
+}
 
-		goto ch_handler;
-	} else {
-		while (((lsr = ch43x_port_read(port, CH43X_LSR_REG)) & CH43X_LSR_DR_BIT) == 0)
-			;
+static const struct regmap_bus ch43x_regmap_bus = {
+	.reg_read = ch43x_regmap_bus_read,
+	.reg_write = ch43x_regmap_bus_write,
+};
 
-		do {
-			if (likely(lsr & CH43X_LSR_DR_BIT)) {
-				ch = ch43x_port_read(port, CH43X_RHR_REG);
-				bytes_read++;
-			} else
-				break;
-ch_handler:
-			flag = TTY_NORMAL;
-			port->icount.rx++;
+static int ch43x_regmap_init(struct ch43x_port *s)
+{
+	struct regmap_config cfg = {
+		.name = "ch432",
+		.reg_bits = 8,
+		.val_bits = 8,
+		.max_register = s->devtype->nr_uart * CH43X_REGMAP_STRIDE - 1,
+		.volatile_reg = ch43x_regmap_volatile,
+		.precious_reg = ch43x_regmap_precious,
+		.readable_reg = ch43x_regmap_readable,
+		.writeable_reg = ch43x_regmap_writeable,
+		.cache_type = REGCACHE_RBTREE,
+		.lock = ch43x_regmap_lock,
+		.unlock = ch43x_regmap_unlock,
+		.lock_arg = s,
+	};
 
-			if (unlikely(lsr & CH43X_LSR_BRK_ERROR_MASK)) {
-				if (lsr & CH43X_LSR_BI_BIT) {
-					lsr &= ~(CH43X_LSR_FE_BIT | CH43X_LSR_PE_BIT);
-					port->icount.brk++;
-					if (uart_handle_break(port))
-						goto ignore_char;
-				} else if (lsr & CH43X_LSR_PE_BIT)
-					port->icount.parity++;
-				else if (lsr & CH43X_LSR_FE_BIT)
-					port->icount.frame++;
-				else if (lsr & CH43X_LSR_OE_BIT)
-					port->icount.overrun++;
+	s->regmap = devm_regmap_init(&s->spi_dev->dev, &ch43x_regmap_bus, s, &cfg);
 
-				lsr &= port->read_status_mask;
-				if (lsr & CH43X_LSR_BI_BIT)
-					flag = TTY_BREAK;
-				else if (lsr & CH43X_LSR_PE_BIT)
-					flag = TTY_PARITY;
-				else if (lsr & CH43X_LSR_FE_BIT)
-					flag = TTY_FRAME;
+	return PTR_ERR_OR_ZERO(s->regmap);
+}
 
-				if (lsr & CH43X_LSR_OE_BIT)
-					dev_err(&s->spi_dev->dev, "%s - overrun detect\n", __func__);
-			}
+/* regmap register of a chip register, the divisor latch while LCR has DLAB set */
+static unsigned int ch43x_port_regmap_reg(struct ch43x_port *s, u8 portnum, u8 reg, bool write)
+{
+	bool dlab = READ_ONCE(s->p[portnum].shadow.lcr) & CH43X_LCR_DLAB_BIT;
 
-			if (uart_handle_sysrq_char(port, ch)) {
-				goto ignore_char;
-			}
-			uart_insert_char(port, lsr, CH43X_LSR_OE_BIT, ch, flag);
-ignore_char:
-			lsr = ch43x_port_read(port, CH43X_LSR_REG);
-		} while ((lsr & CH43X_LSR_DR_BIT));
+	if (dlab && reg == CH43X_DLL_REG)
+		return ch43x_regmap_reg(portnum, CH43X_REGMAP_DLL);
+	if (dlab && reg == CH43X_DLH_REG)
+		return ch43x_regmap_reg(portnum, CH43X_REGMAP_DLH);
+	if (write && reg == CH43X_FCR_REG)
+		return ch43x_regmap_reg(portnum, CH43X_REGMAP_FCR);
+
+	return ch43x_regmap_reg(portnum, reg);
+}
+
+/* returns the register value, or a negative error once all retries failed */
+static int ch43x_port_read_specify(struct uart_port *port, u8 portnum, u8 reg)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	unsigned int val;
+	int ret;
+
+	ret = regmap_read(s->regmap, ch43x_port_regmap_reg(s, portnum, reg, false), &val);
+
+	return ret < 0 ? ret : val;
+}
+
+static int ch43x_port_read(struct uart_port *port, u8 reg)
+{
+	return ch43x_port_read_specify(port, port->line, reg);
+}
+
+static int ch43x_port_write_spefify(struct uart_port *port, u8 portnum, u8 reg, u8 val)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+
+	return regmap_write(s->regmap, ch43x_port_regmap_reg(s, portnum, reg, true), val);
+}
+
+static int ch43x_port_write(struct uart_port *port, u8 reg, u8 val)
+{
+	return ch43x_port_write_spefify(port, port->line, reg, val);
+}
+
+/*
+ * mask: bit to operate, val: 0 to clear, mask to set. The read and the
+ * write are one step under the regmap lock, so the irq pass and the work
+ * items cannot lose each other's bits. The write is forced: setting THRI
+ * again re-arms the THRE interrupt even if IER does not change.
+ */
+static int ch43x_port_update_specify(struct uart_port *port, u8 portnum, u8 reg, u8 mask, u8 val)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	struct ch43x_shadow *sh = &s->p[portnum].shadow;
+	int ret;
+
+	ret = regmap_write_bits(s->regmap, ch43x_port_regmap_reg(s, portnum, reg, false), mask, val);
+	if (ret < 0) {
+		/* the failed access started a recovery, which writes the change from the shadow */
+		ch43x_bus_lock(s);
+		ch43x_shadow_write(sh, reg, (ch43x_shadow_read(sh, reg) & ~mask) | (val & mask));
+		ch43x_bus_unlock(s);
 	}
-	dev_vdbg(&s->spi_dev->dev, "%s-bytes_read:%d\n", __func__, bytes_read);
-	tty_flip_buffer_push(&port->state->port);
+
+	return ret;
 }
 
-static void ch43x_handle_tx(struct uart_port *port)
+// mask: bit to operate, val: 0 to clear, mask to set
+static int ch43x_port_update(struct uart_port *port, u8 reg, u8 mask, u8 val)
+{
+	return ch43x_port_update_specify(port, port->line, reg, mask, val);
+}
+
+/* FIFO bursts are not retried, a THR burst could be sent twice */
+int ch43x_raw_write(struct uart_port *port, const void *reg, unsigned char *buf, int len)
 {
 	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	struct circ_buf *xmit = &port->state->xmit;
-	unsigned int txlen, to_send, i;
-	unsigned char thr_reg;
+	struct ch43x_msgs *mg = &s->p[port->line].msgs;
+	ssize_t status;
+	u64 t0, ns;
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	/* xon/xoff char */
-	if (unlikely(port->x_char)) {
-		ch43x_port_write(port, CH43X_THR_REG, port->x_char);
-		port->icount.tx++;
-		port->x_char = 0;
+	if (len <= 0 || len > CH43X_FIFO_SIZE)
+		return -EINVAL;
+
+	ch43x_bus_lock(s);
+	mg->tx[0] = *(const u8 *)reg;
+	memcpy(mg->tx + 1, buf, len);
+	t0 = ktime_get_ns();
+	status = ch43x_fault_xfer(s) ?: ch43x_spi_sync(s, &mg->tx_burst[len - 1].m);
+	ns = ch43x_spi_account(s, port->line, CH43X_SPI_TX, 1, t0);
+	ch43x_rec_add(s, port->line, CH43X_THR_REG, CH43X_REC_WRITE | CH43X_REC_BURST, buf[0], len, t0, ns);
+	if (status < 0)
+		ch43x_spi_failed(s, port->line, CH43X_THR_REG, status);
+	ch43x_bus_unlock(s);
+	trace_ch43x_burst(port->line, CH43X_THR_REG, len, true, ns);
+	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x, len:%d\n", __func__, *(u8 *)reg, len);
+
+	return status < 0 ? status : 0;
+}
+
+int ch43x_raw_read(struct uart_port *port, unsigned char *buf, int len)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	struct ch43x_msgs *mg = &s->p[port->line].msgs;
+	ssize_t status;
+	u64 t0, ns;
+
+	if (len <= 0 || len > CH43X_FIFO_SIZE)
+		return -EINVAL;
+
+	ch43x_bus_lock(s);
+	mg->tx[0] = ch43x_cmd_read(port->line, CH43X_RHR_REG);
+	memset(mg->tx + 1, 0, len);
+	t0 = ktime_get_ns();
+	status = ch43x_fault_xfer(s) ?: ch43x_spi_sync(s, &mg->rx_burst[len - 1].m);
+	memcpy(buf, mg->rx + 1, len);
+	if (!status)
+		ch43x_fault_corrupt(s, buf, len);
+	ns = ch43x_spi_account(s, port->line, CH43X_SPI_RX, 1, t0);
+	ch43x_rec_add(s, port->line, CH43X_RHR_REG, CH43X_REC_BURST, buf[0], len, t0, ns);
+	if (status < 0)
+		ch43x_spi_failed(s, port->line, CH43X_RHR_REG, status);
+	ch43x_bus_unlock(s);
+	trace_ch43x_burst(port->line, CH43X_RHR_REG, len, false, ns);
+	dev_vdbg(&s->spi_dev->dev, "%s - reg:0x%2x, len:0x%d\n", __func__, CH43X_RHR_REG + port->line * 0x08, len);
+
+	return status < 0 ? status : 0;
+}
+#endif
+
+static void ch43x_hist_add(struct ch43x_hist *h, u64 ns)
+{
+	h->bucket[min_t(int, fls64(ns), CH43X_HIST_BUCKETS - 1)]++;
+	h->count++;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/*
+ * Exclusive bus ownership for an irq pass. The pass takes mutex_bus_access
+ * and locks the spi bus once, so its register accesses neither re-take the
+ * mutex nor re-arbitrate against other devices on the controller, and uses
+ * spi_sync_locked meanwhile. mutex_bus_access is taken before the spi bus
+ * lock, as spi_sync does for every other access, so the two cannot cross.
+ * Called under mutex_irq.
+ */
+static void ch43x_bus_hold(struct ch43x_port *s)
+{
+	mutex_lock(&s->mutex_bus_access);
+	spi_bus_lock(ch43x_spi_ctlr(s->spi_dev));
+	s->bus_owner = current;
+	s->bus_hold_ts = ktime_get_ns();
+}
+
+static void ch43x_bus_release(struct ch43x_port *s)
+{
+	ch43x_hist_add(&s->busload.hold, ktime_get_ns() - s->bus_hold_ts);
+	s->bus_owner = NULL;
+	spi_bus_unlock(ch43x_spi_ctlr(s->spi_dev));
+	mutex_unlock(&s->mutex_bus_access);
+}
+
+/*
+ * Gives the bus up for a moment once the pass held it for bus_hold_max_us,
+ * so a long rx drain does not hold off the other devices on the bus. Every
+ * loop of a pass that reads the chip again calls it, the IIR loop, the wait
+ * for DR and the rx drain. No-op outside a pass.
+ */
+static void ch43x_bus_yield(struct ch43x_port *s)
+{
+	if (s->bus_owner != current)
+		return;
+	if (ktime_get_ns() - s->bus_hold_ts < (u64)READ_ONCE(s->bus_hold_max_us) * NSEC_PER_USEC)
 		return;
+	s->busload.hold_yields++;
+	ch43x_bus_release(s);
+	cond_resched();
+	ch43x_bus_hold(s);
+}
+
+/* upper bound of the bucket holding the given per mille of the samples */
+static u64 ch43x_hist_pct(const struct ch43x_hist *h, unsigned int permille)
+{
+	u64 want = div_u64(h->count * permille + 999, 1000), sum = 0;
+	int i;
+
+	for (i = 0; i < CH43X_HIST_BUCKETS; i++) {
+		sum += h->bucket[i];
+		if (sum >= want)
+			return 1ULL << i;
 	}
 
-	if (uart_circ_empty(xmit) || uart_tx_stopped(port)) {
-		dev_vdbg(&s->spi_dev->dev, "ch43x_handle_tx stopped\n");
-		// add on 20200608
-		ch43x_port_update(port, CH43X_IER_REG, CH43X_IER_THRI_BIT, 0);
-		return;
+	return h->max;
+}
+
+static void ch43x_hist_show(struct seq_file *m, const char *name, const struct ch43x_hist *h)
+{
+	int i;
+
+	seq_printf(m, "%s: count=%llu p50<=%llu p90<=%llu p99<=%llu p999<=%llu max=%llu ns\n", name, h->count,
+		   ch43x_hist_pct(h, 500), ch43x_hist_pct(h, 900), ch43x_hist_pct(h, 990), ch43x_hist_pct(h, 999),
+		   h->max);
+	for (i = 0; i < CH43X_HIST_BUCKETS; i++)
+		if (h->bucket[i])
+			seq_printf(m, "  <%llu: %llu\n", 1ULL << i, h->bucket[i]);
+}
+
+static void ch43x_power(struct uart_port *port, int on)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	int i;
+
+	/* sleep mode is chip wide, keep the console port running */
+	for (i = 0; !on && i < s->uart.nr; i++)
+		if (uart_console(&s->p[i].port))
+			return;
+
+	ch43x_port_update_specify(port, 0, CH43X_IER_REG, CH43X_IER_SLEEP_BIT, on ? 0 : CH43X_IER_SLEEP_BIT);
+}
+
+static struct ch43x_devtype ch43x_devtype = {
+	.name = "CH43X",
+	.nr_uart = 2,
+};
+
+static int ch43x_set_baud(struct uart_port *port, int baud)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	int lcr;
+	unsigned long clk = port->uartclk;
+	unsigned long div;
+	u8 dl[2];
+
+	dev_dbg(&s->spi_dev->dev, "%s - %d\n", __func__, baud);
+
+    /* when use clock multipication */
+    div = ch43x_baud_divisor(clk, baud);
+
+	lcr = ch43x_port_read(port, CH43X_LCR_REG);
+	if (lcr < 0)
+		lcr = s->p[port->line].shadow.lcr;
+
+    /* Open the LCR divisors for configuration */
+    ch43x_port_write(port, CH43X_LCR_REG, CH43X_LCR_CONF_MODE_A);
+
+	/* Write the new divisor, DLL and DLH are adjacent in the regmap */
+	dl[0] = div % 256;
+	dl[1] = div / 256;
+	regmap_bulk_write(s->regmap, ch43x_regmap_reg(port->line, CH43X_REGMAP_DLL), dl, 2);
+
+	/* Put LCR back to the normal mode */
+	ch43x_port_write(port, CH43X_LCR_REG, lcr);
+
+	baud = DIV_ROUND_CLOSEST(clk / 16, div);
+	WRITE_ONCE(s->p[port->line].char_ns, div_u64(10ULL * NSEC_PER_SEC, baud));
+
+	return baud;
+}
+
+static int ch43x_spi_test(struct uart_port *port)
+{
+	int val;
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+
+	dev_vdbg(&s->spi_dev->dev, "******Uart %d SPR Test Start******\n", port->line);
+
+	ch43x_port_read(port, CH43X_IIR_REG);
+	ch43x_port_read(port, CH43X_LSR_REG);
+
+	ch43x_port_write(port, CH43X_SPR_REG, 0x55);
+	val = ch43x_port_read(port, CH43X_SPR_REG);
+	if (val != 0x55) {
+		dev_err(&s->spi_dev->dev, "UART %d SPR Test Failed.\n", port->line);
+		return -1;
 	}
 
-	/* Get length of data pending in circular buffer */
-	to_send = uart_circ_chars_pending(xmit);
+	ch43x_port_write(port, CH43X_SPR_REG, 0xAA);
+	val = ch43x_port_read(port, CH43X_SPR_REG);
+	if (val != 0xAA) {
+		dev_err(&s->spi_dev->dev, "UART %d SPR Test Failed.\n", port->line);
+		return -1;
+	}
 
-	if (likely(to_send)) {
-		/* Limit to size of TX FIFO */
-		txlen = CH43X_FIFO_SIZE;
-		to_send = (to_send > txlen) ? txlen : to_send;
+	dev_vdbg(&s->spi_dev->dev, "******Uart %d SPR Test End******\n", port->line);
+	return 0;
+}
 
-		/* Add data to send */
-		port->icount.tx += to_send;
+/* clock steps of the calibration, the spi-max-frequency limit is tried last */
+static const u32 ch43x_spi_steps[] = { 1000000, 2000000, 5000000, 10000000, 15000000,
+				       20000000, 25000000, 30000000, 40000000, 50000000 };
 
-		/* Convert to linear buffer */
-		for (i = 0; i < to_send; ++i) {
-			s->buf[i] = xmit->buf[xmit->tail];
-			xmit->tail = (xmit->tail + 1) & (UART_XMIT_SIZE - 1);
+/* both levels, alternating bits, walking ones and walking zeros */
+static const u8 ch43x_spr_patterns[] = { 0x00, 0xff, 0x55, 0xaa, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20,
+					 0x40, 0x80, 0xfe, 0xfd, 0xfb, 0xf7, 0xef, 0xdf, 0xbf, 0x7f };
+
+/*
+ * Extended SPR test at the current spi clock. Every pattern goes to the
+ * scratch register of all ports before any is read back, with the port
+ * number mixed in, so a corrupted address bit shows up as well as a
+ * corrupted data bit. Runs before the ports exist, straight on the bus.
+ */
+static int ch43x_spi_pattern_test(struct ch43x_port *s)
+{
+	struct spi_device *spi = s->spi_dev;
+	int round, i, line, ret;
+	u8 buf[2], val;
+
+	for (round = 0; round < CH43X_SPI_CAL_ROUNDS; round++) {
+		for (i = 0; i < ARRAY_SIZE(ch43x_spr_patterns); i++) {
+			for (line = 0; line < s->devtype->nr_uart; line++) {
+				buf[0] = ch43x_cmd_write(line, CH43X_SPR_REG);
+				buf[1] = ch43x_spr_patterns[i] ^ (line << 4);
+				ret = spi_write(spi, buf, 2);
+				if (ret)
+					return ret;
+			}
+			for (line = 0; line < s->devtype->nr_uart; line++) {
+				buf[0] = ch43x_cmd_read(line, CH43X_SPR_REG);
+				ret = spi_write_then_read(spi, buf, 1, &val, 1);
+				if (ret)
+					return ret;
+				if (val != (ch43x_spr_patterns[i] ^ (line << 4)))
+					return -EIO;
+			}
 		}
-		dev_vdbg(&s->spi_dev->dev, "ch43x_handle_tx %d bytes\n", to_send);
-		thr_reg = 0x02 | ((CH43X_THR_REG + port->line * 0x08) << CH43X_REG_SHIFT);
-		ch43x_raw_write(port, &thr_reg, s->buf, to_send);
 	}
 
-	if (uart_circ_chars_pending(xmit) < WAKEUP_CHARS)
-		uart_write_wakeup(port);
+	return 0;
+}
+
+static int ch43x_spi_set_hz(struct spi_device *spi, u32 hz)
+{
+	spi->max_speed_hz = hz;
+	return spi_setup(spi);
+}
+
+/*
+ * Steps the spi clock up to spi-max-frequency and runs the pattern test at
+ * each step. When a step fails, the clock goes back one step below the last
+ * one that passed, so that a board running close to its limit keeps some
+ * margin; if every step passes, spi-max-frequency itself is used. Then
+ * times register reads at the chosen clock. A chip that fails even the
+ * lowest step keeps that clock, the SPR test of the ports reports it.
+ */
+static void ch43x_spi_calibrate(struct ch43x_port *s)
+{
+	struct spi_device *spi = s->spi_dev;
+	u32 hz, good = 0, below = 0;
+	u64 t0, ns;
+	u8 cmd, val;
+	int i;
+
+	/*
+	 * without the property the spi core has already put the controller
+	 * limit (or the board info one) into max_speed_hz
+	 */
+	if (device_property_read_u32(&spi->dev, "spi-max-frequency", &s->spi_max_hz) || !s->spi_max_hz)
+		s->spi_max_hz = min_not_zero(spi->max_speed_hz, (u32)CH43X_SPI_DEFAULT_HZ);
+	s->spi_failed_hz = 0;
+	for (i = 0; i <= ARRAY_SIZE(ch43x_spi_steps); i++) {
+		hz = i < ARRAY_SIZE(ch43x_spi_steps) ? min(ch43x_spi_steps[i], s->spi_max_hz) : s->spi_max_hz;
+		if (hz <= good)
+			continue;
+		if (ch43x_spi_set_hz(spi, hz) || ch43x_spi_pattern_test(s)) {
+			s->spi_failed_hz = hz;
+			break;
+		}
+		below = good;
+		good = hz;
+	}
+	if (s->spi_failed_hz && below)
+		good = below;
+	if (!good)
+		good = min(ch43x_spi_steps[0], s->spi_max_hz);
+	ch43x_spi_set_hz(spi, good);
+	s->spi_hz = good;
+
+	cmd = ch43x_cmd_read(0, CH43X_SPR_REG);
+	t0 = ktime_get_ns();
+	for (i = 0; i < CH43X_SPI_CAL_READS; i++)
+		if (spi_write_then_read(spi, &cmd, 1, &val, 1))
+			break;
+	ns = ktime_get_ns() - t0;
+	s->reg_reads_per_sec = ns ? div64_u64((u64)i * NSEC_PER_SEC, ns) : 0;
+
+	if (s->spi_failed_hz)
+		dev_info(&spi->dev, "spi clock %u Hz, %u Hz failed, limit %u Hz, %u register reads/s\n", s->spi_hz,
+			 s->spi_failed_hz, s->spi_max_hz, s->reg_reads_per_sec);
+	else
+		dev_info(&spi->dev, "spi clock %u Hz, limit %u Hz, %u register reads/s\n", s->spi_hz, s->spi_max_hz,
+			 s->reg_reads_per_sec);
+}
+
+static void ch43x_msg_init(struct ch43x_msg *x, const void *tx, void *rx, unsigned int len)
+{
+	x->t.tx_buf = tx;
+	x->t.rx_buf = rx;
+	x->t.len = len;
+	spi_message_init(&x->m);
+	spi_message_add_tail(&x->t, &x->m);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+#define CH43X_MSGS_NR (1 + 2 * CH43X_FIFO_SIZE)
+
+static struct ch43x_msg *ch43x_msgs_get(struct ch43x_msgs *mg, int i)
+{
+	if (!i)
+		return &mg->reg;
+	if (i <= CH43X_FIFO_SIZE)
+		return &mg->rx_burst[i - 1];
+	return &mg->tx_burst[i - 1 - CH43X_FIFO_SIZE];
+}
+#endif
+
+static void ch43x_msgs_free(struct ch43x_port *s, struct ch43x_msgs *mg)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+	int i;
+
+	if (mg->optimized)
+		for (i = 0; i < CH43X_MSGS_NR; i++)
+			spi_unoptimize_message(&ch43x_msgs_get(mg, i)->m);
+	mg->optimized = false;
+#endif
+	kfree(mg->tx);
+	kfree(mg->rx);
+	mg->tx = NULL;
+	mg->rx = NULL;
+}
+
+/*
+ * Builds the messages of a port. They are optimised for the clock the
+ * calibration chose, so this runs after it; a controller that cannot
+ * optimise them keeps preinitialised messages, spi_sync then validates them
+ * on every call as before.
+ */
+static int ch43x_msgs_init(struct ch43x_port *s, struct ch43x_msgs *mg)
+{
+	int i;
+
+	mg->tx = kzalloc(1 + CH43X_FIFO_SIZE, GFP_KERNEL);
+	mg->rx = kzalloc(1 + CH43X_FIFO_SIZE, GFP_KERNEL);
+	if (!mg->tx || !mg->rx)
+		return -ENOMEM;
+
+	ch43x_msg_init(&mg->reg, mg->tx, mg->rx, 2);
+	for (i = 0; i < CH43X_FIFO_SIZE; i++) {
+		ch43x_msg_init(&mg->rx_burst[i], mg->tx, mg->rx, i + 2);
+		ch43x_msg_init(&mg->tx_burst[i], mg->tx, NULL, i + 2);
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+	for (i = 0; i < CH43X_MSGS_NR; i++) {
+		if (spi_optimize_message(s->spi_dev, &ch43x_msgs_get(mg, i)->m)) {
+			while (i--)
+				spi_unoptimize_message(&ch43x_msgs_get(mg, i)->m);
+			dev_dbg(&s->spi_dev->dev, "spi messages not optimised\n");
+			return 0;
+		}
+	}
+	mg->optimized = true;
+#endif
+
+	return 0;
+}
+
+/*
+ * Times SPR reads of the first port through spi_write_then_read and through
+ * the prebuilt message. Both move the same bytes on the bus, the difference
+ * is the cpu time the spi core spends building, validating and copying a
+ * message on each call.
+ */
+static void ch43x_msgs_measure(struct ch43x_port *s)
+{
+	struct ch43x_msgs *mg = &s->p[0].msgs;
+	u64 t0, generic, prebuilt;
+	u8 cmd, val;
+	int i;
+
+	cmd = ch43x_cmd_read(0, CH43X_SPR_REG);
+	t0 = ktime_get_ns();
+	for (i = 0; i < CH43X_SPI_CAL_READS; i++)
+		if (spi_write_then_read(s->spi_dev, &cmd, 1, &val, 1))
+			return;
+	generic = ktime_get_ns() - t0;
+
+	mg->tx[0] = cmd;
+	mg->tx[1] = 0;
+	t0 = ktime_get_ns();
+	for (i = 0; i < CH43X_SPI_CAL_READS; i++)
+		if (spi_sync(s->spi_dev, &mg->reg.m))
+			return;
+	prebuilt = ktime_get_ns() - t0;
+
+	s->msg_saved_ns = div_s64((s64)generic - (s64)prebuilt, CH43X_SPI_CAL_READS);
+	dev_info(&s->spi_dev->dev, "%s spi messages, %lld ns cpu time saved per register read\n",
+		 mg->optimized ? "optimised" : "preinitialised", s->msg_saved_ns);
+}
+
+/*
+ * Puts a port back into the state the driver last programmed, interrupts go
+ * on last so that an event still pending gives INT a new falling edge. The
+ * SPR test first checks that the chip answers at all.
+ */
+static int ch43x_restore_port(struct ch43x_port *s, int portnum)
+{
+	struct ch43x_one *one = &s->p[portnum];
+	struct uart_port *port = &one->port;
+	/* a copy, the writes below and the SPR test go through the shadow */
+	const struct ch43x_shadow sh = one->shadow;
+	const u8 seq[][2] = {
+		{ CH43X_LCR_REG, sh.lcr & ~CH43X_LCR_DLAB_BIT },
+		{ CH43X_IER_REG, sh.ier & ~CH43X_IER_INT_MASK },
+		{ CH43X_LCR_REG, CH43X_LCR_CONF_MODE_A },
+		{ CH43X_DLL_REG, sh.dll },
+		{ CH43X_DLH_REG, sh.dlh },
+		{ CH43X_LCR_REG, sh.lcr },
+		{ CH43X_FCR_REG, sh.fcr },
+		{ CH43X_MCR_REG, sh.mcr },
+		{ CH43X_SPR_REG, sh.spr },
+	};
+	int i, ret;
+
+	if (ch43x_spi_test(port))
+		return -EIO;
+	for (i = 0; i < ARRAY_SIZE(seq); i++) {
+		ret = ch43x_port_write(port, seq[i][0], seq[i][1]);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* the SPR test cleared IIR and LSR, MSR may have changed meanwhile */
+	ret = ch43x_port_read(port, CH43X_MSR_REG);
+	if (ret < 0)
+		return ret;
+	one->msr_reg = ret;
+
+	return ch43x_port_write(port, CH43X_IER_REG, sh.ier);
+}
+
+/*
+ * Started by a register access that failed after all retries. Every port is
+ * restored from its shadow registers; if that does not work the chip is soft
+ * reset through IER and restored again, a few times. While the chip stays
+ * unreachable the next round follows CH43X_RECOVER_RETRY_MS later, nothing
+ * else would touch the bus once the irq thread stopped.
+ */
+static void ch43x_recover_work_proc(struct work_struct *ws)
+{
+	struct ch43x_port *s = container_of(to_delayed_work(ws), struct ch43x_port, recover_work);
+	int i, try, ret = 0;
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	disable_irq(s->p[0].port.irq);
+	mutex_lock(&s->mutex_irq);
+	mutex_lock(&s->mutex);
+	WRITE_ONCE(s->recovering, true);
+	for (try = 0; try < CH43X_RECOVER_TRIES; try++) {
+		if (try) {
+			msleep(CH43X_RECOVER_WAIT_MS);
+			if (!ch43x_port_write_spefify(&s->p[0].port, 0, CH43X_IER_REG, CH43X_IER_RESET_BIT)) {
+				/* the reset cleared the registers behind the cache */
+				regcache_drop_region(s->regmap, 0, s->uart.nr * CH43X_REGMAP_STRIDE - 1);
+				for (i = 0; i < s->uart.nr; i++)
+					s->p[i].stats.chip_resets++;
+				msleep(CH43X_RECOVER_WAIT_MS);
+			}
+		}
+		for (i = 0; i < s->uart.nr; i++) {
+			ret = ch43x_restore_port(s, i);
+			if (ret < 0)
+				break;
+		}
+		if (!ret)
+			break;
+	}
+	for (i = 0; i < s->uart.nr; i++) {
+		if (ret)
+			s->p[i].stats.recover_failures++;
+		else
+			s->p[i].stats.recoveries++;
+	}
+	WRITE_ONCE(s->recovering, false);
+	mutex_unlock(&s->mutex);
+	mutex_unlock(&s->mutex_irq);
+	enable_irq(s->p[0].port.irq);
+
+	if (!ret) {
+		dev_info(&s->spi_dev->dev, "chip re-initialised after spi errors\n");
+		return;
+	}
+	dev_err_ratelimited(&s->spi_dev->dev, "chip not recovered after %d attempts: %d\n", try, ret);
+	if (READ_ONCE(s->running))
+		schedule_delayed_work(&s->recover_work, msecs_to_jiffies(CH43X_RECOVER_RETRY_MS));
+}
+
+/*
+ * RS485 address demultiplexer: the first byte of every received frame is
+ * taken as slave address and the frame is queued on the character device
+ * of that address. A frame ends on RX time-out (the chip's 4 character gap)
+ * or, if the FIFO was drained exactly at the end of a frame, when no further
+ * RX interrupt arrived within CH43X_DEMUX_GAP_CHARS character times.
+ * A frame with a break, parity, framing or overrun error is still queued
+ * with CH43X_DEMUX_FRAME_ERR set, its read fails with -EIO.
+ */
+static void ch43x_demux_end_frame(struct ch43x_demux *dm)
+{
+	struct ch43x_demux_node *node = dm->cur;
+
+	/* a gap timer armed by an earlier pass must not cut the next frame */
+	hrtimer_try_to_cancel(&dm->gap_timer);
+	if (dm->in_frame && node && dm->len) {
+		kfifo_put(&node->frames, (u16)(dm->len | (dm->bad ? CH43X_DEMUX_FRAME_ERR : 0)));
+		wake_up_interruptible(&node->wait);
+		dm->frames++;
+		if (dm->bad)
+			dm->errors++;
+	}
+	dm->in_frame = false;
+	dm->bad = false;
+	dm->cur = NULL;
+	dm->len = 0;
+}
+
+/* lsr is already masked with read_status_mask */
+static void ch43x_demux_rx(struct uart_port *port, struct ch43x_one *one, unsigned int lsr,
+			   unsigned char ch)
+{
+	struct ch43x_demux *dm = &one->demux;
+	unsigned long flags;
+
+	/* IGNPAR and IGNBRK drop the byte like uart_insert_char() does */
+	if (unlikely(lsr & port->ignore_status_mask & ~CH43X_LSR_OE_BIT))
+		return;
+
+	spin_lock_irqsave(&dm->lock, flags);
+	if (unlikely(!dm->enabled))
+		goto out;
+	if (!dm->in_frame) {
+		dm->in_frame = true;
+		dm->bad = false;
+		dm->len = 0;
+		dm->cur = dm->node[ch];
+		if (dm->cur && kfifo_is_full(&dm->cur->frames))
+			dm->cur = NULL;
+		if (!dm->cur)
+			dm->dropped++;
+	}
+	/* a truncated frame is still queued, the slave handler checks the CRC */
+	if (dm->cur && dm->len < CH43X_DEMUX_FRAME_LEN && kfifo_in(&dm->cur->data, &ch, 1))
+		dm->len++;
+	if (unlikely(lsr & CH43X_LSR_BRK_ERROR_MASK))
+		dm->bad = true;
+out:
+	spin_unlock_irqrestore(&dm->lock, flags);
+}
+
+static void ch43x_demux_pass_end(struct ch43x_one *one, bool timeout)
+{
+	struct ch43x_demux *dm = &one->demux;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dm->lock, flags);
+	if (timeout)
+		ch43x_demux_end_frame(dm);
+	else if (dm->enabled && dm->in_frame)
+		hrtimer_start(&dm->gap_timer, dm->gap, HRTIMER_MODE_REL);
+	spin_unlock_irqrestore(&dm->lock, flags);
+}
+
+static enum hrtimer_restart ch43x_demux_gap_expired(struct hrtimer *timer)
+{
+	struct ch43x_demux *dm = container_of(timer, struct ch43x_demux, gap_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&dm->lock, flags);
+	ch43x_demux_end_frame(dm);
+	spin_unlock_irqrestore(&dm->lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+static void ch43x_demux_set_baud(struct ch43x_one *one, int baud)
+{
+	u64 gap = div_u64((u64)CH43X_DEMUX_GAP_CHARS * 10 * NSEC_PER_SEC, baud);
+
+	one->demux.gap = ns_to_ktime(gap + NSEC_PER_MSEC);
+}
+
+static void ch43x_demux_node_release(struct kref *kref)
+{
+	struct ch43x_demux_node *node = container_of(kref, struct ch43x_demux_node, kref);
+
+	kfifo_free(&node->data);
+	kfree(node);
+}
+
+static int ch43x_demux_open(struct inode *inode, struct file *file)
+{
+	struct ch43x_demux_node *node = container_of(file->private_data, struct ch43x_demux_node, misc);
+
+	kref_get(&node->kref);
+	file->private_data = node;
+
+	return nonseekable_open(inode, file);
+}
+
+static int ch43x_demux_release(struct inode *inode, struct file *file)
+{
+	struct ch43x_demux_node *node = file->private_data;
+
+	kref_put(&node->kref, ch43x_demux_node_release);
+
+	return 0;
+}
+
+static ssize_t ch43x_demux_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct ch43x_demux_node *node = file->private_data;
+	unsigned int copied;
+	u16 len;
+	int ret;
+
+	if (mutex_lock_interruptible(&node->read_lock))
+		return -ERESTARTSYS;
+
+	while (!node->partial) {
+		if (kfifo_get(&node->frames, &len)) {
+			if (len & CH43X_DEMUX_FRAME_ERR) {
+				/* skip the damaged frame, the next read gets the following one */
+				for (len &= CH43X_DEMUX_FRAME_LEN; len; len--)
+					kfifo_skip(&node->data);
+				ret = -EIO;
+				goto out;
+			}
+			node->partial = len;
+			break;
+		}
+		if (node->dead) {
+			ret = -ENODEV;
+			goto out;
+		}
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			goto out;
+		}
+		mutex_unlock(&node->read_lock);
+		if (wait_event_interruptible(node->wait, !kfifo_is_empty(&node->frames) || node->dead))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&node->read_lock))
+			return -ERESTARTSYS;
+	}
+
+	/* never return more than the rest of the current frame */
+	ret = kfifo_to_user(&node->data, buf, min_t(size_t, count, node->partial), &copied);
+	if (!ret) {
+		node->partial -= copied;
+		ret = copied;
+	}
+out:
+	mutex_unlock(&node->read_lock);
+	return ret;
+}
+
+static __poll_t ch43x_demux_poll(struct file *file, poll_table *wait)
+{
+	struct ch43x_demux_node *node = file->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(file, &node->wait, wait);
+	if (node->partial || !kfifo_is_empty(&node->frames))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (node->dead)
+		mask |= EPOLLHUP;
+
+	return mask;
+}
+
+static const struct file_operations ch43x_demux_fops = {
+	.owner = THIS_MODULE,
+	.open = ch43x_demux_open,
+	.release = ch43x_demux_release,
+	.read = ch43x_demux_read,
+	.poll = ch43x_demux_poll,
+	.llseek = no_llseek,
+};
+
+static void ch43x_demux_disable(struct ch43x_one *one)
+{
+	struct ch43x_demux *dm = &one->demux;
+	struct ch43x_demux_node *node;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&dm->lock, flags);
+	dm->enabled = false;
+	dm->in_frame = false;
+	dm->bad = false;
+	dm->cur = NULL;
+	spin_unlock_irqrestore(&dm->lock, flags);
+	hrtimer_cancel(&dm->gap_timer);
+
+	for (i = 0; i < 256; i++) {
+		spin_lock_irqsave(&dm->lock, flags);
+		node = dm->node[i];
+		dm->node[i] = NULL;
+		spin_unlock_irqrestore(&dm->lock, flags);
+		if (!node)
+			continue;
+		misc_deregister(&node->misc);
+		node->dead = true;
+		wake_up_interruptible(&node->wait);
+		kref_put(&node->kref, ch43x_demux_node_release);
+	}
+}
+
+/* the demultiplexer must be disabled when this is called */
+static int ch43x_demux_enable(struct ch43x_one *one, const unsigned long *addrs)
+{
+	struct ch43x_demux *dm = &one->demux;
+	struct ch43x_demux_node *node;
+	unsigned long flags;
+	int i, ret;
+
+	for_each_set_bit(i, addrs, 256) {
+		node = kzalloc(sizeof(*node), GFP_KERNEL);
+		if (!node) {
+			ret = -ENOMEM;
+			goto err;
+		}
+		if (kfifo_alloc(&node->data, CH43X_DEMUX_FIFO_SIZE, GFP_KERNEL)) {
+			kfree(node);
+			ret = -ENOMEM;
+			goto err;
+		}
+		kref_init(&node->kref);
+		INIT_KFIFO(node->frames);
+		init_waitqueue_head(&node->wait);
+		mutex_init(&node->read_lock);
+		node->addr = i;
+		snprintf(node->name, sizeof(node->name), "ttyWCH%d.%d", one->port.line, i);
+		node->misc.minor = MISC_DYNAMIC_MINOR;
+		node->misc.name = node->name;
+		node->misc.fops = &ch43x_demux_fops;
+		node->misc.parent = one->port.dev;
+		ret = misc_register(&node->misc);
+		if (ret) {
+			kref_put(&node->kref, ch43x_demux_node_release);
+			goto err;
+		}
+		spin_lock_irqsave(&dm->lock, flags);
+		dm->node[i] = node;
+		spin_unlock_irqrestore(&dm->lock, flags);
+	}
+
+	spin_lock_irqsave(&dm->lock, flags);
+	dm->in_frame = false;
+	dm->enabled = true;
+	spin_unlock_irqrestore(&dm->lock, flags);
+
+	return 0;
+
+err:
+	ch43x_demux_disable(one);
+	return ret;
+}
+
+/*
+ * Raw bulk device: while it is open, received data bypasses the tty layer
+ * and goes into a ring that the reader mmaps, and written data is fed to
+ * the TX FIFO refill ahead of the tty transmit buffer. Line settings still
+ * come from the ttyWCH port, which must be open.
+ */
+static inline void ch43x_raw_rx(struct uart_port *port, struct ch43x_raw *raw, unsigned int lsr,
+				unsigned char ch)
+{
+	struct ch43x_raw_ring *ring = raw->ring;
+
+	/* the ring has no room for per byte flags, count them in the header */
+	if (unlikely(lsr & CH43X_LSR_BRK_ERROR_MASK)) {
+		if (lsr & CH43X_LSR_OE_BIT)
+			ring->fifo_overruns++;
+		if (lsr & CH43X_LSR_BI_BIT) {
+			ring->breaks++;
+			return;
+		}
+		if (lsr & CH43X_LSR_PE_BIT)
+			ring->parity_errors++;
+		else if (lsr & CH43X_LSR_FE_BIT)
+			ring->frame_errors++;
+		/* IGNPAR drops the byte like uart_insert_char() does */
+		if (lsr & port->ignore_status_mask & ~CH43X_LSR_OE_BIT)
+			return;
+	}
+	if (unlikely(raw->head - smp_load_acquire(&ring->tail) >= CH43X_RAW_RING_SIZE)) {
+		ring->overruns++;
+		return;
+	}
+	raw->data[raw->head & (CH43X_RAW_RING_SIZE - 1)] = ch;
+	raw->head++;
+}
+
+static void ch43x_raw_pass_end(struct ch43x_raw *raw)
+{
+	smp_store_release(&raw->ring->head, raw->head);
+	wake_up_interruptible(&raw->wait);
+}
+
+static int ch43x_raw_open(struct inode *inode, struct file *file)
+{
+	struct ch43x_one *one = container_of(file->private_data, struct ch43x_one, raw.misc);
+	struct ch43x_raw *raw = &one->raw;
+	int ret = 0;
+
+	if (!tty_port_initialized(&one->port.state->port))
+		return -ENXIO;
+
+	mutex_lock(&raw->lock);
+	if (raw->open) {
+		ret = -EBUSY;
+		goto out;
+	}
+	raw->ring = vmalloc_user(PAGE_SIZE + CH43X_RAW_RING_SIZE);
+	if (!raw->ring) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (kfifo_alloc(&raw->tx, CH43X_RAW_TX_SIZE, GFP_KERNEL)) {
+		vfree(raw->ring);
+		ret = -ENOMEM;
+		goto out;
+	}
+	raw->ring->size = CH43X_RAW_RING_SIZE;
+	raw->data = (unsigned char *)raw->ring + PAGE_SIZE;
+	raw->head = 0;
+	file->private_data = one;
+	smp_store_release(&raw->open, true);
+out:
+	mutex_unlock(&raw->lock);
+	return ret ? ret : nonseekable_open(inode, file);
+}
+
+static int ch43x_raw_release(struct inode *inode, struct file *file)
+{
+	struct ch43x_one *one = file->private_data;
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+	struct ch43x_raw *raw = &one->raw;
+
+	mutex_lock(&raw->lock);
+	/*
+	 * the tx refill runs under s->mutex, the rx drain under mutex_irq from
+	 * the irq thread or the watchdog work, so synchronize_irq() is not enough
+	 */
+	mutex_lock(&s->mutex_irq);
+	mutex_lock(&s->mutex);
+	raw->open = false;
+	mutex_unlock(&s->mutex);
+	mutex_unlock(&s->mutex_irq);
+
+	kfifo_free(&raw->tx);
+	vfree(raw->ring);
+	raw->ring = NULL;
+	mutex_unlock(&raw->lock);
+
+	return 0;
+}
+
+static ssize_t ch43x_raw_dev_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct ch43x_one *one = file->private_data;
+	struct ch43x_raw *raw = &one->raw;
+	struct ch43x_raw_ring *ring = raw->ring;
+	u32 head, tail, off, len;
+
+	for (;;) {
+		head = smp_load_acquire(&ring->head);
+		tail = READ_ONCE(ring->tail);
+		if (head != tail)
+			break;
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(raw->wait, smp_load_acquire(&ring->head) != READ_ONCE(ring->tail)))
+			return -ERESTARTSYS;
+	}
+
+	off = tail & (CH43X_RAW_RING_SIZE - 1);
+	len = min3((size_t)(head - tail), count, (size_t)(CH43X_RAW_RING_SIZE - off));
+	if (copy_to_user(buf, raw->data + off, len))
+		return -EFAULT;
+	smp_store_release(&ring->tail, tail + len);
+
+	return len;
+}
+
+static ssize_t ch43x_raw_dev_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct ch43x_one *one = file->private_data;
+	struct ch43x_raw *raw = &one->raw;
+	unsigned int copied;
+	int ret;
+
+	if (mutex_lock_interruptible(&raw->lock))
+		return -ERESTARTSYS;
+	while (kfifo_is_full(&raw->tx)) {
+		mutex_unlock(&raw->lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(raw->wait, !kfifo_is_full(&raw->tx)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&raw->lock))
+			return -ERESTARTSYS;
+	}
+	ret = kfifo_from_user(&raw->tx, buf, count, &copied);
+	mutex_unlock(&raw->lock);
+	if (ret)
+		return ret;
+
+	if (!work_pending(&one->tx_work))
+		schedule_work(&one->tx_work);
+
+	return copied;
+}
+
+static __poll_t ch43x_raw_poll(struct file *file, poll_table *wait)
+{
+	struct ch43x_one *one = file->private_data;
+	struct ch43x_raw *raw = &one->raw;
+	__poll_t mask = 0;
+
+	poll_wait(file, &raw->wait, wait);
+	if (smp_load_acquire(&raw->ring->head) != READ_ONCE(raw->ring->tail))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (!kfifo_is_full(&raw->tx))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+static int ch43x_raw_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ch43x_one *one = file->private_data;
+
+	return remap_vmalloc_range(vma, one->raw.ring, vma->vm_pgoff);
+}
+
+static const struct file_operations ch43x_raw_fops = {
+	.owner = THIS_MODULE,
+	.open = ch43x_raw_open,
+	.release = ch43x_raw_release,
+	.read = ch43x_raw_dev_read,
+	.write = ch43x_raw_dev_write,
+	.poll = ch43x_raw_poll,
+	.mmap = ch43x_raw_mmap,
+	.llseek = no_llseek,
+};
+
+static int ch43x_raw_register(struct ch43x_one *one)
+{
+	struct ch43x_raw *raw = &one->raw;
+
+	init_waitqueue_head(&raw->wait);
+	mutex_init(&raw->lock);
+	snprintf(raw->name, sizeof(raw->name), "ttyWCHraw%d", one->port.line);
+	raw->misc.minor = MISC_DYNAMIC_MINOR;
+	raw->misc.name = raw->name;
+	raw->misc.fops = &ch43x_raw_fops;
+	raw->misc.parent = one->port.dev;
+
+	return misc_register(&raw->misc);
+}
+
+/* called from the irq thread for every received byte while a benchmark runs */
+static void ch43x_bench_rx(struct ch43x_bench *b, unsigned char ch)
+{
+	if (b->echo_wait) {
+		if (ch != b->echo_byte) {
+			b->errors++;
+			return;
+		}
+		ch43x_hist_add(&b->rtt, ktime_get_ns() - b->echo_ts);
+		b->echo_wait = false;
+		complete(&b->echo_done);
+		return;
+	}
+	if (ch != b->rx_seq)
+		b->errors++;
+	b->rx_seq = ch + 1;
+	b->received++;
+}
+
+/* LSR for the rx path, with the error bits other LSR reads of the port took off the chip */
+static int ch43x_rx_lsr(struct uart_port *port)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	struct ch43x_one *one = to_ch43x_one(port, port);
+	int ret;
+
+	ret = ch43x_port_read(port, CH43X_LSR_REG);
+	if (ret < 0)
+		return ret;
+	ch43x_bus_lock(s);
+	ret |= one->lsr_err;
+	one->lsr_err = 0;
+	ch43x_bus_unlock(s);
+
+	return ret;
+}
+
+/* hands one received byte to whoever has the port */
+static void ch43x_rx_char(struct uart_port *port, unsigned int lsr, unsigned int ch, unsigned int flag)
+{
+	struct ch43x_one *one = to_ch43x_one(port, port);
+
+	if (uart_handle_sysrq_char(port, ch))
+		return;
+	if (one->bench.active)
+		ch43x_bench_rx(&one->bench, ch);
+	else if (one->raw.open)
+		ch43x_raw_rx(port, &one->raw, lsr, ch);
+	else if (one->demux.enabled)
+		ch43x_demux_rx(port, one, lsr, ch);
+	else
+		uart_insert_char(port, lsr, CH43X_LSR_OE_BIT, ch, flag);
+}
+
+static void ch43x_handle_rx(struct uart_port *port, unsigned int iir)
+{
+    struct ch43x_port *s = dev_get_drvdata(port->dev);
+    struct ch43x_one *one = to_ch43x_one(port, port);
+    unsigned int lsr = 0, ch, flag, bytes_read = 0;
+    unsigned char burst[CH43X_RX_TRIG];
+    u64 drained;
+    bool read_lsr = (iir == CH43X_IIR_RLSE_SRC) ? true : false;
+    int ret, i;
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	/* Only read lsr if there are possible errors in FIFO */
+	if (read_lsr) {
+		ret = ch43x_rx_lsr(port);
+		if (ret < 0)
+			goto out;
+		lsr = ret;
+		/* No errors left in FIFO, or none at its head */
+		if (!(lsr & (CH43X_LSR_FIFOE_BIT | CH43X_LSR_BRK_ERROR_MASK)) || !(lsr & CH43X_LSR_DR_BIT))
+			read_lsr = false;
+	} else
+		lsr = 0;
+
+	/* At lest one error left in FIFO */
+	if (read_lsr) {
+		ret = ch43x_port_read(port, CH43X_RHR_REG);
+		if (ret < 0)
+			goto out;
+		ch = ret;
+		bytes_read = 1;
+
+		goto ch_handler;
+	} else {
+		/*
+		 * a failed read ends the pass, the recovery services the port
+		 * again; DR that never shows up means IIR was corrupted on the
+		 * bus, the next IIR read decides what is really pending
+		 */
+		for (i = 0; i < CH43X_RX_DR_READS; i++) {
+			ch43x_bus_yield(s);
+			ret = ch43x_rx_lsr(port);
+			if (ret < 0 || (ret & CH43X_LSR_DR_BIT))
+				break;
+			lsr |= ret & CH43X_LSR_BRK_ERROR_MASK;
+		}
+		if (ret < 0)
+			goto out;
+		if (!(ret & CH43X_LSR_DR_BIT)) {
+			one->stats.rx_no_data++;
+			goto out;
+		}
+		/* errors read without a byte go with the next one */
+		lsr = ret | (lsr & CH43X_LSR_BRK_ERROR_MASK);
+
+		/*
+		 * RDI: the trigger level was in the FIFO when IIR was read, and
+		 * without errors in the FIFO those bytes come in one burst
+		 */
+		if (iir == CH43X_IIR_RDI_SRC && !(lsr & (CH43X_LSR_BRK_ERROR_MASK | CH43X_LSR_FIFOE_BIT))) {
+			if (ch43x_raw_read(port, burst, CH43X_RX_TRIG) < 0)
+				goto out;
+			bytes_read = CH43X_RX_TRIG;
+			port->icount.rx += CH43X_RX_TRIG;
+			for (i = 0; i < CH43X_RX_TRIG; i++)
+				ch43x_rx_char(port, 0, burst[i], TTY_NORMAL);
+			ch43x_bus_yield(s);
+			ret = ch43x_rx_lsr(port);
+			if (ret < 0)
+				goto out;
+			lsr = ret;
+		}
+
+		do {
+			if (likely(lsr & CH43X_LSR_DR_BIT)) {
+				ret = ch43x_port_read(port, CH43X_RHR_REG);
+				if (ret < 0)
+					break;
+				ch = ret;
+				bytes_read++;
+			} else
+				break;
+ch_handler:
+			flag = TTY_NORMAL;
+			port->icount.rx++;
+
+			if (unlikely(lsr & CH43X_LSR_BRK_ERROR_MASK)) {
+				if (lsr & CH43X_LSR_BI_BIT) {
+					lsr &= ~(CH43X_LSR_FE_BIT | CH43X_LSR_PE_BIT);
+					port->icount.brk++;
+					if (uart_handle_break(port))
+						goto ignore_char;
+				} else if (lsr & CH43X_LSR_PE_BIT)
+					port->icount.parity++;
+				else if (lsr & CH43X_LSR_FE_BIT)
+					port->icount.frame++;
+				else if (lsr & CH43X_LSR_OE_BIT)
+					port->icount.overrun++;
+
+				lsr &= port->read_status_mask;
+				flag = ch43x_lsr_flag(lsr);
+
+				if (lsr & CH43X_LSR_OE_BIT) {
+					one->stats.overruns++;
+					dev_err(&s->spi_dev->dev, "%s - overrun detect\n", __func__);
+				}
+			}
+
+			ch43x_rx_char(port, lsr, ch, flag);
+ignore_char:
+			ch43x_bus_yield(s);
+			ret = ch43x_rx_lsr(port);
+			lsr = ret < 0 ? 0 : ret;
+		} while ((lsr & CH43X_LSR_DR_BIT));
+	}
+out:
+	dev_vdbg(&s->spi_dev->dev, "%s-bytes_read:%d\n", __func__, bytes_read);
+	one->stats.rx_bytes += bytes_read;
+	one->stats.rx_passes++;
+	if (bytes_read > one->stats.rx_max_pass)
+		one->stats.rx_max_pass = bytes_read;
+	drained = ktime_get_ns();
+	ch43x_hist_add(&one->lat[CH43X_LAT_RX_DRAIN], drained - s->thread_ts);
+	/* the benchmark has nothing to hand on */
+	if (!one->bench.active) {
+		if (one->raw.open)
+			ch43x_raw_pass_end(&one->raw);
+		else if (one->demux.enabled)
+			ch43x_demux_pass_end(one, iir == CH43X_IIR_RTOI_SRC);
+		else
+			tty_flip_buffer_push(&port->state->port);
+	}
+	ch43x_hist_add(&one->lat[CH43X_LAT_RX_PUSH], ktime_get_ns() - drained);
+}
+
+static void ch43x_handle_tx(struct uart_port *port)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	struct ch43x_one *one = to_ch43x_one(port, port);
+	struct circ_buf *xmit = &port->state->xmit;
+	unsigned int txlen, to_send, i;
+	unsigned char thr_reg;
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	/* xon/xoff char */
+	if (unlikely(port->x_char)) {
+		ch43x_port_write(port, CH43X_THR_REG, port->x_char);
+		port->icount.tx++;
+		port->x_char = 0;
+		return;
+	}
+
+	/* the benchmark streams its pattern until it stops */
+	if (one->bench.active) {
+		struct ch43x_bench *b = &one->bench;
+
+		if (!b->streaming) {
+			ch43x_port_update(port, CH43X_IER_REG, CH43X_IER_THRI_BIT, 0);
+			return;
+		}
+		for (i = 0; i < CH43X_FIFO_SIZE; i++)
+			s->buf[i] = b->tx_seq++;
+		b->sent += CH43X_FIFO_SIZE;
+		one->stats.tx_bytes += CH43X_FIFO_SIZE;
+		one->stats.tx_refills++;
+		thr_reg = ch43x_cmd_write(port->line, CH43X_THR_REG);
+		ch43x_raw_write(port, &thr_reg, s->buf, CH43X_FIFO_SIZE);
+		return;
+	}
+
+	if (uart_tx_stopped(port)) {
+		dev_vdbg(&s->spi_dev->dev, "ch43x_handle_tx stopped\n");
+		ch43x_port_update(port, CH43X_IER_REG, CH43X_IER_THRI_BIT, 0);
+		return;
+	}
+
+	/* raw device data goes first, it does not wait for the tty */
+	if (one->raw.open && !kfifo_is_empty(&one->raw.tx)) {
+		to_send = kfifo_out(&one->raw.tx, s->buf, CH43X_FIFO_SIZE);
+		port->icount.tx += to_send;
+		one->stats.tx_bytes += to_send;
+		one->stats.tx_refills++;
+		thr_reg = ch43x_cmd_write(port->line, CH43X_THR_REG);
+		ch43x_raw_write(port, &thr_reg, s->buf, to_send);
+		wake_up_interruptible(&one->raw.wait);
+		return;
+	}
+
+	if (uart_circ_empty(xmit)) {
+		dev_vdbg(&s->spi_dev->dev, "ch43x_handle_tx stopped\n");
+		// add on 20200608
+		ch43x_port_update(port, CH43X_IER_REG, CH43X_IER_THRI_BIT, 0);
+		return;
+	}
+
+	/* Get length of data pending in circular buffer */
+	to_send = uart_circ_chars_pending(xmit);
+
+	if (likely(to_send)) {
+		/* Limit to size of TX FIFO */
+		txlen = CH43X_FIFO_SIZE;
+		to_send = (to_send > txlen) ? txlen : to_send;
+
+		/* Add data to send */
+		port->icount.tx += to_send;
+		one->stats.tx_bytes += to_send;
+		one->stats.tx_refills++;
+
+		/* Convert to linear buffer */
+		for (i = 0; i < to_send; ++i) {
+			s->buf[i] = xmit->buf[xmit->tail];
+			xmit->tail = (xmit->tail + 1) & (UART_XMIT_SIZE - 1);
+		}
+		dev_vdbg(&s->spi_dev->dev, "ch43x_handle_tx %d bytes\n", to_send);
+		thr_reg = ch43x_cmd_write(port->line, CH43X_THR_REG);
+		ch43x_raw_write(port, &thr_reg, s->buf, to_send);
+	}
+
+	if (uart_circ_chars_pending(xmit) < WAKEUP_CHARS)
+		uart_write_wakeup(port);
+}
+
+/* the port can raise INT: an interrupt enabled and OUT2 set */
+static bool ch43x_irq_armed(struct ch43x_one *one)
+{
+	return (READ_ONCE(one->shadow.ier) & CH43X_IER_INT_MASK) && (READ_ONCE(one->shadow.mcr) & CH43X_MCR_OUT2);
+}
+
+/*
+ * Interrupt storms. A floating CTS or DCD line, or line errors on a noisy
+ * bus, can raise MSI or RLSE back to back, each costing several spi
+ * messages and starving the other port. A source firing CH43X_STORM_EVENTS
+ * times within CH43X_STORM_WINDOW_MS is masked in IER and polled every
+ * CH43X_STORM_POLL_MS instead: MSR for the modem lines, the line error
+ * counts of the rx path for RLSE. After CH43X_STORM_QUIET polls without
+ * activity the interrupt is enabled again. Called under mutex_irq.
+ */
+static void ch43x_storm_event(struct ch43x_port *s, int portno, int src)
+{
+	struct ch43x_one *one = &s->p[portno];
+	struct ch43x_storm *st = &one->storm[src];
+	u64 now = ktime_get_ns();
+
+	if (now - st->window > (u64)CH43X_STORM_WINDOW_MS * NSEC_PER_MSEC) {
+		st->window = now;
+		st->events = 0;
+	}
+	if (++st->events < CH43X_STORM_EVENTS || st->masked)
+		return;
+	st->masked = true;
+	st->quiet = 0;
+	if (src == CH43X_STORM_MSI)
+		one->stats.msi_storms++;
+	else
+		one->stats.rls_storms++;
+	one->storm_errors = one->port.icount.frame + one->port.icount.parity + one->port.icount.brk +
+			    one->port.icount.overrun;
+	dev_warn_ratelimited(one->port.dev, "port %d: %s interrupt storm, polling\n", portno,
+			     ch43x_storm_names[src]);
+	/* one locked read-modify-write, the tx work may change THRI meanwhile */
+	ch43x_port_update(&one->port, CH43X_IER_REG, ch43x_storm_ier[src], 0);
+	schedule_delayed_work(&one->storm_work, msecs_to_jiffies(CH43X_STORM_POLL_MS));
+}
+
+static void ch43x_storm_poll(struct ch43x_one *one, int src, bool active)
+{
+	struct ch43x_storm *st = &one->storm[src];
+
+	if (active) {
+		st->quiet = 0;
+		return;
+	}
+	if (++st->quiet < CH43X_STORM_QUIET)
+		return;
+	st->masked = false;
+	st->events = 0;
+	st->window = ktime_get_ns();
+	ch43x_port_update(&one->port, CH43X_IER_REG, ch43x_storm_ier[src], ch43x_storm_ier[src]);
+}
+
+static void ch43x_storm_work_proc(struct work_struct *ws)
+{
+	struct ch43x_one *one = container_of(to_delayed_work(ws), struct ch43x_one, storm_work);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+	struct uart_port *port = &one->port;
+	bool masked = false;
+	u32 errors;
+	int i, ret;
+
+	mutex_lock(&s->mutex_irq);
+	/* the port was closed, startup enables the interrupts again */
+	if (!ch43x_irq_armed(one)) {
+		for (i = 0; i < CH43X_STORM_NR; i++)
+			one->storm[i].masked = false;
+		goto out;
+	}
+	one->stats.storm_polls++;
+	if (one->storm[CH43X_STORM_MSI].masked) {
+		ret = ch43x_port_read(port, CH43X_MSR_REG);
+		if (ret >= 0) {
+			one->msr_reg = ret;
+			ch43x_storm_poll(one, CH43X_STORM_MSI, ret & (CH43X_MSR_DCTS_BIT | CH43X_MSR_DDSR_BIT |
+								      CH43X_MSR_DRI_BIT | CH43X_MSR_DCD_BIT));
+		}
+	}
+	/* with RLSI masked the rx path still reads LSR and counts the errors of each byte */
+	errors = port->icount.frame + port->icount.parity + port->icount.brk + port->icount.overrun;
+	if (one->storm[CH43X_STORM_RLS].masked)
+		ch43x_storm_poll(one, CH43X_STORM_RLS, errors != one->storm_errors);
+	one->storm_errors = errors;
+	for (i = 0; i < CH43X_STORM_NR; i++)
+		masked |= one->storm[i].masked;
+out:
+	mutex_unlock(&s->mutex_irq);
+	if (masked && READ_ONCE(s->running))
+		schedule_delayed_work(&one->storm_work, msecs_to_jiffies(CH43X_STORM_POLL_MS));
+}
+
+/* serves one interrupt source of a port, iir already masked with CH43X_IIR_ID_MASK */
+static int ch43x_port_source(struct ch43x_port *s, int portno, unsigned int iir, u64 iir_ts)
+{
+	struct uart_port *port = &s->p[portno].port;
+	struct ch43x_one *one = &s->p[portno];
+	bool held;
+	int ret;
+
+	one->stats.irqs++;
+	trace_ch43x_port_irq(portno, iir);
+	switch (iir) {
+	case CH43X_IIR_RDI_SRC:
+	case CH43X_IIR_RTOI_SRC:
+		ch43x_handle_rx(port, iir);
+		break;
+	case CH43X_IIR_RLSE_SRC:
+		ch43x_handle_rx(port, iir);
+		ch43x_storm_event(s, portno, CH43X_STORM_RLS);
+		break;
+	case CH43X_IIR_MSI_SRC:
+		ret = ch43x_port_read(port, CH43X_MSR_REG);
+		if (ret < 0)
+			return ret;
+		s->p[portno].msr_reg = ret;
+		dev_vdbg(&s->spi_dev->dev, "uart_handle_modem_change = 0x%02x\n", ret);
+		ch43x_storm_event(s, portno, CH43X_STORM_MSI);
+		break;
+	case CH43X_IIR_THRI_SRC:
+		/* s->mutex goes before the bus, a pass holding it must not wait for s->mutex */
+		if (!mutex_trylock(&s->mutex)) {
+			held = s->bus_owner == current;
+			if (held)
+				ch43x_bus_release(s);
+			mutex_lock(&s->mutex);
+			if (held)
+				ch43x_bus_hold(s);
+		}
+		ch43x_handle_tx(port);
+		mutex_unlock(&s->mutex);
+		ch43x_hist_add(&one->lat[CH43X_LAT_TX_REFILL], ktime_get_ns() - iir_ts);
+		break;
+	default:
+		/* not a source the chip has, the read was corrupted on the bus */
+		dev_err(port->dev, "Port %i: Unexpected interrupt: %x", port->line, iir);
+		ch43x_bus_lock(s);
+		ch43x_spi_failed(s, portno, CH43X_IIR_REG, -EIO);
+		ch43x_bus_unlock(s);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * Serves the port until IIR shows no interrupt, at most CH43X_IRQ_MAX_LOOPS
+ * sources so that a port that keeps interrupting cannot starve the other
+ * one. Returns true if it stopped at that limit with work left, and sets
+ * *served if it served a source.
+ */
+static bool ch43x_port_irq(struct ch43x_port *s, int portno, u64 irq_lat, bool *served)
+{
+	struct uart_port *port = &s->p[portno].port;
+	struct ch43x_one *one = &s->p[portno];
+	int ret, loops = 0;
+
+	do {
+		unsigned int iir;
+
+		ch43x_bus_yield(s);
+		/* with the bus failing the chip is re-initialised, which raises INT again */
+		ret = ch43x_port_read(port, CH43X_IIR_REG);
+		if (ret < 0)
+			return false;
+		iir = ret;
+		if (iir & CH43X_IIR_NO_INT_BIT) {
+			dev_vdbg(&s->spi_dev->dev, "%s no int, quit\n", __func__);
+			return false;
+		}
+
+		/* LSR is left to the rx path, which counts an overrun with the byte it hits */
+
+		// add on 20200608
+		/*
+		msr = ch43x_port_read(port, CH43X_MSR_REG);
+		s->p[portno].msr_reg = msr; 
+		dev_vdbg(&s->spi_dev->dev, "uart_update_modem = 0x%02x\n", msr);
+		uart_handle_cts_change(port, !!(msr & CH43X_MSR_CTS_BIT));
+		*/
+
+		if (irq_lat) {
+			ch43x_hist_add(&one->lat[CH43X_LAT_IRQ_THREAD], irq_lat);
+			irq_lat = 0;
+		}
+		if (ch43x_port_source(s, portno, iir & CH43X_IIR_ID_MASK, ktime_get_ns()) < 0)
+			return false;
+		*served = true;
+	} while (++loops < CH43X_IRQ_MAX_LOOPS);
+
+	one->stats.irq_loop_limits++;
+	return true;
+}
+
+/*
+ * Serves the ports until INT is inactive. A source that becomes pending on
+ * a port already served keeps INT active without a new edge, so like
+ * serial8250_interrupt() this goes round the ports again until a round
+ * serves nothing, at most CH43X_IRQ_MAX_ROUNDS times. Returns true if work
+ * is left, the watchdog work follows up on it.
+ */
+static bool ch43x_serve_ports(struct ch43x_port *s, u64 irq_lat)
+{
+	bool more = false, served;
+	int i, rounds = 0;
+
+	do {
+		served = false;
+		for (i = 0; i < s->uart.nr; ++i)
+			more |= ch43x_port_irq(s, i, irq_lat, &served);
+		irq_lat = 0;
+	} while (served && !more && ++rounds < CH43X_IRQ_MAX_ROUNDS);
+
+	return more;
+}
+
+/* one pass over the ports, irq_ts is the hard irq time or 0 */
+static void ch43x_service(struct ch43x_port *s, u64 irq_ts)
+{
+	bool more;
+
+	mutex_lock(&s->mutex_irq);
+	ch43x_bus_hold(s);
+	s->thread_ts = ktime_get_ns();
+	more = ch43x_serve_ports(s, irq_ts ? s->thread_ts - irq_ts : 0);
+	ch43x_bus_release(s);
+	mutex_unlock(&s->mutex_irq);
+	if (more && READ_ONCE(s->running))
+		schedule_work(&s->watchdog_work);
+}
+
+static irqreturn_t ch43x_ist_top(int irq, void *dev_id)
+{
+	struct ch43x_port *s = (struct ch43x_port *)dev_id;
+
+	if (ch43x_fault_drop_irq(s))
+		return IRQ_HANDLED;
+	s->irq_ts = ktime_get_ns();
+
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t ch43x_ist(int irq, void *dev_id)
+{
+	struct ch43x_port *s = (struct ch43x_port *)dev_id;
+	u64 irq_ts = xchg(&s->irq_ts, 0);
+
+	dev_dbg(&s->spi_dev->dev, "ch43x_ist interrupt enter...\n");
+	trace_ch43x_irq_enter(irq);
+	WRITE_ONCE(s->irq_passes, s->irq_passes + 1);
+
+	ch43x_service(s, irq_ts);
+
+	trace_ch43x_irq_exit(irq);
+	dev_dbg(&s->spi_dev->dev, "%s end\n", __func__);
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * Interrupt watchdog. INT is edge triggered and shared by the ports, so an
+ * edge that is lost, or a source that becomes pending while the thread
+ * still serves the other port, leaves INT active with no further edge and
+ * both ports stalled. While a port has interrupts enabled and no irq pass
+ * ran for a tick, the watchdog reads IIR and serves what is pending, or a
+ * refill if THRI is enabled and THR is empty without IIR showing it. The
+ * tick is CH43X_WATCHDOG_CHARS character times of the fastest port while
+ * data moves, CH43X_WATCHDOG_IDLE_MS otherwise. Only ports that moved data
+ * within CH43X_WATCHDOG_IDLE_MS or wait for a refill are checked.
+ */
+static void ch43x_watchdog_work_proc(struct work_struct *ws)
+{
+	struct ch43x_port *s = container_of(ws, struct ch43x_port, watchdog_work);
+	unsigned int iir[CH43X_MAX_PORTS];
+	bool lost = false, more = false;
+	int i, ret;
+
+	if (READ_ONCE(s->recovering))
+		return;
+	mutex_lock(&s->mutex_irq);
+	ch43x_bus_hold(s);
+	for (i = 0; i < s->uart.nr; i++) {
+		struct ch43x_one *one = &s->p[i];
+
+		iir[i] = CH43X_IIR_NO_INT_BIT;
+		if (!ch43x_irq_armed(one))
+			continue;
+		one->stats.watchdog_polls++;
+		ret = ch43x_port_read(&one->port, CH43X_IIR_REG);
+		if (ret < 0)
+			continue;
+		if (ret & CH43X_IIR_NO_INT_BIT) {
+			/*
+			 * an IIR read that was corrupted on the bus cleared a
+			 * THRI unseen, the FIFO then stays empty for good
+			 */
+			if (!(READ_ONCE(one->shadow.ier) & CH43X_IER_THRI_BIT))
+				continue;
+			ret = ch43x_port_read(&one->port, CH43X_LSR_REG);
+			if (ret < 0 || !(ret & CH43X_LSR_THRE_BIT))
+				continue;
+			ret = CH43X_IIR_THRI_SRC;
+		}
+		/* reading IIR cleared a THRI, so the source is served from here */
+		iir[i] = ret & CH43X_IIR_ID_MASK;
+		one->stats.irq_lost++;
+		lost = true;
+	}
+	if (lost) {
+		dev_dbg(&s->spi_dev->dev, "%s: interrupt pending without an irq pass\n", __func__);
+		s->thread_ts = ktime_get_ns();
+		for (i = 0; i < s->uart.nr; i++)
+			if (!(iir[i] & CH43X_IIR_NO_INT_BIT))
+				ch43x_port_source(s, i, iir[i], s->thread_ts);
+		more = ch43x_serve_ports(s, 0);
+	}
+	ch43x_bus_release(s);
+	mutex_unlock(&s->mutex_irq);
+	if (more && READ_ONCE(s->running))
+		schedule_work(&s->watchdog_work);
+}
+
+static enum hrtimer_restart ch43x_watchdog_tick(struct hrtimer *timer)
+{
+	struct ch43x_port *s = container_of(timer, struct ch43x_port, watchdog);
+	u64 now = ktime_get_ns(), passes = READ_ONCE(s->irq_passes);
+	u64 bytes = 0, period = (u64)CH43X_WATCHDOG_IDLE_MS * NSEC_PER_MSEC;
+	bool armed = false;
+	int i;
+
+	for (i = 0; i < s->uart.nr; i++) {
+		struct ch43x_one *one = &s->p[i];
+		u8 ier = READ_ONCE(one->shadow.ier);
+		u64 char_ns = READ_ONCE(one->char_ns);
+
+		bytes += READ_ONCE(one->stats.rx_bytes) + READ_ONCE(one->stats.tx_bytes);
+		if (!ch43x_irq_armed(one))
+			continue;
+		armed = true;
+		/* a pending refill counts as moving data */
+		if (ier & CH43X_IER_THRI_BIT)
+			s->wd_active_until = now + (u64)CH43X_WATCHDOG_IDLE_MS * NSEC_PER_MSEC;
+		if (char_ns)
+			period = min(period, CH43X_WATCHDOG_CHARS * char_ns);
+	}
+	/* smaller after a stats reset */
+	if (bytes > s->wd_bytes)
+		s->wd_active_until = now + (u64)CH43X_WATCHDOG_IDLE_MS * NSEC_PER_MSEC;
+	/* an idle port costs no bus traffic, its next byte moves the data again */
+	if (armed && now < s->wd_active_until && passes == s->wd_passes && !READ_ONCE(s->recovering))
+		schedule_work(&s->watchdog_work);
+	s->wd_bytes = bytes;
+	s->wd_passes = passes;
+
+	if (now >= s->wd_active_until)
+		period = (u64)CH43X_WATCHDOG_IDLE_MS * NSEC_PER_MSEC;
+	hrtimer_forward_now(timer, ns_to_ktime(period));
+
+	return HRTIMER_RESTART;
+}
+
+static void ch43x_wq_proc(struct work_struct *ws)
+{
+	struct ch43x_one *one = to_ch43x_one(ws, tx_work);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	mutex_lock(&s->mutex);
+	ch43x_port_update(&one->port, CH43X_IER_REG, CH43X_IER_THRI_BIT, CH43X_IER_THRI_BIT);
+	//	ch43x_handle_tx(&one->port);
+	mutex_unlock(&s->mutex);
+}
+
+static void ch43x_stop_tx(struct uart_port *port)
+{
+	struct ch43x_one *one = to_ch43x_one(port, port);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	schedule_work(&one->stop_tx_work);
+}
+
+static void ch43x_stop_rx(struct uart_port *port)
+{
+	struct ch43x_one *one = to_ch43x_one(port, port);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	schedule_work(&one->stop_rx_work);
+}
+
+static void ch43x_start_tx(struct uart_port *port)
+{
+	struct ch43x_one *one = to_ch43x_one(port, port);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+
+	/* handle rs485 */
+	if ((one->rs485.flags & SER_RS485_ENABLED) && (one->rs485.delay_rts_before_send > 0)) {
+		mdelay(one->rs485.delay_rts_before_send);
+	}
+	if (!work_pending(&one->tx_work)) {
+		dev_dbg(&s->spi_dev->dev, "%s schedule\n", __func__);
+		schedule_work(&one->tx_work);
+	}
+}
+
+static void ch43x_stop_rx_work_proc(struct work_struct *ws)
+{
+	struct ch43x_one *one = to_ch43x_one(ws, stop_rx_work);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	mutex_lock(&s->mutex);
+	one->port.read_status_mask &= ~CH43X_LSR_DR_BIT;
+	ch43x_port_update(&one->port, CH43X_IER_REG, CH43X_IER_RDI_BIT, 0);
+	ch43x_port_update(&one->port, CH43X_IER_REG, CH43X_IER_RLSI_BIT, 0);
+	mutex_unlock(&s->mutex);
+}
+
+static void ch43x_stop_tx_work_proc(struct work_struct *ws)
+{
+	struct ch43x_one *one = to_ch43x_one(ws, stop_tx_work);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+	struct circ_buf *xmit = &one->port.state->xmit;
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	mutex_lock(&s->mutex);
+	/* handle rs485 */
+	if (one->rs485.flags & SER_RS485_ENABLED) {
+		/* do nothing if current tx not yet completed */
+		int lsr = ch43x_port_read(&one->port, CH43X_LSR_REG);
+		if (!(lsr & CH43X_LSR_TEMT_BIT)) {
+			mutex_unlock(&s->mutex);
+			return;
+		}
+		if (uart_circ_empty(xmit) && (one->rs485.delay_rts_after_send > 0))
+			mdelay(one->rs485.delay_rts_after_send);
+	}
+
+	/* raw device data still queued, the refill clears THRI once it is sent */
+	if (!uart_tx_stopped(&one->port) && one->raw.open && !kfifo_is_empty(&one->raw.tx)) {
+		mutex_unlock(&s->mutex);
+		return;
+	}
+	ch43x_port_update(&one->port, CH43X_IER_REG, CH43X_IER_THRI_BIT, 0);
+	mutex_unlock(&s->mutex);
+}
+
+static unsigned int ch43x_tx_empty(struct uart_port *port)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	int lsr;
+	unsigned int result;
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	lsr = ch43x_port_read(port, CH43X_LSR_REG);
+	/* do not keep a close waiting on a chip that cannot be read */
+	result = (lsr < 0 || (lsr & CH43X_LSR_THRE_BIT)) ? TIOCSER_TEMT : 0;
+
+	return result;
+}
+
+static unsigned int ch43x_get_mctrl(struct uart_port *port)
+{
+	unsigned int status, ret;
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	status = s->p[port->line].msr_reg;
+	ret = 0;
+	if (status & UART_MSR_DCD)
+		ret |= TIOCM_CAR;
+	if (status & UART_MSR_RI)
+		ret |= TIOCM_RNG;
+	if (status & UART_MSR_DSR)
+		ret |= TIOCM_DSR;
+	if (status & UART_MSR_CTS)
+		ret |= TIOCM_CTS;
+
+	return ret;
+}
+
+static void ch43x_md_proc(struct work_struct *ws)
+{
+	struct ch43x_one *one = to_ch43x_one(ws, md_work);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+	unsigned int mctrl = one->port.mctrl;
+	unsigned char mcr = 0;
+
+	if (mctrl & TIOCM_RTS) {
+		mcr |= UART_MCR_RTS;
+	}
+	if (mctrl & TIOCM_DTR) {
+		mcr |= UART_MCR_DTR;
+	}
+	if (mctrl & TIOCM_OUT1) {
+		mcr |= UART_MCR_OUT1;
+	}
+	if (mctrl & TIOCM_OUT2) {
+		mcr |= UART_MCR_OUT2;
+	}
+	if (mctrl & TIOCM_LOOP) {
+		mcr |= UART_MCR_LOOP;
+	}
+
+	mcr |= one->mcr_force;
+
+	dev_dbg(&s->spi_dev->dev, "%s - mcr:0x%x, force:0x%2x\n", __func__, mcr, one->mcr_force);
+
+	ch43x_port_write(&one->port, CH43X_MCR_REG, mcr);
+}
+
+static void ch43x_set_mctrl(struct uart_port *port, unsigned int mctrl)
+{
+	struct ch43x_one *one = to_ch43x_one(port, port);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+
+	dev_dbg(&s->spi_dev->dev, "%s - mctrl:0x%x\n", __func__, mctrl);
+	schedule_work(&one->md_work);
+}
+
+static void ch43x_break_ctl(struct uart_port *port, int break_state)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	ch43x_port_update(port, CH43X_LCR_REG, CH43X_LCR_TXBREAK_BIT, break_state ? CH43X_LCR_TXBREAK_BIT : 0);
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0))
+static void ch43x_set_termios(struct uart_port *port, struct ktermios *termios, const struct ktermios *old)
+#else
+static void ch43x_set_termios(struct uart_port *port, struct ktermios *termios, struct ktermios *old)
+#endif
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	struct ch43x_one *one = to_ch43x_one(port, port);
+	unsigned int lcr;
+	int baud;
+
+    dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+
+	/* Mask termios capabilities we don't support */
+	termios->c_cflag &= ~CMSPAR;
+
+	/* Word size, parity and stop bits, a word size the chip lacks becomes CS8 */
+	lcr = ch43x_termios_lcr(termios->c_cflag);
+	if ((lcr & CH43X_LCR_WORD_LEN_8) == CH43X_LCR_WORD_LEN_8) {
+		termios->c_cflag &= ~CSIZE;
+		termios->c_cflag |= CS8;
+	}
+	dev_vdbg(&s->spi_dev->dev, "%s - lcr:0x%02x\n", __func__, lcr);
+
+	/* Set read status mask */
+	port->read_status_mask = CH43X_LSR_OE_BIT;
+	if (termios->c_iflag & INPCK)
+		port->read_status_mask |= CH43X_LSR_PE_BIT | CH43X_LSR_FE_BIT;
+	if (termios->c_iflag & (BRKINT | PARMRK))
+		port->read_status_mask |= CH43X_LSR_BI_BIT;
+
+	/* Set status ignore mask */
+	port->ignore_status_mask = 0;
+	if (termios->c_iflag & IGNBRK)
+		port->ignore_status_mask |= CH43X_LSR_BI_BIT;
+	if (!(termios->c_cflag & CREAD))
+		port->ignore_status_mask |= CH43X_LSR_BRK_ERROR_MASK;
+
+	/* Update LCR register */
+	ch43x_port_write(port, CH43X_LCR_REG, lcr);
+
+	/* Configure flow control */
+	if (termios->c_cflag & CRTSCTS) {
+		dev_vdbg(&s->spi_dev->dev, "ch43x_set_termios enable rts/cts\n");
+		ch43x_port_update(port, CH43X_MCR_REG, CH43X_MCR_AFE | CH43X_MCR_RTS_BIT,
+				  CH43X_MCR_AFE | CH43X_MCR_RTS_BIT);
+		one->mcr_force |= CH43X_MCR_AFE | CH43X_MCR_RTS_BIT;
+		// add on 20200608 suppose cts status is always valid here
+		uart_handle_cts_change(port, 1);
+	} else {
+		dev_vdbg(&s->spi_dev->dev, "ch43x_set_termios disable rts/cts\n");
+		ch43x_port_update(port, CH43X_MCR_REG, CH43X_MCR_AFE, 0);
+		one->mcr_force &= ~(CH43X_MCR_AFE | CH43X_MCR_RTS_BIT);
+	}
+
+	/* Get baud rate generator configuration */
+	baud = uart_get_baud_rate(port, termios, old, port->uartclk / 16 / 0xffff, port->uartclk / 16 * 24);
+	/* Setup baudrate generator */
+	baud = ch43x_set_baud(port, baud);
+	ch43x_demux_set_baud(one, baud);
+	/* Update timeout according to new baud rate */
+	uart_update_timeout(port, termios->c_cflag, baud);
+}
+
+static void ch43x_config_rs485(struct uart_port *port, struct serial_rs485 *rs485)
+{
+	struct ch43x_one *one = to_ch43x_one(port, port);
+	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+
+	one->rs485 = *rs485;
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	if (one->rs485.flags & SER_RS485_ENABLED) {
+	} else {
+	}
+}
+
+static int ch43x_ioctl(struct uart_port *port, unsigned int cmd, unsigned long arg)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	struct serial_rs485 rs485;
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+
+	switch (cmd) {
+	case IOCTL_CMD_SRS485:
+		if (copy_from_user(&rs485, (void __user *)arg, sizeof(rs485)))
+			return -EFAULT;
+
+		ch43x_config_rs485(port, &rs485);
+		return 0;
+	case IOCTL_CMD_GRS485:
+		if (copy_to_user((void __user *)arg, &(to_ch43x_one(port, port)->rs485), sizeof(rs485)))
+			return -EFAULT;
+		return 0;
+	default:
+		break;
+	}
+
+	return -ENOIOCTLCMD;
+}
+
+static int ch43x_startup(struct uart_port *port)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	unsigned int val;
+	struct ch43x_one *one = to_ch43x_one(port, port);
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+
+	ch43x_power(port, 1);
+	/* Reset FIFOs*/
+	val = CH43X_FCR_RXRESET_BIT | CH43X_FCR_TXRESET_BIT;
+	ch43x_port_write(port, CH43X_FCR_REG, val);
+	udelay(5);
+	/* Enable FIFOs and configure interrupt & flow control levels to 8 */
+	ch43x_port_write(port, CH43X_FCR_REG, CH43X_FCR_RXLVLH_BIT | CH43X_FCR_FIFO_BIT);
+	/* errors of bytes from before the reset are not for this open */
+	ch43x_bus_lock(s);
+	one->lsr_err = 0;
+	ch43x_bus_unlock(s);
+
+	/* Now, initialize the UART */
+	ch43x_port_write(port, CH43X_LCR_REG, CH43X_LCR_WORD_LEN_8);
+
+    /* Enable RX, CTS change interrupts */
+    val = CH43X_IER_RDI_BIT | CH43X_IER_RLSI_BIT | CH43X_IER_MSI_BIT;
+    ch43x_port_update(port, CH43X_IER_REG, val, val);
+
+	/* Enable Uart interrupts */
+	ch43x_port_write(port, CH43X_MCR_REG, CH43X_MCR_OUT2);
+	one->mcr_force = CH43X_MCR_OUT2;
+
+	return 0;
+}
+
+static void ch43x_shutdown(struct uart_port *port)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	struct ch43x_one *one = to_ch43x_one(port, port);
+
+    dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+    dev_vdbg(&s->spi_dev->dev, "MCR:0x%x\n", ch43x_port_read(port, CH43X_MCR_REG));
+    dev_vdbg(&s->spi_dev->dev, "LSR:0x%x\n", ch43x_port_read(port, CH43X_LSR_REG));
+    dev_vdbg(&s->spi_dev->dev, "IIR:0x%x\n", ch43x_port_read(port, CH43X_IIR_REG));
+
+    /* Disable uart0 interrupts */
+    if (port->line == 0)
+        ch43x_port_write(port, CH43X_IER_REG, 0);
+    ch43x_port_write(port, CH43X_MCR_REG, 0);
+
+    one->mcr_force = 0;
+    ch43x_power(port, 0);
+}
+
+static const char *ch43x_type(struct uart_port *port)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	return (port->type == PORT_SC16IS7XX) ? s->devtype->name : NULL;
+}
+
+static int ch43x_request_port(struct uart_port *port)
+{
+	/* Do nothing */
+	return 0;
+}
+
+static void ch43x_config_port(struct uart_port *port, int flags)
+{
+	if (flags & UART_CONFIG_TYPE)
+		port->type = PORT_SC16IS7XX;
+}
+
+static int ch43x_verify_port(struct uart_port *port, struct serial_struct *s)
+{
+	if ((s->type != PORT_UNKNOWN) && (s->type != PORT_SC16IS7XX))
+		return -EINVAL;
+	if (s->irq != port->irq)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void ch43x_pm(struct uart_port *port, unsigned int state, unsigned int oldstate)
+{
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+
+	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	ch43x_power(port, (state == UART_PM_STATE_ON) ? 1 : 0);
+}
+
+static void ch43x_null_void(struct uart_port *port)
+{
+	/* Do nothing */
+}
+static void ch43x_enable_ms(struct uart_port *port)
+{
+	/* Do nothing */
+}
+
+#ifdef CONFIG_CONSOLE_POLL
+/*
+ * kgdb polling. These go through the normal SPI path, so they only work
+ * where the SPI controller can complete spi_sync() from the debugger context.
+ */
+static int ch43x_poll_init(struct uart_port *port)
+{
+	ch43x_power(port, 1);
+	ch43x_port_write(port, CH43X_FCR_REG, CH43X_FCR_RXLVLH_BIT | CH43X_FCR_FIFO_BIT);
+
+	return 0;
+}
+
+static int ch43x_poll_get_char(struct uart_port *port)
+{
+	int val = ch43x_port_read(port, CH43X_LSR_REG);
+
+	if (val < 0 || !(val & CH43X_LSR_DR_BIT))
+		return NO_POLL_CHAR;
+	val = ch43x_port_read(port, CH43X_RHR_REG);
+
+	return val < 0 ? NO_POLL_CHAR : val;
+}
+
+static void ch43x_poll_put_char(struct uart_port *port, unsigned char c)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < 10000; i++) {
+		ret = ch43x_port_read(port, CH43X_LSR_REG);
+		/* the bus failed, a recovery follows and the character is dropped */
+		if (ret < 0)
+			return;
+		if (ret & CH43X_LSR_THRE_BIT)
+			break;
+	}
+	if (!(ret & CH43X_LSR_THRE_BIT))
+		dev_err_ratelimited(port->dev, "Port %i: THR not empty, poll write anyway\n", port->line);
+	ch43x_port_write(port, CH43X_THR_REG, c);
+}
+#endif
+
+static const struct uart_ops ch43x_ops = {
+	.tx_empty = ch43x_tx_empty,
+	.set_mctrl = ch43x_set_mctrl,
+	.get_mctrl = ch43x_get_mctrl,
+	.stop_tx = ch43x_stop_tx,
+	.start_tx = ch43x_start_tx,
+	.stop_rx = ch43x_stop_rx,
+	.break_ctl = ch43x_break_ctl,
+	.startup = ch43x_startup,
+	.shutdown = ch43x_shutdown,
+	.set_termios = ch43x_set_termios,
+	.type = ch43x_type,
+	.request_port = ch43x_request_port,
+	.release_port = ch43x_null_void,
+	.config_port = ch43x_config_port,
+	.verify_port = ch43x_verify_port,
+	.ioctl = ch43x_ioctl,
+	.enable_ms = ch43x_enable_ms,
+	.pm = ch43x_pm,
+#ifdef CONFIG_CONSOLE_POLL
+	.poll_init = ch43x_poll_init,
+	.poll_get_char = ch43x_poll_get_char,
+	.poll_put_char = ch43x_poll_put_char,
+#endif
+};
+
+/*
+ * Console. printk may call the write method from any context, so the text is
+ * only queued there and a work item sends it: wait for THRE, then write up to
+ * a full TX FIFO in one SPI message. The bus is released between the bursts,
+ * so the irq thread keeps servicing the other port.
+ */
+static struct console ch43x_console;
+
+static bool ch43x_console_thre(struct uart_port *port)
+{
+	int lsr = ch43x_port_read(port, CH43X_LSR_REG);
+
+	return lsr >= 0 && (lsr & CH43X_LSR_THRE_BIT);
 }
 
-static void ch43x_port_irq(struct ch43x_port *s, int portno)
+static bool ch43x_console_wait_thre(struct uart_port *port)
 {
-	struct uart_port *port = &s->p[portno].port;
+	/* a full FIFO takes 133ms at 1200 baud */
+	unsigned long deadline = jiffies + HZ / 5;
 
 	do {
-		unsigned int iir, msr;
-		unsigned char lsr;
-		lsr = ch43x_port_read(port, CH43X_LSR_REG);
-		if (lsr & 0x02) {
-			dev_err(port->dev, "Rx Overrun portno = %d, lsr = 0x%2x\n", portno, lsr);
-		}
+		if (ch43x_console_thre(port))
+			return true;
+		usleep_range(100, 200);
+	} while (time_before(jiffies, deadline));
 
-		// add on 20200608
-		/*
-		msr = ch43x_port_read(port, CH43X_MSR_REG);
-		s->p[portno].msr_reg = msr; 
-		dev_vdbg(&s->spi_dev->dev, "uart_update_modem = 0x%02x\n", msr);
-		uart_handle_cts_change(port, !!(msr & CH43X_MSR_CTS_BIT));
-		*/
+	return false;
+}
 
-		iir = ch43x_port_read(port, CH43X_IIR_REG);
-		if (iir & CH43X_IIR_NO_INT_BIT) {
-			dev_vdbg(&s->spi_dev->dev, "%s no int, quit\n", __func__);
-			break;
-		}
-		iir &= CH43X_IIR_ID_MASK;
-		switch (iir) {
-		case CH43X_IIR_RDI_SRC:
-		case CH43X_IIR_RLSE_SRC:
-		case CH43X_IIR_RTOI_SRC:
-			ch43x_handle_rx(port, iir);
-			break;
-		case CH43X_IIR_MSI_SRC:
-			msr = ch43x_port_read(port, CH43X_MSR_REG);
-			s->p[portno].msr_reg = msr;
-			dev_vdbg(&s->spi_dev->dev, "uart_handle_modem_change = 0x%02x\n", msr);
+static void ch43x_console_work_proc(struct work_struct *ws)
+{
+	struct ch43x_port *s = container_of(ws, struct ch43x_port, console_work);
+	struct uart_port *port;
+	unsigned char thr_reg;
+	unsigned long flags;
+	unsigned int len;
+
+	if (ch43x_console.index < 0 || ch43x_console.index >= s->uart.nr)
+		return;
+	port = &s->p[ch43x_console.index].port;
+	thr_reg = ch43x_cmd_write(port->line, CH43X_THR_REG);
+
+	/* the worker is the only reader of the fifo */
+	while (!kfifo_is_empty(&s->console_fifo)) {
+		/*
+		 * wait without s->mutex, the irq pass takes it for a THRI
+		 * refill and would stall rx on both ports meanwhile
+		 */
+		if (!ch43x_console_wait_thre(port))
 			break;
-		case CH43X_IIR_THRI_SRC:
-			mutex_lock(&s->mutex);
-			ch43x_handle_tx(port);
+		/* s->mutex keeps the tty tx refill out of the FIFO for the burst */
+		mutex_lock(&s->mutex);
+		if (!ch43x_console_thre(port)) {
+			/* the tty refill came first */
 			mutex_unlock(&s->mutex);
-			break;
-		default:
-			dev_err(port->dev, "Port %i: Unexpected interrupt: %x", port->line, iir);
-			break;
+			continue;
 		}
-	} while (1);
+		spin_lock_irqsave(&s->console_lock, flags);
+		len = kfifo_out(&s->console_fifo, s->buf, CH43X_FIFO_SIZE);
+		spin_unlock_irqrestore(&s->console_lock, flags);
+		if (len)
+			ch43x_raw_write(port, &thr_reg, s->buf, len);
+		mutex_unlock(&s->mutex);
+		cond_resched();
+	}
 }
 
-static irqreturn_t ch43x_ist_top(int irq, void *dev_id)
+static void ch43x_console_write(struct console *co, const char *str, unsigned int count)
 {
-	return IRQ_WAKE_THREAD;
+	struct ch43x_port *s = container_of(co->data, struct ch43x_port, uart);
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&s->console_lock, flags);
+	for (i = 0; i < count; i++) {
+		if (str[i] == '\n' && !kfifo_put(&s->console_fifo, '\r'))
+			break;
+		if (!kfifo_put(&s->console_fifo, str[i]))
+			break;
+	}
+	spin_unlock_irqrestore(&s->console_lock, flags);
+
+	schedule_work(&s->console_work);
 }
 
-static irqreturn_t ch43x_ist(int irq, void *dev_id)
+static int ch43x_console_setup(struct console *co, char *options)
 {
-	struct ch43x_port *s = (struct ch43x_port *)dev_id;
-	int i;
+	struct ch43x_port *s;
+	struct uart_port *port;
+	int baud = 115200, bits = 8, parity = 'n', flow = 'n';
 
-	dev_dbg(&s->spi_dev->dev, "ch43x_ist interrupt enter...\n");
+	if (!co->data)
+		return -ENODEV;
+	s = container_of(co->data, struct ch43x_port, uart);
+	if (co->index < 0 || co->index >= s->uart.nr)
+		return -ENODEV;
+	port = &s->p[co->index].port;
 
-	for (i = 0; i < s->uart.nr; ++i)
-		ch43x_port_irq(s, i);
+	ch43x_power(port, 1);
+	ch43x_port_update_specify(port, 1, CH43X_IER_REG, CH43X_IER_CK2X_BIT, CH43X_IER_CK2X_BIT);
+	ch43x_port_write(port, CH43X_FCR_REG, CH43X_FCR_RXLVLH_BIT | CH43X_FCR_FIFO_BIT);
 
-	dev_dbg(&s->spi_dev->dev, "%s end\n", __func__);
+	if (options)
+		uart_parse_options(options, &baud, &parity, &bits, &flow);
 
-	return IRQ_HANDLED;
+	return uart_set_options(port, co, baud, parity, bits, flow);
 }
 
-static void ch43x_wq_proc(struct work_struct *ws)
+static struct console ch43x_console = {
+	.name = "ttyWCH",
+	.write = ch43x_console_write,
+	.device = uart_console_device,
+	.setup = ch43x_console_setup,
+	.flags = CON_PRINTBUFFER,
+	.index = -1,
+};
+
+static int ch43x_latency_show(struct seq_file *m, void *v)
 {
-	struct ch43x_one *one = to_ch43x_one(ws, tx_work);
-	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+	struct ch43x_one *one = m->private;
+	int i;
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	mutex_lock(&s->mutex);
-	ch43x_port_update(&one->port, CH43X_IER_REG, CH43X_IER_THRI_BIT, CH43X_IER_THRI_BIT);
-	//	ch43x_handle_tx(&one->port);
-	mutex_unlock(&s->mutex);
+	for (i = 0; i < CH43X_LAT_NR; i++)
+		ch43x_hist_show(m, ch43x_lat_names[i], &one->lat[i]);
+
+	return 0;
 }
 
-static void ch43x_stop_tx(struct uart_port *port)
+static int ch43x_latency_open(struct inode *inode, struct file *file)
 {
-	struct ch43x_one *one = to_ch43x_one(port, port);
-	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
-
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	schedule_work(&one->stop_tx_work);
+	return single_open(file, ch43x_latency_show, inode->i_private);
 }
 
-static void ch43x_stop_rx(struct uart_port *port)
+/* any write resets the histograms */
+static ssize_t ch43x_latency_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 {
-	struct ch43x_one *one = to_ch43x_one(port, port);
-	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+	struct ch43x_one *one = ((struct seq_file *)file->private_data)->private;
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	schedule_work(&one->stop_rx_work);
+	memset(one->lat, 0, sizeof(one->lat));
+
+	return count;
 }
 
-static void ch43x_start_tx(struct uart_port *port)
+static const struct file_operations ch43x_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = ch43x_latency_open,
+	.read = seq_read,
+	.write = ch43x_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* prints a/b with three decimals */
+static void ch43x_seq_ratio(struct seq_file *m, const char *name, u64 a, u64 b)
 {
-	struct ch43x_one *one = to_ch43x_one(port, port);
-	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+	u64 r = b ? div64_u64(a * 1000, b) : 0;
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	seq_printf(m, "%s %llu.%03llu\n", name, div_u64(r, 1000), r % 1000);
+}
 
-	/* handle rs485 */
-	if ((one->rs485.flags & SER_RS485_ENABLED) && (one->rs485.delay_rts_before_send > 0)) {
-		mdelay(one->rs485.delay_rts_before_send);
-	}
-	if (!work_pending(&one->tx_work)) {
-		dev_dbg(&s->spi_dev->dev, "%s schedule\n", __func__);
-		schedule_work(&one->tx_work);
+static int ch43x_stats_show(struct seq_file *m, void *v)
+{
+	struct ch43x_one *one = m->private;
+	struct ch43x_stats *st = &one->stats;
+	u64 msgs = 0, xfers = 0;
+	int i;
+
+	seq_printf(m, "rx_bytes %llu\n", st->rx_bytes);
+	seq_printf(m, "rx_passes %llu\n", st->rx_passes);
+	ch43x_seq_ratio(m, "rx_bytes_per_pass", st->rx_bytes, st->rx_passes);
+	seq_printf(m, "rx_bytes_per_pass_max %llu\n", st->rx_max_pass);
+	seq_printf(m, "tx_bytes %llu\n", st->tx_bytes);
+	seq_printf(m, "tx_refills %llu\n", st->tx_refills);
+	ch43x_seq_ratio(m, "tx_bytes_per_refill", st->tx_bytes, st->tx_refills);
+	for (i = 0; i < CH43X_SPI_NR; i++) {
+		seq_printf(m, "spi_msgs_%s %llu\n", ch43x_spi_names[i], st->spi_msgs[i]);
+		seq_printf(m, "spi_xfers_%s %llu\n", ch43x_spi_names[i], st->spi_xfers[i]);
+		msgs += st->spi_msgs[i];
+		xfers += st->spi_xfers[i];
 	}
+	seq_printf(m, "spi_msgs %llu\n", msgs);
+	seq_printf(m, "spi_xfers %llu\n", xfers);
+	ch43x_seq_ratio(m, "spi_msgs_per_byte", msgs, st->rx_bytes + st->tx_bytes);
+	seq_printf(m, "irqs %llu\n", st->irqs);
+	seq_printf(m, "overruns %llu\n", st->overruns);
+	seq_printf(m, "spi_retries %llu\n", st->spi_retries);
+	seq_printf(m, "spi_errors %llu\n", st->spi_errors);
+	seq_printf(m, "recoveries %llu\n", st->recoveries);
+	seq_printf(m, "recover_failures %llu\n", st->recover_failures);
+	seq_printf(m, "chip_resets %llu\n", st->chip_resets);
+	seq_printf(m, "irq_loop_limits %llu\n", st->irq_loop_limits);
+	seq_printf(m, "rx_no_data %llu\n", st->rx_no_data);
+	seq_printf(m, "irq_lost %llu\n", st->irq_lost);
+	seq_printf(m, "watchdog_polls %llu\n", st->watchdog_polls);
+	seq_printf(m, "msi_storms %llu\n", st->msi_storms);
+	seq_printf(m, "rls_storms %llu\n", st->rls_storms);
+	seq_printf(m, "storm_polls %llu\n", st->storm_polls);
+
+	return 0;
 }
 
-static void ch43x_stop_rx_work_proc(struct work_struct *ws)
+static int ch43x_stats_open(struct inode *inode, struct file *file)
 {
-	struct ch43x_one *one = to_ch43x_one(ws, stop_rx_work);
-	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
-
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	mutex_lock(&s->mutex);
-	one->port.read_status_mask &= ~CH43X_LSR_DR_BIT;
-	ch43x_port_update(&one->port, CH43X_IER_REG, CH43X_IER_RDI_BIT, 0);
-	ch43x_port_update(&one->port, CH43X_IER_REG, CH43X_IER_RLSI_BIT, 0);
-	mutex_unlock(&s->mutex);
+	return single_open(file, ch43x_stats_show, inode->i_private);
 }
 
-static void ch43x_stop_tx_work_proc(struct work_struct *ws)
+/* any write resets the counters */
+static ssize_t ch43x_stats_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 {
-	struct ch43x_one *one = to_ch43x_one(ws, stop_tx_work);
-	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
-	struct circ_buf *xmit = &one->port.state->xmit;
+	struct ch43x_one *one = ((struct seq_file *)file->private_data)->private;
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	mutex_lock(&s->mutex);
-	/* handle rs485 */
-	if (one->rs485.flags & SER_RS485_ENABLED) {
-		/* do nothing if current tx not yet completed */
-		int lsr = ch43x_port_read(&one->port, CH43X_LSR_REG);
-		if (!(lsr & CH43X_LSR_TEMT_BIT)) {
-			mutex_unlock(&s->mutex);
-			return;
-		}
-		if (uart_circ_empty(xmit) && (one->rs485.delay_rts_after_send > 0))
-			mdelay(one->rs485.delay_rts_after_send);
-	}
+	memset(&one->stats, 0, sizeof(one->stats));
 
-	ch43x_port_update(&one->port, CH43X_IER_REG, CH43X_IER_THRI_BIT, 0);
-	mutex_unlock(&s->mutex);
+	return count;
 }
 
-static unsigned int ch43x_tx_empty(struct uart_port *port)
+static const struct file_operations ch43x_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = ch43x_stats_open,
+	.read = seq_read,
+	.write = ch43x_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * spi bus utilisation of the chip over the last 1/10/60 complete seconds,
+ * and the aggregate baud rate the bus could carry at the current cost per
+ * payload byte (10 bits per byte).
+ */
+static int ch43x_busload_show(struct seq_file *m, void *v)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	unsigned int lsr;
-	unsigned int result;
+	static const unsigned int windows[] = { 1, 10, 60 };
+	struct ch43x_port *s = m->private;
+	struct ch43x_busload *bl = &s->busload;
+	u64 busy = 0, bytes = 0, win_ns;
+	char name[32];
+	int i, j;
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	lsr = ch43x_port_read(port, CH43X_LSR_REG);
-	result = (lsr & CH43X_LSR_THRE_BIT) ? TIOCSER_TEMT : 0;
+	mutex_lock(&s->mutex_bus_access);
+	ch43x_busload_advance(bl, ktime_get_ns());
+	for (i = 0; i < ARRAY_SIZE(windows); i++) {
+		win_ns = 0;
+		for (j = 1; j <= windows[i]; j++)
+			win_ns += bl->slot_ns[ch43x_busload_slot(bl->slot_sec - j)];
+		snprintf(name, sizeof(name), "util_%us_percent", windows[i]);
+		ch43x_seq_ratio(m, name, win_ns * 100, (u64)windows[i] * NSEC_PER_SEC);
+	}
+	for (i = 0; i < CH43X_SPI_NR; i++) {
+		seq_printf(m, "busy_ns_%s %llu\n", ch43x_spi_names[i], bl->busy_ns[i]);
+		snprintf(name, sizeof(name), "ns_per_msg_%s", ch43x_spi_names[i]);
+		ch43x_seq_ratio(m, name, bl->busy_ns[i], bl->msgs[i]);
+		busy += bl->busy_ns[i];
+	}
+	mutex_unlock(&s->mutex_bus_access);
 
-	return result;
+	for (i = 0; i < s->uart.nr; i++)
+		bytes += s->p[i].stats.rx_bytes + s->p[i].stats.tx_bytes;
+	seq_printf(m, "busy_ns %llu\n", busy);
+	ch43x_seq_ratio(m, "busy_ns_per_byte", busy, bytes);
+	seq_printf(m, "est_max_aggregate_baud %llu\n", busy ? div64_u64(bytes * NSEC_PER_SEC, busy) * 10 : 0);
+	seq_printf(m, "spi_hz %u\n", s->spi_hz);
+	seq_printf(m, "spi_max_hz %u\n", s->spi_max_hz);
+	seq_printf(m, "spi_failed_hz %u\n", s->spi_failed_hz);
+	seq_printf(m, "reg_reads_per_sec %u\n", s->reg_reads_per_sec);
+	seq_printf(m, "spi_msgs_optimized %d\n", s->p[0].msgs.optimized);
+	seq_printf(m, "msg_saved_ns %lld\n", s->msg_saved_ns);
+
+	mutex_lock(&s->mutex_bus_access);
+	seq_printf(m, "bus_hold_max_us %u\n", READ_ONCE(s->bus_hold_max_us));
+	seq_printf(m, "bus_hold_yields %llu\n", bl->hold_yields);
+	ch43x_hist_show(m, "bus_hold", &bl->hold);
+	mutex_unlock(&s->mutex_bus_access);
+
+	return 0;
 }
 
-static unsigned int ch43x_get_mctrl(struct uart_port *port)
+static int ch43x_busload_open(struct inode *inode, struct file *file)
 {
-	unsigned int status, ret;
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	return single_open(file, ch43x_busload_show, inode->i_private);
+}
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	status = s->p[port->line].msr_reg;
-	ret = 0;
-	if (status & UART_MSR_DCD)
-		ret |= TIOCM_CAR;
-	if (status & UART_MSR_RI)
-		ret |= TIOCM_RNG;
-	if (status & UART_MSR_DSR)
-		ret |= TIOCM_DSR;
-	if (status & UART_MSR_CTS)
-		ret |= TIOCM_CTS;
+/* any write resets the totals, the per second window keeps running */
+static ssize_t ch43x_busload_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct ch43x_port *s = ((struct seq_file *)file->private_data)->private;
 
-	return ret;
+	mutex_lock(&s->mutex_bus_access);
+	memset(s->busload.busy_ns, 0, sizeof(s->busload.busy_ns));
+	memset(s->busload.msgs, 0, sizeof(s->busload.msgs));
+	memset(&s->busload.hold, 0, sizeof(s->busload.hold));
+	s->busload.hold_yields = 0;
+	mutex_unlock(&s->mutex_bus_access);
+
+	return count;
 }
 
-static void ch43x_md_proc(struct work_struct *ws)
+static const struct file_operations ch43x_busload_fops = {
+	.owner = THIS_MODULE,
+	.open = ch43x_busload_open,
+	.read = seq_read,
+	.write = ch43x_busload_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+struct ch43x_rec_dump {
+	size_t size;
+	u8 data[];
+};
+
+/* a reader gets a snapshot of the ring taken at open */
+static int ch43x_rec_open(struct inode *inode, struct file *file)
 {
-	struct ch43x_one *one = to_ch43x_one(ws, md_work);
-	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
-	unsigned int mctrl = one->port.mctrl;
-	unsigned char mcr = 0;
+	struct ch43x_port *s = inode->i_private;
+	struct ch43x_rec_header hdr = {
+		.magic = CH43X_REC_MAGIC,
+		.version = CH43X_REC_VERSION,
+		.entry_size = sizeof(struct ch43x_rec_entry),
+		.uartclk = s->p[0].port.uartclk,
+		.nr_uart = s->uart.nr,
+	};
+	struct ch43x_rec_entry *out;
+	struct ch43x_rec_dump *dump;
+	struct ch43x_rec *rec;
+	u64 first, i;
 
-	if (mctrl & TIOCM_RTS) {
-		mcr |= UART_MCR_RTS;
-	}
-	if (mctrl & TIOCM_DTR) {
-		mcr |= UART_MCR_DTR;
-	}
-	if (mctrl & TIOCM_OUT1) {
-		mcr |= UART_MCR_OUT1;
-	}
-	if (mctrl & TIOCM_OUT2) {
-		mcr |= UART_MCR_OUT2;
+	if (!(file->f_mode & FMODE_READ))
+		return 0;
+
+	mutex_lock(&s->mutex_bus_access);
+	rec = s->rec;
+	if (rec) {
+		hdr.entries = min_t(u64, rec->head, rec->size);
+		hdr.lost = rec->head - hdr.entries;
 	}
-	if (mctrl & TIOCM_LOOP) {
-		mcr |= UART_MCR_LOOP;
+	dump = vmalloc(sizeof(*dump) + sizeof(hdr) + hdr.entries * sizeof(*out));
+	if (!dump) {
+		mutex_unlock(&s->mutex_bus_access);
+		return -ENOMEM;
 	}
+	dump->size = sizeof(hdr) + hdr.entries * sizeof(*out);
+	memcpy(dump->data, &hdr, sizeof(hdr));
+	out = (struct ch43x_rec_entry *)(dump->data + sizeof(hdr));
+	first = rec ? rec->head - hdr.entries : 0;
+	for (i = 0; i < hdr.entries; i++)
+		out[i] = rec->ent[(first + i) & (rec->size - 1)];
+	mutex_unlock(&s->mutex_bus_access);
 
-	mcr |= one->mcr_force;
+	file->private_data = dump;
 
-	dev_dbg(&s->spi_dev->dev, "%s - mcr:0x%x, force:0x%2x\n", __func__, mcr, one->mcr_force);
+	return 0;
+}
 
-	ch43x_port_write(&one->port, CH43X_MCR_REG, mcr);
+static ssize_t ch43x_rec_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct ch43x_rec_dump *dump = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, dump->data, dump->size);
 }
 
-static void ch43x_set_mctrl(struct uart_port *port, unsigned int mctrl)
+/* swaps the ring under the bus lock, no message is recorded into the old one afterwards */
+static void ch43x_rec_set(struct ch43x_port *s, struct ch43x_rec *rec)
 {
-	struct ch43x_one *one = to_ch43x_one(port, port);
-	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+	struct ch43x_rec *old;
 
-	dev_dbg(&s->spi_dev->dev, "%s - mctrl:0x%x\n", __func__, mctrl);
-	schedule_work(&one->md_work);
+	mutex_lock(&s->mutex_bus_access);
+	old = s->rec;
+	s->rec = rec;
+	mutex_unlock(&s->mutex_bus_access);
+
+	if (old) {
+		vfree(old->ent);
+		kfree(old);
+	}
 }
 
-static void ch43x_break_ctl(struct uart_port *port, int break_state)
+/* writing n starts recording into a ring of n entries (rounded up), 0 stops */
+static ssize_t ch43x_rec_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	struct ch43x_port *s = file_inode(file)->i_private;
+	struct ch43x_rec *rec = NULL;
+	unsigned int n;
+	int ret;
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	ch43x_port_update(port, CH43X_LCR_REG, CH43X_LCR_TXBREAK_BIT, break_state ? CH43X_LCR_TXBREAK_BIT : 0);
+	ret = kstrtouint_from_user(buf, count, 0, &n);
+	if (ret)
+		return ret;
+	if (n > CH43X_REC_MAX)
+		return -EINVAL;
+
+	if (n) {
+		rec = kzalloc(sizeof(*rec), GFP_KERNEL);
+		if (!rec)
+			return -ENOMEM;
+		rec->size = roundup_pow_of_two(n);
+		rec->ent = vmalloc(rec->size * sizeof(*rec->ent));
+		if (!rec->ent) {
+			kfree(rec);
+			return -ENOMEM;
+		}
+	}
+
+	ch43x_rec_set(s, rec);
+
+	return count;
 }
 
-#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0))
-static void ch43x_set_termios(struct uart_port *port, struct ktermios *termios, const struct ktermios *old)
-#else
-static void ch43x_set_termios(struct uart_port *port, struct ktermios *termios, struct ktermios *old)
-#endif
+static int ch43x_rec_release(struct inode *inode, struct file *file)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	struct ch43x_one *one = to_ch43x_one(port, port);
-	unsigned int lcr;
-	int baud;
-	u8 bParityType;
+	vfree(file->private_data);
 
-    dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	return 0;
+}
 
-	/* Mask termios capabilities we don't support */
-	termios->c_cflag &= ~CMSPAR;
+static const struct file_operations ch43x_rec_fops = {
+	.owner = THIS_MODULE,
+	.open = ch43x_rec_open,
+	.read = ch43x_rec_read,
+	.write = ch43x_rec_write,
+	.llseek = default_llseek,
+	.release = ch43x_rec_release,
+};
 
-	/* Word size */
-	switch (termios->c_cflag & CSIZE) {
-	case CS5:
-		lcr = CH43X_LCR_WORD_LEN_5;
-		break;
-	case CS6:
-		lcr = CH43X_LCR_WORD_LEN_6;
-		break;
-	case CS7:
-		lcr = CH43X_LCR_WORD_LEN_7;
-		break;
-	case CS8:
-		lcr = CH43X_LCR_WORD_LEN_8;
-		break;
-	default:
-		lcr = CH43X_LCR_WORD_LEN_8;
-		termios->c_cflag &= ~CSIZE;
-		termios->c_cflag |= CS8;
-		break;
+/*
+ * Loopback benchmark of a closed port: streams a counting pattern through
+ * MCR loopback for secs seconds, then times single byte echoes. The tty port
+ * mutex is held for the whole run so the port cannot be opened meanwhile.
+ */
+static int ch43x_bench_run(struct ch43x_one *one, unsigned int baud, unsigned int secs)
+{
+	struct uart_port *port = &one->port;
+	struct tty_port *tport = &port->state->port;
+	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	struct ch43x_bench *b = &one->bench;
+	u64 overruns, t0, deadline;
+	unsigned int i;
+
+	mutex_lock(&tport->mutex);
+	if (tty_port_initialized(tport) || uart_console(port)) {
+		mutex_unlock(&tport->mutex);
+		return -EBUSY;
+	}
+
+	ch43x_startup(port);
+	ch43x_port_write(port, CH43X_LCR_REG, ch43x_termios_lcr(CS8));
+	baud = ch43x_set_baud(port, baud);
+	ch43x_port_update(port, CH43X_MCR_REG, CH43X_MCR_LOOP_BIT, CH43X_MCR_LOOP_BIT);
+
+	b->tx_seq = 0;
+	b->rx_seq = 0;
+	b->sent = 0;
+	b->received = 0;
+	b->errors = 0;
+	b->echo_wait = false;
+	b->echo_lost = 0;
+	memset(&b->rtt, 0, sizeof(b->rtt));
+	init_completion(&b->echo_done);
+	overruns = one->stats.overruns;
+
+	/* throughput */
+	WRITE_ONCE(b->active, true);
+	mutex_lock(&s->mutex);
+	b->streaming = true;
+	ch43x_port_update(port, CH43X_IER_REG, CH43X_IER_THRI_BIT, CH43X_IER_THRI_BIT);
+	mutex_unlock(&s->mutex);
+	t0 = ktime_get_ns();
+	msleep_interruptible(secs * 1000);
+	mutex_lock(&s->mutex);
+	b->streaming = false;
+	mutex_unlock(&s->mutex);
+	b->ns = ktime_get_ns() - t0;
+	/* the bytes still in the tx FIFO and the rx path, 48 chars */
+	msleep(480 * 1000 / baud + 10);
+	b->res_sent = b->sent;
+	b->res_received = b->received;
+	b->res_errors = b->errors;
+	b->res_overruns = one->stats.overruns - overruns;
+
+	/* round trip of single bytes, they are reported by the rx timeout */
+	deadline = ktime_get_ns() + (u64)secs * NSEC_PER_SEC;
+	for (i = 0; i < CH43X_BENCH_ECHOS && ktime_get_ns() < deadline && !signal_pending(current); i++) {
+		reinit_completion(&b->echo_done);
+		mutex_lock(&s->mutex);
+		b->echo_byte = i;
+		b->echo_ts = ktime_get_ns();
+		WRITE_ONCE(b->echo_wait, true);
+		ch43x_port_write(port, CH43X_THR_REG, i);
+		mutex_unlock(&s->mutex);
+		if (!wait_for_completion_timeout(&b->echo_done, HZ / 10)) {
+			/* a late echo must not complete the next round */
+			mutex_lock(&s->mutex_irq);
+			WRITE_ONCE(b->echo_wait, false);
+			mutex_unlock(&s->mutex_irq);
+			b->echo_lost++;
+		}
 	}
 
-	bParityType = termios->c_cflag & PARENB ?
-			      (termios->c_cflag & PARODD ? 1 : 2) + (termios->c_cflag & CMSPAR ? 2 : 0) :
-			      0;
-	lcr |= CH43X_LCR_PARITY_BIT;
-	switch (bParityType) {
-	case 0x01:
-		lcr |= CH43X_LCR_ODDPARITY_BIT;
-		dev_vdbg(&s->spi_dev->dev, "parity = odd\n");
-		break;
-	case 0x02:
-		lcr |= CH43X_LCR_EVENPARITY_BIT;
-		dev_vdbg(&s->spi_dev->dev, "parity = even\n");
-		break;
-	case 0x03:
-		lcr |= CH43X_LCR_MARKPARITY_BIT;
-		dev_vdbg(&s->spi_dev->dev, "parity = mark\n");
-		break;
-	case 0x04:
-		lcr |= CH43X_LCR_SPACEPARITY_BIT;
-		dev_vdbg(&s->spi_dev->dev, "parity = space\n");
-		break;
-	default:
-		lcr &= ~CH43X_LCR_PARITY_BIT;
-		dev_vdbg(&s->spi_dev->dev, "parity = none\n");
-		break;
+	/* the rx path runs under mutex_irq, no pass sees the benchmark after this */
+	mutex_lock(&s->mutex_irq);
+	WRITE_ONCE(b->active, false);
+	mutex_unlock(&s->mutex_irq);
+	ch43x_port_update(port, CH43X_MCR_REG, CH43X_MCR_LOOP_BIT, 0);
+	ch43x_port_update(port, CH43X_IER_REG,
+			  CH43X_IER_RDI_BIT | CH43X_IER_THRI_BIT | CH43X_IER_RLSI_BIT | CH43X_IER_MSI_BIT, 0);
+	ch43x_shutdown(port);
+	b->baud = baud;
+	b->valid = true;
+	mutex_unlock(&tport->mutex);
+
+	return 0;
+}
+
+static int ch43x_bench_show(struct seq_file *m, void *v)
+{
+	struct ch43x_one *one = m->private;
+	struct ch43x_bench *b = &one->bench;
+	u64 bps;
+
+	mutex_lock(&b->lock);
+	if (!b->valid) {
+		seq_puts(m, "no run, write \"<baud> [seconds]\" to start one\n");
+		mutex_unlock(&b->lock);
+		return 0;
 	}
+	bps = div64_u64(b->res_received * NSEC_PER_SEC, b->ns);
+	seq_printf(m, "baud %u\n", b->baud);
+	ch43x_seq_ratio(m, "seconds", b->ns, NSEC_PER_SEC);
+	seq_printf(m, "sent %llu\n", b->res_sent);
+	seq_printf(m, "received %llu\n", b->res_received);
+	seq_printf(m, "lost %llu\n", b->res_sent > b->res_received ? b->res_sent - b->res_received : 0);
+	seq_printf(m, "sequence_errors %llu\n", b->res_errors);
+	seq_printf(m, "overruns %llu\n", b->res_overruns);
+	seq_printf(m, "bytes_per_sec %llu\n", bps);
+	/* 10 bits per byte at 8N1 */
+	ch43x_seq_ratio(m, "line_rate_percent", bps * 10 * 100, b->baud);
+	seq_printf(m, "echo_lost %llu\n", b->echo_lost);
+	ch43x_hist_show(m, "echo_rtt", &b->rtt);
+	mutex_unlock(&b->lock);
 
-	/* Stop bits */
-	if (termios->c_cflag & CSTOPB)
-		lcr |= CH43X_LCR_STOPLEN_BIT; /* 2 stops */
+	return 0;
+}
 
-	/* Set read status mask */
-	port->read_status_mask = CH43X_LSR_OE_BIT;
-	if (termios->c_iflag & INPCK)
-		port->read_status_mask |= CH43X_LSR_PE_BIT | CH43X_LSR_FE_BIT;
-	if (termios->c_iflag & (BRKINT | PARMRK))
-		port->read_status_mask |= CH43X_LSR_BI_BIT;
+static int ch43x_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ch43x_bench_show, inode->i_private);
+}
 
-	/* Set status ignore mask */
-	port->ignore_status_mask = 0;
-	if (termios->c_iflag & IGNBRK)
-		port->ignore_status_mask |= CH43X_LSR_BI_BIT;
-	if (!(termios->c_cflag & CREAD))
-		port->ignore_status_mask |= CH43X_LSR_BRK_ERROR_MASK;
+/* "<baud> [seconds]" runs a benchmark, the write returns when it is done */
+static ssize_t ch43x_bench_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	struct ch43x_one *one = ((struct seq_file *)file->private_data)->private;
+	unsigned int baud, secs = 10;
+	char buf[32];
+	int ret;
 
-	/* Update LCR register */
-	ch43x_port_write(port, CH43X_LCR_REG, lcr);
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	if (sscanf(buf, "%u %u", &baud, &secs) < 1)
+		return -EINVAL;
+	if (!baud || baud > one->port.uartclk / 16 || !secs || secs > 3600)
+		return -EINVAL;
 
-	/* Configure flow control */
-	if (termios->c_cflag & CRTSCTS) {
-		dev_vdbg(&s->spi_dev->dev, "ch43x_set_termios enable rts/cts\n");
-		ch43x_port_update(port, CH43X_MCR_REG, CH43X_MCR_AFE | CH43X_MCR_RTS_BIT,
-				  CH43X_MCR_AFE | CH43X_MCR_RTS_BIT);
-		one->mcr_force |= CH43X_MCR_AFE | CH43X_MCR_RTS_BIT;
-		// add on 20200608 suppose cts status is always valid here
-		uart_handle_cts_change(port, 1);
-	} else {
-		dev_vdbg(&s->spi_dev->dev, "ch43x_set_termios disable rts/cts\n");
-		ch43x_port_update(port, CH43X_MCR_REG, CH43X_MCR_AFE, 0);
-		one->mcr_force &= ~(CH43X_MCR_AFE | CH43X_MCR_RTS_BIT);
-	}
+	mutex_lock(&one->bench.lock);
+	ret = ch43x_bench_run(one, baud, secs);
+	mutex_unlock(&one->bench.lock);
 
-	/* Get baud rate generator configuration */
-	baud = uart_get_baud_rate(port, termios, old, port->uartclk / 16 / 0xffff, port->uartclk / 16 * 24);
-	/* Setup baudrate generator */
-	baud = ch43x_set_baud(port, baud);
-	/* Update timeout according to new baud rate */
-	uart_update_timeout(port, termios->c_cflag, baud);
-	//ch43x_dump_register(port);
+	return ret ? ret : count;
 }
 
-static void ch43x_config_rs485(struct uart_port *port, struct serial_rs485 *rs485)
+static const struct file_operations ch43x_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = ch43x_bench_open,
+	.read = seq_read,
+	.write = ch43x_bench_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void ch43x_debugfs_init(struct ch43x_port *s)
 {
-	struct ch43x_one *one = to_ch43x_one(port, port);
-	struct ch43x_port *s = dev_get_drvdata(one->port.dev);
+	struct dentry *dir;
+	char name[32];
+	int i;
 
-	one->rs485 = *rs485;
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	if (one->rs485.flags & SER_RS485_ENABLED) {
-	} else {
+	snprintf(name, sizeof(name), "ch432-%s", dev_name(&s->spi_dev->dev));
+	s->debugfs = debugfs_create_dir(name, NULL);
+	debugfs_create_file("busload", 0644, s->debugfs, s, &ch43x_busload_fops);
+	debugfs_create_u32("bus_hold_max_us", 0644, s->debugfs, &s->bus_hold_max_us);
+	debugfs_create_file("recorder", 0600, s->debugfs, s, &ch43x_rec_fops);
+	ch43x_fault_init(s);
+	for (i = 0; i < s->uart.nr; i++) {
+		snprintf(name, sizeof(name), "port%d", i);
+		dir = debugfs_create_dir(name, s->debugfs);
+		debugfs_create_file("latency", 0644, dir, &s->p[i], &ch43x_latency_fops);
+		debugfs_create_file("stats", 0644, dir, &s->p[i], &ch43x_stats_fops);
+		debugfs_create_file("loopback", 0600, dir, &s->p[i], &ch43x_bench_fops);
 	}
 }
 
-static int ch43x_ioctl(struct uart_port *port, unsigned int cmd, unsigned long arg)
-{
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	struct serial_rs485 rs485;
+#ifdef CONFIG_PERF_EVENTS
+/*
+ * Software PMU with the driver counters, so they can be read with perf stat
+ * next to other events. config bits 0-7 select the event, bits 8-15 the port,
+ * 0xff counts the whole chip. The counters are not tied to a cpu, perf opens
+ * them on the cpu given in the cpumask file only. The chip value is the sum
+ * of the ports except for irq_passes: one pass of the irq thread serves both
+ * ports, so for the chip it counts passes and for a port the interrupt
+ * sources handled on it.
+ */
+enum {
+	CH43X_PMU_RX_BYTES,
+	CH43X_PMU_TX_BYTES,
+	CH43X_PMU_SPI_MSGS,
+	CH43X_PMU_IRQ_PASSES,
+	CH43X_PMU_OVERRUNS,
+	CH43X_PMU_SPI_ERRORS,
+	CH43X_PMU_IRQ_LOST,
+	CH43X_PMU_STORMS,
+	CH43X_PMU_NR,
+};
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+#define CH43X_PMU_EVENT(config) ((config) & 0xff)
+#define CH43X_PMU_PORT(config)	(((config) >> 8) & 0xff)
+#define CH43X_PMU_CHIP		0xff
 
-	switch (cmd) {
-	case IOCTL_CMD_SRS485:
-		if (copy_from_user(&rs485, (void __user *)arg, sizeof(rs485)))
-			return -EFAULT;
+static DEFINE_IDA(ch43x_pmu_ida);
 
-		ch43x_config_rs485(port, &rs485);
-		return 0;
-	case IOCTL_CMD_GRS485:
-		if (copy_to_user((void __user *)arg, &(to_ch43x_one(port, port)->rs485), sizeof(rs485)))
-			return -EFAULT;
-		return 0;
-	default:
-		break;
+static u64 ch43x_pmu_port_value(struct ch43x_one *one, int ev)
+{
+	struct ch43x_stats *st = &one->stats;
+	u64 val = 0;
+	int i;
+
+	switch (ev) {
+	case CH43X_PMU_RX_BYTES:
+		return READ_ONCE(st->rx_bytes);
+	case CH43X_PMU_TX_BYTES:
+		return READ_ONCE(st->tx_bytes);
+	case CH43X_PMU_SPI_MSGS:
+		for (i = 0; i < CH43X_SPI_NR; i++)
+			val += READ_ONCE(st->spi_msgs[i]);
+		return val;
+	case CH43X_PMU_IRQ_PASSES:
+		return READ_ONCE(st->irqs);
+	case CH43X_PMU_OVERRUNS:
+		return READ_ONCE(st->overruns);
+	case CH43X_PMU_SPI_ERRORS:
+		return READ_ONCE(st->spi_errors);
+	case CH43X_PMU_IRQ_LOST:
+		return READ_ONCE(st->irq_lost);
+	case CH43X_PMU_STORMS:
+		return READ_ONCE(st->msi_storms) + READ_ONCE(st->rls_storms);
 	}
 
-	return -ENOIOCTLCMD;
+	return 0;
 }
 
-static int ch43x_startup(struct uart_port *port)
+static u64 ch43x_pmu_value(struct ch43x_port *s, u64 config)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	unsigned int val;
-	struct ch43x_one *one = to_ch43x_one(port, port);
-
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
+	int ev = CH43X_PMU_EVENT(config);
+	int port = CH43X_PMU_PORT(config);
+	u64 val = 0;
+	int i;
 
-	ch43x_power(port, 1);
-	/* Reset FIFOs*/
-	val = CH43X_FCR_RXRESET_BIT | CH43X_FCR_TXRESET_BIT;
-	ch43x_port_write(port, CH43X_FCR_REG, val);
-	udelay(5);
-	/* Enable FIFOs and configure interrupt & flow control levels to 8 */
-	ch43x_port_write(port, CH43X_FCR_REG, CH43X_FCR_RXLVLH_BIT | CH43X_FCR_FIFO_BIT);
+	if (port != CH43X_PMU_CHIP)
+		return ch43x_pmu_port_value(&s->p[port], ev);
+	/* per chip, the port values count interrupt sources instead */
+	if (ev == CH43X_PMU_IRQ_PASSES)
+		return READ_ONCE(s->irq_passes);
+	for (i = 0; i < s->uart.nr; i++)
+		val += ch43x_pmu_port_value(&s->p[i], ev);
 
-	/* Now, initialize the UART */
-	ch43x_port_write(port, CH43X_LCR_REG, CH43X_LCR_WORD_LEN_8);
+	return val;
+}
 
-    /* Enable RX, CTS change interrupts */
-    val = ch43x_port_read(port, CH43X_IER_REG);
-    val |= CH43X_IER_RDI_BIT | CH43X_IER_RLSI_BIT | CH43X_IER_MSI_BIT;
-    ch43x_port_write(port, CH43X_IER_REG, val);
+static int ch43x_pmu_event_init(struct perf_event *event)
+{
+	struct ch43x_port *s = container_of(event->pmu, struct ch43x_port, pmu);
+	u64 config = event->attr.config;
 
-	/* Enable Uart interrupts */
-	ch43x_port_write(port, CH43X_MCR_REG, CH43X_MCR_OUT2);
-	one->mcr_force = CH43X_MCR_OUT2;
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+	if (is_sampling_event(event) || (event->attach_state & PERF_ATTACH_TASK) || event->cpu < 0)
+		return -EINVAL;
+	if ((config >> 16) || CH43X_PMU_EVENT(config) >= CH43X_PMU_NR)
+		return -EINVAL;
+	if (CH43X_PMU_PORT(config) != CH43X_PMU_CHIP && CH43X_PMU_PORT(config) >= s->uart.nr)
+		return -EINVAL;
+	event->cpu = 0;
 
 	return 0;
 }
 
-static void ch43x_shutdown(struct uart_port *port)
+static void ch43x_pmu_update(struct perf_event *event)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	struct ch43x_one *one = to_ch43x_one(port, port);
+	struct ch43x_port *s = container_of(event->pmu, struct ch43x_port, pmu);
+	u64 now = ch43x_pmu_value(s, event->attr.config);
+	u64 prev = local64_xchg(&event->hw.prev_count, now);
 
-    dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-    dev_vdbg(&s->spi_dev->dev, "MCR:0x%x\n", ch43x_port_read(port, CH43X_MCR_REG));
-    dev_vdbg(&s->spi_dev->dev, "LSR:0x%x\n", ch43x_port_read(port, CH43X_LSR_REG));
-    dev_vdbg(&s->spi_dev->dev, "IIR:0x%x\n", ch43x_port_read(port, CH43X_IIR_REG));
+	/* the debugfs stats file may have reset the counters */
+	local64_add(now >= prev ? now - prev : now, &event->count);
+}
 
-    /* Disable uart0 interrupts */
-    if (port->line == 0)
-        ch43x_port_write(port, CH43X_IER_REG, 0);
-    ch43x_port_write(port, CH43X_MCR_REG, 0);
+static void ch43x_pmu_start(struct perf_event *event, int flags)
+{
+	struct ch43x_port *s = container_of(event->pmu, struct ch43x_port, pmu);
 
-    one->mcr_force = 0;
-    ch43x_power(port, 0);
+	local64_set(&event->hw.prev_count, ch43x_pmu_value(s, event->attr.config));
+	event->hw.state = 0;
 }
 
-static const char *ch43x_type(struct uart_port *port)
+static void ch43x_pmu_stop(struct perf_event *event, int flags)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
-	return (port->type == PORT_SC16IS7XX) ? s->devtype->name : NULL;
+	if (event->hw.state & PERF_HES_STOPPED)
+		return;
+	ch43x_pmu_update(event);
+	event->hw.state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
 }
 
-static int ch43x_request_port(struct uart_port *port)
+static int ch43x_pmu_add(struct perf_event *event, int flags)
 {
-	/* Do nothing */
+	event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+	if (flags & PERF_EF_START)
+		ch43x_pmu_start(event, flags);
+
 	return 0;
 }
 
-static void ch43x_config_port(struct uart_port *port, int flags)
+static void ch43x_pmu_del(struct perf_event *event, int flags)
 {
-	if (flags & UART_CONFIG_TYPE)
-		port->type = PORT_SC16IS7XX;
+	ch43x_pmu_stop(event, PERF_EF_UPDATE);
 }
 
-static int ch43x_verify_port(struct uart_port *port, struct serial_struct *s)
+static void ch43x_pmu_read(struct perf_event *event)
 {
-	if ((s->type != PORT_UNKNOWN) && (s->type != PORT_SC16IS7XX))
-		return -EINVAL;
-	if (s->irq != port->irq)
-		return -EINVAL;
+	ch43x_pmu_update(event);
+}
 
-	return 0;
+PMU_FORMAT_ATTR(event, "config:0-7");
+PMU_FORMAT_ATTR(port, "config:8-15");
+
+static struct attribute *ch43x_pmu_format_attrs[] = {
+	&format_attr_event.attr,
+	&format_attr_port.attr,
+	NULL,
+};
+
+static const struct attribute_group ch43x_pmu_format_group = {
+	.name = "format",
+	.attrs = ch43x_pmu_format_attrs,
+};
+
+/* the port term can be given again to select a single port, ch432/rx_bytes,port=1/ */
+PMU_EVENT_ATTR_STRING(rx_bytes, ch43x_pmu_rx_bytes, "event=0x00,port=0xff");
+PMU_EVENT_ATTR_STRING(tx_bytes, ch43x_pmu_tx_bytes, "event=0x01,port=0xff");
+PMU_EVENT_ATTR_STRING(spi_msgs, ch43x_pmu_spi_msgs, "event=0x02,port=0xff");
+PMU_EVENT_ATTR_STRING(irq_passes, ch43x_pmu_irq_passes, "event=0x03,port=0xff");
+PMU_EVENT_ATTR_STRING(overruns, ch43x_pmu_overruns, "event=0x04,port=0xff");
+PMU_EVENT_ATTR_STRING(spi_errors, ch43x_pmu_spi_errors, "event=0x05,port=0xff");
+PMU_EVENT_ATTR_STRING(irq_lost, ch43x_pmu_irq_lost, "event=0x06,port=0xff");
+PMU_EVENT_ATTR_STRING(storms, ch43x_pmu_storms, "event=0x07,port=0xff");
+
+static struct attribute *ch43x_pmu_event_attrs[] = {
+	&ch43x_pmu_rx_bytes.attr.attr,
+	&ch43x_pmu_tx_bytes.attr.attr,
+	&ch43x_pmu_spi_msgs.attr.attr,
+	&ch43x_pmu_irq_passes.attr.attr,
+	&ch43x_pmu_overruns.attr.attr,
+	&ch43x_pmu_spi_errors.attr.attr,
+	&ch43x_pmu_irq_lost.attr.attr,
+	&ch43x_pmu_storms.attr.attr,
+	NULL,
+};
+
+static const struct attribute_group ch43x_pmu_events_group = {
+	.name = "events",
+	.attrs = ch43x_pmu_event_attrs,
+};
+
+static ssize_t cpumask_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return cpumap_print_to_pagebuf(true, buf, cpumask_of(0));
 }
+static DEVICE_ATTR_RO(cpumask);
 
-static void ch43x_pm(struct uart_port *port, unsigned int state, unsigned int oldstate)
+static struct attribute *ch43x_pmu_cpumask_attrs[] = {
+	&dev_attr_cpumask.attr,
+	NULL,
+};
+
+static const struct attribute_group ch43x_pmu_cpumask_group = {
+	.attrs = ch43x_pmu_cpumask_attrs,
+};
+
+static const struct attribute_group *ch43x_pmu_attr_groups[] = {
+	&ch43x_pmu_format_group,
+	&ch43x_pmu_events_group,
+	&ch43x_pmu_cpumask_group,
+	NULL,
+};
+
+/* the first chip is "ch432", further chips "ch432_<n>" */
+static void ch43x_pmu_register(struct ch43x_port *s)
 {
-	struct ch43x_port *s = dev_get_drvdata(port->dev);
+	int ret;
 
-	dev_dbg(&s->spi_dev->dev, "%s\n", __func__);
-	ch43x_power(port, (state == UART_PM_STATE_ON) ? 1 : 0);
+	s->pmu_id = ida_alloc(&ch43x_pmu_ida, GFP_KERNEL);
+	if (s->pmu_id < 0)
+		return;
+	if (s->pmu_id)
+		snprintf(s->pmu_name, sizeof(s->pmu_name), "ch432_%d", s->pmu_id);
+	else
+		strscpy(s->pmu_name, "ch432", sizeof(s->pmu_name));
+
+	s->pmu = (struct pmu) {
+		.module = THIS_MODULE,
+		.task_ctx_nr = perf_invalid_context,
+		.attr_groups = ch43x_pmu_attr_groups,
+		.event_init = ch43x_pmu_event_init,
+		.add = ch43x_pmu_add,
+		.del = ch43x_pmu_del,
+		.start = ch43x_pmu_start,
+		.stop = ch43x_pmu_stop,
+		.read = ch43x_pmu_read,
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0))
+		.capabilities = PERF_PMU_CAP_NO_INTERRUPT | PERF_PMU_CAP_NO_EXCLUDE,
+#else
+		.capabilities = PERF_PMU_CAP_NO_INTERRUPT,
+#endif
+	};
+
+	ret = perf_pmu_register(&s->pmu, s->pmu_name, -1);
+	if (ret) {
+		dev_warn(&s->spi_dev->dev, "Registering pmu %s failed %d\n", s->pmu_name, ret);
+		ida_free(&ch43x_pmu_ida, s->pmu_id);
+		s->pmu_id = -1;
+	}
 }
 
-static void ch43x_null_void(struct uart_port *port)
+static void ch43x_pmu_unregister(struct ch43x_port *s)
 {
-	/* Do nothing */
+	if (s->pmu_id < 0)
+		return;
+	perf_pmu_unregister(&s->pmu);
+	ida_free(&ch43x_pmu_ida, s->pmu_id);
 }
-static void ch43x_enable_ms(struct uart_port *port)
+#else
+static inline void ch43x_pmu_register(struct ch43x_port *s)
 {
-	/* Do nothing */
 }
 
-static const struct uart_ops ch43x_ops = {
-	.tx_empty = ch43x_tx_empty,
-	.set_mctrl = ch43x_set_mctrl,
-	.get_mctrl = ch43x_get_mctrl,
-	.stop_tx = ch43x_stop_tx,
-	.start_tx = ch43x_start_tx,
-	.stop_rx = ch43x_stop_rx,
-	.break_ctl = ch43x_break_ctl,
-	.startup = ch43x_startup,
-	.shutdown = ch43x_shutdown,
-	.set_termios = ch43x_set_termios,
-	.type = ch43x_type,
-	.request_port = ch43x_request_port,
-	.release_port = ch43x_null_void,
-	.config_port = ch43x_config_port,
-	.verify_port = ch43x_verify_port,
-	.ioctl = ch43x_ioctl,
-	.enable_ms = ch43x_enable_ms,
-	.pm = ch43x_pm,
-};
-
-static ssize_t reg_dump_show(struct device *dev, struct device_attribute *attr, char *buf)
+static inline void ch43x_pmu_unregister(struct ch43x_port *s)
 {
-    struct uart_port *port;
-    int i;
-
-    dev_info(dev, "reg_dump_show");
+}
+#endif
 
-    for (i = 0; i < 2; i++) {
-        port = &g_ch43x_port->p[i].port;
-        ch43x_dump_register(port);
+static ssize_t rs485_demux_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct ch43x_port *s = dev_get_drvdata(dev);
+    struct ch43x_demux *dm;
+    ssize_t len = 0;
+    int i, j;
+
+    mutex_lock(&s->mutex);
+    for (i = 0; i < s->uart.nr; i++) {
+        dm = &s->p[i].demux;
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%d", i);
+        for (j = 0; j < 256; j++)
+            if (dm->node[j])
+                len += scnprintf(buf + len, PAGE_SIZE - len, " %d", j);
+        len += scnprintf(buf + len, PAGE_SIZE - len, " frames:%lu dropped:%lu errors:%lu\n",
+                         dm->frames, dm->dropped, dm->errors);
     }
+    mutex_unlock(&s->mutex);
 
-    return 0;
+    return len;
 }
 
-static ssize_t reg_dump_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+/* "<port> <addr> [<addr> ...]" enables, "<port>" alone disables */
+static ssize_t rs485_demux_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    return count;
+    struct ch43x_port *s = dev_get_drvdata(dev);
+    DECLARE_BITMAP(addrs, 256);
+    char *str, *p, *tok;
+    unsigned int portnum, addr;
+    bool first = true;
+    int ret = 0;
+
+    bitmap_zero(addrs, 256);
+    str = kstrndup(buf, count, GFP_KERNEL);
+    if (!str)
+        return -ENOMEM;
+
+    p = str;
+    while ((tok = strsep(&p, " \t\n")) != NULL) {
+        if (!*tok)
+            continue;
+        if (first) {
+            ret = kstrtouint(tok, 0, &portnum);
+            if (!ret && portnum >= s->uart.nr)
+                ret = -EINVAL;
+            first = false;
+        } else {
+            ret = kstrtouint(tok, 0, &addr);
+            if (!ret && addr > 255)
+                ret = -EINVAL;
+            if (!ret)
+                set_bit(addr, addrs);
+        }
+        if (ret)
+            break;
+    }
+    kfree(str);
+    if (first)
+        ret = -EINVAL;
+    if (ret)
+        return ret;
+
+    mutex_lock(&s->mutex);
+    ch43x_demux_disable(&s->p[portnum]);
+    if (!bitmap_empty(addrs, 256))
+        ret = ch43x_demux_enable(&s->p[portnum], addrs);
+    mutex_unlock(&s->mutex);
+
+    return ret ? ret : count;
 }
 
-static DEVICE_ATTR(reg_dump, S_IRUGO | S_IWUSR, reg_dump_show, reg_dump_store);
+static DEVICE_ATTR(rs485_demux, S_IRUGO | S_IWUSR, rs485_demux_show, rs485_demux_store);
 
-static struct attribute *ch432_attributes[] = {&dev_attr_reg_dump.attr, NULL};
+static struct attribute *ch432_attributes[] = {&dev_attr_rs485_demux.attr, NULL};
 
 static struct attribute_group ch432_attribute_group = {.attrs = ch432_attributes};
 
-int ch432_create_sysfs(struct spi_device *spi)
+/* the attributes live on the spi device, one set per chip */
+static int ch432_create_sysfs(struct spi_device *spi)
 {
     int err;
 
     err = sysfs_create_group(&spi->dev.kobj, &ch432_attribute_group);
-    if (err != 0) {
-        dev_err(&spi->dev, "sysfs_create_group() failed!!");
-        sysfs_remove_group(&spi->dev.kobj, &ch432_attribute_group);
-        return -EIO;
-    }
+    if (err)
+        dev_err(&spi->dev, "sysfs_create_group() failed: %d\n", err);
 
-    err = sysfs_create_link(NULL, &spi->dev.kobj, "ch432");
-    if (err < 0) {
-        dev_err(&spi->dev, "Failed to create link!");
-        return -EIO;
-    }
+    return err;
+}
 
-    dev_info(&spi->dev, "sysfs_create_group() succeeded!!");
+static void ch432_remove_sysfs(struct spi_device *spi)
+{
+    sysfs_remove_group(&spi->dev.kobj, &ch432_attribute_group);
+}
 
-    return err;
+static void ch43x_node_dev_release(struct device *dev)
+{
+	of_node_put(dev->of_node);
+	kfree(dev);
+}
+
+/*
+ * The serial core looks for serdev children (bluetooth, gnss, ...) below the
+ * device node of port->dev, which both ports share. A port whose line
+ * matches the "reg" of a child node gets a device of its own below the spi
+ * device, carrying that child node, as port->dev. So each port gets its own
+ * serdev controller and the spi device is left alone; ports without a child
+ * node stay on the spi device and become a ttyWCH device.
+ */
+static int ch43x_add_one_port(struct ch43x_port *s, struct ch43x_one *one)
+{
+	struct device *parent = one->port.dev;
+	struct device_node *child = NULL;
+	struct device *dev;
+	u32 reg;
+	int ret;
+
+	if (IS_ENABLED(CONFIG_OF) && parent->of_node) {
+		for_each_available_child_of_node(parent->of_node, child)
+			if (!of_property_read_u32(child, "reg", &reg) && reg == one->port.line)
+				break;
+	}
+	if (!child)
+		return uart_add_one_port(&s->uart, &one->port);
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev) {
+		of_node_put(child);
+		return -ENOMEM;
+	}
+	device_initialize(dev);
+	dev->parent = parent;
+	dev->release = ch43x_node_dev_release;
+	/* the reference taken by the child iterator goes with the device */
+	dev->of_node = child;
+	dev->fwnode = of_fwnode_handle(child);
+	dev_set_drvdata(dev, s);
+	ret = dev_set_name(dev, "%s.%d", dev_name(parent), one->port.line);
+	if (!ret)
+		ret = device_add(dev);
+	if (ret) {
+		put_device(dev);
+		return ret;
+	}
+
+	one->port.dev = dev;
+	ret = uart_add_one_port(&s->uart, &one->port);
+	if (ret) {
+		one->port.dev = parent;
+		device_unregister(dev);
+		return ret;
+	}
+	one->node_dev = dev;
+	dev_info(parent, "port %d: serdev node %pOFn\n", one->port.line, child);
+
+	return 0;
+}
+
+/* after uart_remove_one_port(), port->dev goes back to the spi device */
+static void ch43x_put_node_dev(struct ch43x_one *one)
+{
+	if (!one->node_dev)
+		return;
+	one->port.dev = one->node_dev->parent;
+	device_unregister(one->node_dev);
+	one->node_dev = NULL;
 }
 
 static int ch43x_probe(struct spi_device *spi, struct ch43x_devtype *devtype, int irq, unsigned long flags)
@@ -1136,19 +4285,51 @@ static int ch43x_probe(struct spi_device *spi, struct ch43x_devtype *devtype, in
 	s->devtype = devtype;
 	dev_set_drvdata(dev, s);
 	s->spi_dev = spi;
+	ch43x_spi_calibrate(s);
+	for (i = 0; i < devtype->nr_uart; i++) {
+		ret = ch43x_msgs_init(s, &s->p[i].msgs);
+		if (ret) {
+			dev_err(dev, "Allocating spi messages failed\n");
+			goto out_msgs;
+		}
+	}
+	ch43x_msgs_measure(s);
+	ret = ch43x_regmap_init(s);
+	if (ret) {
+		dev_err(dev, "Registering regmap failed\n");
+		goto out_msgs;
+	}
 
 	/* Register UART driver */
 	s->uart.owner = THIS_MODULE;
 	s->uart.dev_name = "ttyWCH";
 	s->uart.nr = devtype->nr_uart;
+
+	/* the console can only live on the first chip */
+	INIT_KFIFO(s->console_fifo);
+	spin_lock_init(&s->console_lock);
+	INIT_WORK(&s->console_work, ch43x_console_work_proc);
+	if (!ch43x_console.data) {
+		ch43x_console.data = &s->uart;
+		s->uart.cons = &ch43x_console;
+	}
+
 	ret = uart_register_driver(&s->uart);
 	if (ret) {
 		dev_err(dev, "Registering UART driver failed\n");
-		goto out_clk;
+		if (ch43x_console.data == &s->uart)
+			ch43x_console.data = NULL;
+		goto out_msgs;
 	}
 
 	mutex_init(&s->mutex);
 	mutex_init(&s->mutex_bus_access);
+	mutex_init(&s->mutex_irq);
+	s->bus_hold_max_us = CH43X_BUS_HOLD_MAX_US;
+	INIT_DELAYED_WORK(&s->recover_work, ch43x_recover_work_proc);
+	INIT_WORK(&s->watchdog_work, ch43x_watchdog_work_proc);
+	hrtimer_init(&s->watchdog, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->watchdog.function = ch43x_watchdog_tick;
 	for (i = 0; i < devtype->nr_uart; ++i) {
 		/* Initialize port data */
 		s->p[i].port.line = i;
@@ -1160,6 +4341,7 @@ static int ch43x_probe(struct spi_device *spi, struct ch43x_devtype *devtype, in
 		s->p[i].port.iotype = UPIO_PORT;
 		s->p[i].port.uartclk = freq;
 		s->p[i].port.ops = &ch43x_ops;
+		mutex_init(&s->p[i].bench.lock);
 		/* Disable all interrupts */
 		ch43x_port_write(&s->p[i].port, CH43X_IER_REG, 0);
 		/* Disable uart interrupts */
@@ -1174,9 +4356,23 @@ static int ch43x_probe(struct spi_device *spi, struct ch43x_devtype *devtype, in
 
 		INIT_WORK(&s->p[i].stop_rx_work, ch43x_stop_rx_work_proc);
 		INIT_WORK(&s->p[i].stop_tx_work, ch43x_stop_tx_work_proc);
+		INIT_DELAYED_WORK(&s->p[i].storm_work, ch43x_storm_work_proc);
+
+		spin_lock_init(&s->p[i].demux.lock);
+		hrtimer_init(&s->p[i].demux.gap_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		s->p[i].demux.gap_timer.function = ch43x_demux_gap_expired;
 
 		/* Register port */
-		uart_add_one_port(&s->uart, &s->p[i].port);
+		ret = ch43x_add_one_port(s, &s->p[i]);
+		if (ret) {
+			dev_err(dev, "Registering port %d failed\n", i);
+			goto out;
+		}
+		ret = ch43x_raw_register(&s->p[i]);
+		if (ret) {
+			dev_err(dev, "Registering raw device %d failed\n", i);
+			goto out;
+		}
 		ret = ch43x_spi_test(&s->p[i].port);
 		if (ret)
 			goto out;
@@ -1190,19 +4386,34 @@ static int ch43x_probe(struct spi_device *spi, struct ch43x_devtype *devtype, in
 					flags, dev_name(dev), s);
 
 	dev_dbg(dev, "%s - devm_request_threaded_irq =%d result:%d\n", __func__, irq, ret);
-    g_ch43x_port = s;
 
-	if (!ret)
+	if (!ret) {
+		WRITE_ONCE(s->running, true);
+		hrtimer_start(&s->watchdog, ms_to_ktime(CH43X_WATCHDOG_IDLE_MS), HRTIMER_MODE_REL);
+		ch43x_debugfs_init(s);
+		ch43x_pmu_register(s);
 		return 0;
+	}
 
 out:
+	if (ch43x_console.data == &s->uart)
+		ch43x_console.data = NULL;
+	for (i = 0; i < devtype->nr_uart; ++i) {
+		if (!IS_ERR_OR_NULL(s->p[i].raw.misc.this_device))
+			misc_deregister(&s->p[i].raw.misc);
+		/* set by uart_add_one_port(), the port device must outlive the port */
+		if (s->p[i].port.state) {
+			uart_remove_one_port(&s->uart, &s->p[i].port);
+			ch43x_put_node_dev(&s->p[i]);
+		}
+	}
 	mutex_destroy(&s->mutex);
 
 	uart_unregister_driver(&s->uart);
 
-out_clk:
-	if (!IS_ERR(s->clk))
-		/*clk_disable_unprepare(s->clk)*/;
+out_msgs:
+	for (i = 0; i < devtype->nr_uart; ++i)
+		ch43x_msgs_free(s, &s->p[i].msgs);
 
 	return ret;
 }
@@ -1214,20 +4425,37 @@ static int ch43x_remove(struct device *dev)
 
 	dev_dbg(dev, "%s\n", __func__);
 
+	WRITE_ONCE(s->running, false);
+	hrtimer_cancel(&s->watchdog);
+	cancel_work_sync(&s->watchdog_work);
+	cancel_delayed_work_sync(&s->recover_work);
+	/* no irq pass from here on, it uses the spi messages freed below */
+	devm_free_irq(dev, s->p[0].port.irq, s);
+	ch43x_pmu_unregister(s);
+	debugfs_remove_recursive(s->debugfs);
 	for (i = 0; i < s->uart.nr; i++) {
 		cancel_work_sync(&s->p[i].tx_work);
 		cancel_work_sync(&s->p[i].md_work);
 		cancel_work_sync(&s->p[i].stop_rx_work);
 		cancel_work_sync(&s->p[i].stop_tx_work);
+		cancel_delayed_work_sync(&s->p[i].storm_work);
+		ch43x_demux_disable(&s->p[i]);
+		misc_deregister(&s->p[i].raw.misc);
 		uart_remove_one_port(&s->uart, &s->p[i].port);
 		ch43x_power(&s->p[i].port, 0);
+		ch43x_put_node_dev(&s->p[i]);
 	}
 
+	cancel_work_sync(&s->console_work);
+	if (ch43x_console.data == &s->uart)
+		ch43x_console.data = NULL;
+
+	ch43x_rec_set(s, NULL);
+	for (i = 0; i < s->uart.nr; i++)
+		ch43x_msgs_free(s, &s->p[i].msgs);
 	mutex_destroy(&s->mutex);
 	mutex_destroy(&s->mutex_bus_access);
 	uart_unregister_driver(&s->uart);
-	if (!IS_ERR(s->clk))
-		/*clk_disable_unprepare(s->clk)*/;
 
 	return 0;
 }
@@ -1253,7 +4481,6 @@ static int ch43x_spi_probe(struct spi_device *spi)
 	save = spi->mode;
 	spi->mode |= SPI_MODE_3;
 
-    spi->max_speed_hz = 20000000;
 	if (spi_setup(spi) < 0) {
 		spi->mode = save;
 	} else {
@@ -1276,7 +4503,12 @@ static int ch43x_spi_probe(struct spi_device *spi)
 	ret = ch43x_probe(spi, devtype, gpio_to_irq(GPIO_NUMBER), flags);
 #endif
 
-    // ch432_create_sysfs(spi);
+    if (ret)
+        return ret;
+
+    ret = ch432_create_sysfs(spi);
+    if (ret)
+        ch43x_remove(&spi->dev);
 
     return ret;
 }
@@ -1287,6 +4519,7 @@ static void ch43x_spi_remove(struct spi_device *spi)
 static int ch43x_spi_remove(struct spi_device *spi)
 #endif
 {
+    ch432_remove_sysfs(spi);
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0))
     ch43x_remove(&spi->dev);
 #else
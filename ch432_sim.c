@@ -0,0 +1,496 @@
+/*
+ * Virtual ch432 behind a software SPI controller.
+ *
+ * Registers an spi controller with one "ch43x_spi" device on it, so the
+ * ch432 driver binds to it unmodified. The chip is the register model of
+ * tools/ch43x_model.c, the one the host harness and the replay tool use: the
+ * 16 byte RX/TX FIFOs timed at the programmed baud rate, the IIR priority
+ * logic, LSR, MSR, the DLAB register bank, MCR loopback, the sleep mode and
+ * the CK2X clock doubler. The INT line is an irq_sim interrupt fired on its
+ * falling edge.
+ *
+ * RX traffic (a counting pattern) is generated at a rate set per port in
+ * /sys/kernel/debug/ch432-sim/port<n>/rx_baud, 0 turns it off. The bytes
+ * arrive with the frame format the port is programmed to, whatever its baud
+ * rate. port<n>/msr sets the modem input lines (CTS 0x10, DSR 0x20, RI 0x40,
+ * DCD 0x80) and raises the matching delta bits. With spi_timing=1 (default)
+ * every spi message takes the time it would take at the device clock.
+ *
+ * Copyright (C) 2024 Nanjing Qinheng Microelectronics Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/irq_sim.h>
+#include <linux/irqdomain.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/seq_file.h>
+#include <linux/spi/spi.h>
+#include "linux/version.h"
+
+#include "tools/ch43x_model.c"
+
+#define DRIVER_DESC "Virtual ch432 on a software spi controller."
+
+/* same crystal as the ch432 driver, CK2X doubles it */
+#define CRYSTAL_FREQ 22118400
+
+#define SIM_NR_UART CH43X_MODEL_NR_UART
+#define SIM_MAX_HZ  50000000
+
+static bool spi_timing = true;
+module_param(spi_timing, bool, 0644);
+MODULE_PARM_DESC(spi_timing, "delay every spi message by its time on the bus");
+
+struct ch43x_sim;
+
+/* what a debugfs file of a port points to */
+struct sim_port {
+	struct ch43x_sim *sim;
+	int line;
+};
+
+struct ch43x_sim {
+	struct platform_device *pdev;
+	struct spi_controller *ctlr;
+	struct spi_device *spi;
+	spinlock_t lock;
+	struct hrtimer timer;
+	bool irq_level;
+	int irq;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0))
+	struct fwnode_handle *fwnode;
+	struct irq_domain *domain;
+#else
+	struct irq_sim irq_sim;
+#endif
+	struct dentry *debugfs;
+	u64 spi_msgs;
+	u64 irq_edges;
+	struct ch43x_model model;
+	struct sim_port p[SIM_NR_UART];
+};
+
+static struct platform_device *sim_pdev;
+
+static void sim_advance(struct ch43x_sim *sim)
+{
+	ch43x_model_advance(&sim->model, ktime_get_ns());
+}
+
+static void sim_fire(struct ch43x_sim *sim)
+{
+	sim->irq_edges++;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0))
+	irq_set_irqchip_state(sim->irq, IRQCHIP_STATE_PENDING, true);
+#else
+	irq_sim_fire(&sim->irq_sim, 0);
+#endif
+}
+
+/*
+ * Updates the INT line and returns the time of the next event, called with
+ * the lock held. INT is active low, the driver triggers on the falling edge.
+ */
+static u64 sim_eval(struct ch43x_sim *sim)
+{
+	u64 next = ch43x_model_next_event(&sim->model);
+	bool level = ch43x_model_irq(&sim->model);
+
+	if (level && !sim->irq_level)
+		sim_fire(sim);
+	sim->irq_level = level;
+
+	return next == CH43X_MODEL_NEVER ? U64_MAX : max(next, sim->model.now + 1);
+}
+
+/* after a register access, called with the lock held */
+static void sim_update(struct ch43x_sim *sim)
+{
+	u64 next = sim_eval(sim);
+
+	if (next != U64_MAX)
+		hrtimer_start(&sim->timer, ns_to_ktime(next), HRTIMER_MODE_ABS);
+}
+
+static enum hrtimer_restart sim_timer_fn(struct hrtimer *timer)
+{
+	struct ch43x_sim *sim = container_of(timer, struct ch43x_sim, timer);
+	unsigned long flags;
+	u64 next;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim_advance(sim);
+	next = sim_eval(sim);
+	/* a register access may have restarted the timer meanwhile */
+	if (hrtimer_is_queued(timer))
+		next = U64_MAX;
+	if (next != U64_MAX)
+		hrtimer_set_expires(timer, ns_to_ktime(next));
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return next != U64_MAX ? HRTIMER_RESTART : HRTIMER_NORESTART;
+}
+
+/*
+ * Runs one chip select period. The first byte is the command, the rest is
+ * data: read commands fill rx, write commands consume tx. Register accesses
+ * other than RHR/THR repeat on the same register.
+ */
+struct sim_cs {
+	bool have_cmd;
+	bool write;
+	u8 line;
+	u8 reg;
+};
+
+static void sim_xfer(struct ch43x_sim *sim, struct sim_cs *cs, struct spi_transfer *t)
+{
+	const u8 *tx = t->tx_buf;
+	u8 *rx = t->rx_buf;
+	unsigned int i;
+	u8 cmd, val;
+
+	for (i = 0; i < t->len; i++) {
+		if (!cs->have_cmd) {
+			cmd = tx ? tx[i] : 0;
+			cs->have_cmd = true;
+			cs->write = !!(cmd & 0x02);
+			cs->line = (cmd >> 5) & 0x07;
+			cs->reg = (cmd >> 2) & 0x07;
+			if (rx)
+				rx[i] = 0xff;
+			continue;
+		}
+		if (cs->line >= SIM_NR_UART) {
+			if (rx)
+				rx[i] = 0xff;
+			continue;
+		}
+		if (cs->write) {
+			ch43x_model_write(&sim->model, cs->line, cs->reg, tx ? tx[i] : 0);
+		} else {
+			val = ch43x_model_read(&sim->model, cs->line, cs->reg);
+			if (rx)
+				rx[i] = val;
+		}
+	}
+}
+
+static void sim_bus_delay(unsigned int bytes, u32 hz)
+{
+	u64 ns;
+
+	if (!spi_timing || !bytes || !hz)
+		return;
+	ns = div_u64((u64)bytes * 8 * NSEC_PER_SEC, hz);
+	if (ns < 20 * NSEC_PER_USEC)
+		ndelay(ns);
+	else
+		usleep_range(div_u64(ns, NSEC_PER_USEC), div_u64(ns, NSEC_PER_USEC) + 5);
+}
+
+static int sim_transfer_one_message(struct spi_controller *ctlr, struct spi_message *msg)
+{
+	struct ch43x_sim *sim = spi_controller_get_devdata(ctlr);
+	struct spi_transfer *t;
+	struct sim_cs cs = { 0 };
+	unsigned long flags;
+	u32 hz;
+
+	list_for_each_entry(t, &msg->transfers, transfer_list) {
+		hz = t->speed_hz ? t->speed_hz : msg->spi->max_speed_hz;
+		sim_bus_delay(t->len, hz);
+
+		spin_lock_irqsave(&sim->lock, flags);
+		sim_advance(sim);
+		sim_xfer(sim, &cs, t);
+		sim_update(sim);
+		spin_unlock_irqrestore(&sim->lock, flags);
+
+		msg->actual_length += t->len;
+		/* chip select toggles, the next transfer starts a new command */
+		if (t->cs_change && !list_is_last(&t->transfer_list, &msg->transfers))
+			memset(&cs, 0, sizeof(cs));
+	}
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim->spi_msgs++;
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	msg->status = 0;
+	spi_finalize_current_message(ctlr);
+
+	return 0;
+}
+
+static int sim_rx_baud_get(void *data, u64 *val)
+{
+	struct sim_port *sp = data;
+
+	*val = sp->sim->model.p[sp->line].rx_baud;
+
+	return 0;
+}
+
+static int sim_rx_baud_set(void *data, u64 val)
+{
+	struct sim_port *sp = data;
+	struct ch43x_sim *sim = sp->sim;
+	unsigned long flags;
+
+	if (val > 100000000)
+		return -EINVAL;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim_advance(sim);
+	ch43x_model_set_rx_baud(&sim->model, sp->line, val);
+	sim_update(sim);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(sim_rx_baud_fops, sim_rx_baud_get, sim_rx_baud_set, "%llu\n");
+
+static int sim_msr_get(void *data, u64 *val)
+{
+	struct sim_port *sp = data;
+
+	*val = sp->sim->model.p[sp->line].msr & 0xf0;
+
+	return 0;
+}
+
+static int sim_msr_set(void *data, u64 val)
+{
+	struct sim_port *sp = data;
+	struct ch43x_sim *sim = sp->sim;
+	unsigned long flags;
+
+	if (val & ~0xf0ull)
+		return -EINVAL;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim_advance(sim);
+	ch43x_model_set_msr(&sim->model, sp->line, val);
+	sim_update(sim);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(sim_msr_fops, sim_msr_get, sim_msr_set, "0x%02llx\n");
+
+static int sim_stats_show(struct seq_file *m, void *v)
+{
+	struct sim_port *sp = m->private;
+	struct ch43x_sim *sim = sp->sim;
+	struct ch43x_model_port c;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim_advance(sim);
+	c = sim->model.p[sp->line];
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	seq_printf(m, "rx_bytes %llu\n", c.rx_bytes);
+	seq_printf(m, "rx_read %llu\n", c.rx_read);
+	seq_printf(m, "rx_overruns %llu\n", c.rx_overruns);
+	seq_printf(m, "rx_asleep %llu\n", c.rx_asleep);
+	seq_printf(m, "rx_max %u\n", c.rx_max);
+	seq_printf(m, "tx_bytes %llu\n", c.tx_bytes);
+	seq_printf(m, "tx_sent %llu\n", c.tx_sent);
+	seq_printf(m, "tx_overflows %llu\n", c.tx_overflows);
+	seq_printf(m, "spi_msgs %llu\n", sim->spi_msgs);
+	seq_printf(m, "irq_edges %llu\n", sim->irq_edges);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sim_stats);
+
+static void sim_debugfs_init(struct ch43x_sim *sim)
+{
+	struct dentry *dir;
+	char name[16];
+	int i;
+
+	sim->debugfs = debugfs_create_dir("ch432-sim", NULL);
+	for (i = 0; i < SIM_NR_UART; i++) {
+		snprintf(name, sizeof(name), "port%d", i);
+		dir = debugfs_create_dir(name, sim->debugfs);
+		debugfs_create_file_unsafe("rx_baud", 0644, dir, &sim->p[i], &sim_rx_baud_fops);
+		debugfs_create_file_unsafe("msr", 0644, dir, &sim->p[i], &sim_msr_fops);
+		debugfs_create_file("stats", 0444, dir, &sim->p[i], &sim_stats_fops);
+	}
+}
+
+static int sim_irq_init(struct ch43x_sim *sim)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0))
+	sim->fwnode = irq_domain_alloc_named_fwnode("ch432-sim");
+	if (!sim->fwnode)
+		return -ENOMEM;
+	sim->domain = irq_domain_create_sim(sim->fwnode, 1);
+	if (IS_ERR(sim->domain)) {
+		irq_domain_free_fwnode(sim->fwnode);
+		return PTR_ERR(sim->domain);
+	}
+	sim->irq = irq_create_mapping(sim->domain, 0);
+	if (!sim->irq) {
+		irq_domain_remove_sim(sim->domain);
+		irq_domain_free_fwnode(sim->fwnode);
+		return -ENXIO;
+	}
+#else
+	int ret = devm_irq_sim_init(&sim->pdev->dev, &sim->irq_sim, 1);
+
+	if (ret)
+		return ret;
+	sim->irq = irq_sim_irqnum(&sim->irq_sim, 0);
+#endif
+
+	return 0;
+}
+
+static void sim_irq_exit(struct ch43x_sim *sim)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0))
+	irq_dispose_mapping(sim->irq);
+	irq_domain_remove_sim(sim->domain);
+	irq_domain_free_fwnode(sim->fwnode);
+#endif
+}
+
+static int sim_probe(struct platform_device *pdev)
+{
+	struct spi_board_info info = {
+		.modalias = "ch43x_spi",
+		.max_speed_hz = 20000000,
+		.mode = SPI_MODE_3,
+	};
+	struct spi_controller *ctlr;
+	struct ch43x_sim *sim;
+	int i, ret;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0))
+	ctlr = spi_alloc_host(&pdev->dev, sizeof(*sim));
+#else
+	ctlr = spi_alloc_master(&pdev->dev, sizeof(*sim));
+#endif
+	if (!ctlr)
+		return -ENOMEM;
+
+	sim = spi_controller_get_devdata(ctlr);
+	sim->pdev = pdev;
+	sim->ctlr = ctlr;
+	spin_lock_init(&sim->lock);
+	hrtimer_init(&sim->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	sim->timer.function = sim_timer_fn;
+	ch43x_model_init(&sim->model, CRYSTAL_FREQ);
+	for (i = 0; i < SIM_NR_UART; i++) {
+		sim->p[i].sim = sim;
+		sim->p[i].line = i;
+	}
+	platform_set_drvdata(pdev, sim);
+
+	ret = sim_irq_init(sim);
+	if (ret)
+		goto out_put;
+
+	ctlr->bus_num = -1;
+	ctlr->num_chipselect = 1;
+	ctlr->mode_bits = SPI_CPOL | SPI_CPHA;
+	ctlr->max_speed_hz = SIM_MAX_HZ;
+	ctlr->transfer_one_message = sim_transfer_one_message;
+	ret = spi_register_controller(ctlr);
+	if (ret)
+		goto out_irq;
+
+	info.irq = sim->irq;
+	sim->spi = spi_new_device(ctlr, &info);
+	if (!sim->spi) {
+		ret = -ENODEV;
+		goto out_unregister;
+	}
+
+	sim_debugfs_init(sim);
+	dev_info(&pdev->dev, "virtual ch432 on spi%d, irq %d\n", ctlr->bus_num, sim->irq);
+
+	return 0;
+
+out_unregister:
+	/* spi_unregister_controller() drops a reference, keep sim alive */
+	spi_controller_get(ctlr);
+	spi_unregister_controller(ctlr);
+out_irq:
+	sim_irq_exit(sim);
+out_put:
+	spi_controller_put(ctlr);
+	return ret;
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0))
+static void sim_remove(struct platform_device *pdev)
+#else
+static int sim_remove(struct platform_device *pdev)
+#endif
+{
+	struct ch43x_sim *sim = platform_get_drvdata(pdev);
+	struct spi_controller *ctlr = sim->ctlr;
+
+	debugfs_remove_recursive(sim->debugfs);
+	spi_controller_get(ctlr);
+	/* unbinds the ch432 driver first */
+	spi_unregister_controller(ctlr);
+	hrtimer_cancel(&sim->timer);
+	sim_irq_exit(sim);
+	spi_controller_put(ctlr);
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0))
+	return 0;
+#endif
+}
+
+static struct platform_driver sim_driver = {
+	.driver = {
+		.name = "ch432-sim",
+	},
+	.probe = sim_probe,
+	.remove = sim_remove,
+};
+
+static int __init sim_init(void)
+{
+	int ret;
+
+	printk(KERN_INFO KBUILD_MODNAME ": " DRIVER_DESC "\n");
+	ret = platform_driver_register(&sim_driver);
+	if (ret)
+		return ret;
+	sim_pdev = platform_device_register_simple("ch432-sim", -1, NULL, 0);
+	if (IS_ERR(sim_pdev)) {
+		platform_driver_unregister(&sim_driver);
+		return PTR_ERR(sim_pdev);
+	}
+
+	return 0;
+}
+module_init(sim_init);
+
+static void __exit sim_exit(void)
+{
+	platform_device_unregister(sim_pdev);
+	platform_driver_unregister(&sim_driver);
+}
+module_exit(sim_exit);
+
+MODULE_AUTHOR("WCH");
+MODULE_DESCRIPTION(DRIVER_DESC);
+MODULE_LICENSE("GPL");
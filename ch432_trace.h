@@ -0,0 +1,126 @@
+/*
+ * Tracepoints for the ch432 SPI serial driver.
+ *
+ * Copyright (C) 2024 Nanjing Qinheng Microelectronics Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ch432
+
+#if !defined(_CH432_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CH432_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(ch43x_reg,
+	TP_PROTO(u8 line, u8 reg, u8 val, u64 ns),
+	TP_ARGS(line, reg, val, ns),
+	TP_STRUCT__entry(
+		__field(u8, line)
+		__field(u8, reg)
+		__field(u8, val)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->line = line;
+		__entry->reg = reg;
+		__entry->val = val;
+		__entry->ns = ns;
+	),
+	TP_printk("port=%u reg=0x%02x val=0x%02x spi_ns=%llu",
+		  __entry->line, __entry->reg, __entry->val, __entry->ns)
+);
+
+/* register read, ns is the spi transfer time */
+DEFINE_EVENT(ch43x_reg, ch43x_reg_read,
+	TP_PROTO(u8 line, u8 reg, u8 val, u64 ns),
+	TP_ARGS(line, reg, val, ns)
+);
+
+/* register write, ns is the spi transfer time */
+DEFINE_EVENT(ch43x_reg, ch43x_reg_write,
+	TP_PROTO(u8 line, u8 reg, u8 val, u64 ns),
+	TP_ARGS(line, reg, val, ns)
+);
+
+/* RHR/THR FIFO burst */
+TRACE_EVENT(ch43x_burst,
+	TP_PROTO(u8 line, u8 reg, unsigned int len, bool write, u64 ns),
+	TP_ARGS(line, reg, len, write, ns),
+	TP_STRUCT__entry(
+		__field(u8, line)
+		__field(u8, reg)
+		__field(unsigned int, len)
+		__field(bool, write)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->line = line;
+		__entry->reg = reg;
+		__entry->len = len;
+		__entry->write = write;
+		__entry->ns = ns;
+	),
+	TP_printk("port=%u reg=0x%02x %s len=%u spi_ns=%llu",
+		  __entry->line, __entry->reg, __entry->write ? "write" : "read",
+		  __entry->len, __entry->ns)
+);
+
+DECLARE_EVENT_CLASS(ch43x_irq,
+	TP_PROTO(int irq),
+	TP_ARGS(irq),
+	TP_STRUCT__entry(
+		__field(int, irq)
+	),
+	TP_fast_assign(
+		__entry->irq = irq;
+	),
+	TP_printk("irq=%d", __entry->irq)
+);
+
+/* irq thread start */
+DEFINE_EVENT(ch43x_irq, ch43x_irq_enter,
+	TP_PROTO(int irq),
+	TP_ARGS(irq)
+);
+
+/* irq thread end */
+DEFINE_EVENT(ch43x_irq, ch43x_irq_exit,
+	TP_PROTO(int irq),
+	TP_ARGS(irq)
+);
+
+/* one interrupt source of a port is handled */
+TRACE_EVENT(ch43x_port_irq,
+	TP_PROTO(u8 line, u8 iir),
+	TP_ARGS(line, iir),
+	TP_STRUCT__entry(
+		__field(u8, line)
+		__field(u8, iir)
+	),
+	TP_fast_assign(
+		__entry->line = line;
+		__entry->iir = iir;
+	),
+	TP_printk("port=%u iir=0x%02x %s", __entry->line, __entry->iir,
+		  __print_symbolic(__entry->iir,
+				   { 0x00, "MSI" },
+				   { 0x02, "THRI" },
+				   { 0x04, "RDI" },
+				   { 0x06, "RLSE" },
+				   { 0x0c, "RTOI" }))
+);
+
+#endif /* _CH432_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ch432_trace
+#include <trace/define_trace.h>
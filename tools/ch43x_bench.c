@@ -0,0 +1,594 @@
+/*
+ * Benchmark suite for ttyWCH ports.
+ *
+ * Runs standard scenarios through the tty interface and prints one CSV line
+ * (or JSON object with -j) per scenario:
+ *   unidir    port a streams a counting pattern to its peer
+ *   bidir     both ports stream at the same time
+ *   pingpong  small message round trips (-m bytes)
+ *   rs485     request/response turnaround with RS485 mode on port a
+ *   tcdrain   cost of tcdrain() after a -m byte write, beyond the wire time
+ *
+ * With -L every port is put into internal loopback and is its own peer, so
+ * no wiring is needed. Without it port a and port b must be cross-connected,
+ * in pingpong and rs485 port b echoes what it receives.
+ *
+ * With -s the spi counters are read from the driver's debugfs stats file
+ * before and after each scenario, and reported per payload byte. Point it at
+ * /sys/kernel/debug/ch432-<spi device>, the port number is taken from the tty
+ * name. The same runs work on the virtual chip of ch432_sim.ko.
+ *
+ *   ch43x_bench [-L] [-j] [-t sec] [-r baud] [-m bytes] [-s debugfs] -a tty [-b tty] [scenario...]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+/* not exported by the libc headers, the driver maps it to MCR LOOP */
+#ifndef TIOCM_LOOP
+#define TIOCM_LOOP 0x8000
+#endif
+
+#define BENCH_INFLIGHT 4096 /* bytes sent but not yet received, per stream */
+#define BENCH_MAX_MSG  256
+
+struct port {
+	const char *path;
+	int fd;
+	int line; /* driver port number, from the tty name */
+};
+
+struct spi_counters {
+	uint64_t msgs;
+	uint64_t xfers;
+	int valid;
+};
+
+struct result {
+	const char *scenario;
+	double secs;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t samples;
+	double p50_us, p99_us, max_us;
+};
+
+static struct {
+	int loop;
+	int json;
+	double secs;
+	unsigned int baud;
+	unsigned int msg;
+	const char *debugfs;
+	struct port a, b;
+	int have_b;
+	int rows;
+} cfg = {
+	.secs = 5,
+	.baud = 921600,
+	.msg = 8,
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static speed_t to_speed(unsigned int baud)
+{
+	switch (baud) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	case 1000000: return B1000000;
+	case 1500000: return B1500000;
+	case 2000000: return B2000000;
+	default: return B0;
+	}
+}
+
+static int port_open(struct port *p)
+{
+	struct termios tio;
+	int loop = TIOCM_LOOP;
+	const char *d;
+
+	p->fd = open(p->path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (p->fd < 0) {
+		perror(p->path);
+		return -1;
+	}
+	tcgetattr(p->fd, &tio);
+	cfmakeraw(&tio);
+	cfsetspeed(&tio, to_speed(cfg.baud));
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	tcsetattr(p->fd, TCSANOW, &tio);
+	ioctl(p->fd, cfg.loop ? TIOCMBIS : TIOCMBIC, &loop);
+	tcflush(p->fd, TCIOFLUSH);
+
+	for (d = p->path + strlen(p->path); d > p->path && isdigit((unsigned char)d[-1]); d--)
+		;
+	p->line = atoi(d);
+
+	return 0;
+}
+
+static void port_close(struct port *p)
+{
+	int loop = TIOCM_LOOP;
+
+	if (p->fd < 0)
+		return;
+	if (cfg.loop)
+		ioctl(p->fd, TIOCMBIC, &loop);
+	close(p->fd);
+	p->fd = -1;
+}
+
+static struct port *peer(struct port *p)
+{
+	if (cfg.loop)
+		return p;
+	return p == &cfg.a ? &cfg.b : &cfg.a;
+}
+
+/* spi counters of a port from the driver's debugfs stats file */
+static struct spi_counters spi_read(const struct port *p)
+{
+	struct spi_counters c = { 0 };
+	char path[512], name[64];
+	unsigned long long val;
+	FILE *f;
+
+	if (!cfg.debugfs)
+		return c;
+	snprintf(path, sizeof(path), "%s/port%d/stats", cfg.debugfs, p->line);
+	f = fopen(path, "r");
+	if (!f)
+		return c;
+	while (fscanf(f, "%63s %llu", name, &val) == 2) {
+		if (!strcmp(name, "spi_msgs"))
+			c.msgs = val;
+		else if (!strcmp(name, "spi_xfers"))
+			c.xfers = val;
+	}
+	fclose(f);
+	c.valid = 1;
+
+	return c;
+}
+
+static struct spi_counters spi_snapshot(void)
+{
+	struct spi_counters c = spi_read(&cfg.a);
+
+	if (cfg.have_b && c.valid) {
+		struct spi_counters cb = spi_read(&cfg.b);
+
+		c.msgs += cb.msgs;
+		c.xfers += cb.xfers;
+		c.valid = cb.valid;
+	}
+
+	return c;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void lat_summary(struct result *r, double *lat, size_t n)
+{
+	r->samples = n;
+	if (!n)
+		return;
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	r->p50_us = lat[n / 2] * 1e6;
+	r->p99_us = lat[(n * 99) / 100] * 1e6;
+	r->max_us = lat[n - 1] * 1e6;
+}
+
+static void report(struct result *r, struct spi_counters before)
+{
+	struct spi_counters after = spi_snapshot();
+	double bps = r->secs > 0 ? r->bytes / r->secs : 0;
+	double msgs = 0, xfers = 0;
+
+	if (before.valid && after.valid && r->bytes) {
+		msgs = (double)(after.msgs - before.msgs) / r->bytes;
+		xfers = (double)(after.xfers - before.xfers) / r->bytes;
+	}
+
+	if (cfg.json) {
+		printf("%s{\"scenario\":\"%s\",\"baud\":%u,\"seconds\":%.3f,\"bytes\":%llu,\"bytes_per_sec\":%.0f,"
+		       "\"errors\":%llu,\"samples\":%llu,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f",
+		       cfg.rows ? ",\n" : "[\n", r->scenario, cfg.baud, r->secs, (unsigned long long)r->bytes, bps,
+		       (unsigned long long)r->errors, (unsigned long long)r->samples, r->p50_us, r->p99_us,
+		       r->max_us);
+		if (before.valid && after.valid)
+			printf(",\"spi_msgs_per_byte\":%.3f,\"spi_xfers_per_byte\":%.3f", msgs, xfers);
+		printf("}");
+	} else {
+		if (!cfg.rows)
+			printf("scenario,baud,seconds,bytes,bytes_per_sec,errors,samples,p50_us,p99_us,max_us,"
+			       "spi_msgs_per_byte,spi_xfers_per_byte\n");
+		printf("%s,%u,%.3f,%llu,%.0f,%llu,%llu,%.1f,%.1f,%.1f,", r->scenario, cfg.baud, r->secs,
+		       (unsigned long long)r->bytes, bps, (unsigned long long)r->errors,
+		       (unsigned long long)r->samples, r->p50_us, r->p99_us, r->max_us);
+		if (before.valid && after.valid)
+			printf("%.3f,%.3f\n", msgs, xfers);
+		else
+			printf(",\n");
+	}
+	cfg.rows++;
+	fflush(stdout);
+}
+
+struct stream {
+	struct port *tx, *rx;
+	uint8_t tx_seq, rx_seq;
+	uint64_t sent, received, errors;
+};
+
+static void stream_rx(struct stream *st)
+{
+	uint8_t buf[4096];
+	ssize_t n, i;
+
+	n = read(st->rx->fd, buf, sizeof(buf));
+	for (i = 0; i < n; i++) {
+		if (buf[i] != st->rx_seq)
+			st->errors++;
+		st->rx_seq = buf[i] + 1;
+	}
+	if (n > 0)
+		st->received += n;
+}
+
+static void stream_tx(struct stream *st)
+{
+	uint8_t buf[4096];
+	size_t i, len = BENCH_INFLIGHT - (st->sent - st->received);
+	ssize_t n;
+
+	if (len > sizeof(buf))
+		len = sizeof(buf);
+	for (i = 0; i < len; i++)
+		buf[i] = st->tx_seq + i;
+	n = write(st->tx->fd, buf, len);
+	if (n > 0) {
+		st->tx_seq += n;
+		st->sent += n;
+	}
+}
+
+static void run_streams(struct result *r, struct stream *st, int n)
+{
+	struct pollfd pfd[4];
+	double start = now(), end = start + cfg.secs, t;
+	int i, sending = 1;
+
+	while ((t = now()) < end + 0.5) {
+		if (sending && t >= end)
+			sending = 0;
+		if (!sending) {
+			for (i = 0; i < n && st[i].received >= st[i].sent; i++)
+				;
+			if (i == n)
+				break;
+		}
+		for (i = 0; i < n; i++) {
+			pfd[2 * i].fd = st[i].rx->fd;
+			pfd[2 * i].events = POLLIN;
+			pfd[2 * i + 1].fd = st[i].tx->fd;
+			pfd[2 * i + 1].events = sending && st[i].sent - st[i].received < BENCH_INFLIGHT ? POLLOUT : 0;
+		}
+		if (poll(pfd, 2 * n, 100) < 0)
+			break;
+		for (i = 0; i < n; i++) {
+			if (pfd[2 * i].revents & POLLIN)
+				stream_rx(&st[i]);
+			if (pfd[2 * i + 1].revents & POLLOUT)
+				stream_tx(&st[i]);
+		}
+	}
+
+	r->secs = cfg.secs;
+	for (i = 0; i < n; i++) {
+		r->bytes += st[i].received;
+		r->errors += st[i].errors + (st[i].sent - st[i].received);
+	}
+}
+
+static void scenario_unidir(struct result *r)
+{
+	struct stream st = { .tx = &cfg.a, .rx = peer(&cfg.a) };
+
+	run_streams(r, &st, 1);
+}
+
+static int scenario_bidir(struct result *r)
+{
+	struct stream st[2] = {
+		{ .tx = &cfg.a, .rx = peer(&cfg.a) },
+		{ .tx = &cfg.b, .rx = peer(&cfg.b) },
+	};
+
+	if (!cfg.have_b)
+		return -1;
+	run_streams(r, st, 2);
+
+	return 0;
+}
+
+/* writes all of buf on the non-blocking fd */
+static int write_full(int fd, const uint8_t *buf, size_t len)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno != EAGAIN)
+			return -1;
+		if (n > 0) {
+			buf += n;
+			len -= n;
+		} else if (poll(&pfd, 1, 1000) <= 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* reads len bytes from fd within timeout seconds, echoing them to echo_fd if set */
+static int read_full(int fd, uint8_t *buf, size_t len, double timeout, int echo_fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	double end = now() + timeout;
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < len) {
+		int ms = (end - now()) * 1000;
+
+		if (ms <= 0 || poll(&pfd, 1, ms) <= 0)
+			return -1;
+		n = read(fd, buf + got, len - got);
+		if (n <= 0)
+			continue;
+		if (echo_fd >= 0 && write_full(echo_fd, buf + got, n))
+			return -1;
+		got += n;
+	}
+
+	return 0;
+}
+
+/* message round trips, port b echoes when the ports are cross-connected */
+static void run_pingpong(struct result *r)
+{
+	size_t cap = 1024, n = 0;
+	double *lat = malloc(cap * sizeof(*lat));
+	double start = now(), t0;
+	uint8_t tx[BENCH_MAX_MSG], rx[BENCH_MAX_MSG];
+	unsigned int i, seq = 0;
+
+	while (lat && now() - start < cfg.secs) {
+		for (i = 0; i < cfg.msg; i++)
+			tx[i] = seq++;
+		t0 = now();
+		if (write_full(cfg.a.fd, tx, cfg.msg)) {
+			r->errors++;
+			break;
+		}
+		if (!cfg.loop && read_full(cfg.b.fd, rx, cfg.msg, 1.0, cfg.b.fd)) {
+			r->errors++;
+			tcflush(cfg.b.fd, TCIOFLUSH);
+			continue;
+		}
+		if (read_full(cfg.a.fd, rx, cfg.msg, 1.0, -1) || memcmp(tx, rx, cfg.msg)) {
+			r->errors++;
+			tcflush(cfg.a.fd, TCIOFLUSH);
+			continue;
+		}
+		if (n == cap) {
+			double *p = realloc(lat, 2 * cap * sizeof(*lat));
+
+			if (!p)
+				break;
+			lat = p;
+			cap *= 2;
+		}
+		lat[n++] = now() - t0;
+		r->bytes += cfg.msg;
+	}
+
+	r->secs = now() - start;
+	lat_summary(r, lat, n);
+	free(lat);
+}
+
+static int scenario_rs485(struct result *r)
+{
+	struct serial_rs485 rs485 = { .flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND };
+	struct serial_rs485 off = { 0 };
+
+	if (ioctl(cfg.a.fd, TIOCSRS485, &rs485) < 0) {
+		perror("TIOCSRS485");
+		return -1;
+	}
+	run_pingpong(r);
+	ioctl(cfg.a.fd, TIOCSRS485, &off);
+
+	return 0;
+}
+
+/* time of tcdrain() beyond the time the bytes need on the wire */
+static void scenario_tcdrain(struct result *r)
+{
+	size_t cap = 1024, n = 0;
+	double *lat = malloc(cap * sizeof(*lat));
+	double wire = cfg.msg * 10.0 / cfg.baud, start = now(), t0;
+	uint8_t buf[BENCH_MAX_MSG] = { 0 };
+
+	while (lat && now() - start < cfg.secs) {
+		t0 = now();
+		if (write_full(cfg.a.fd, buf, cfg.msg)) {
+			r->errors++;
+			break;
+		}
+		tcdrain(cfg.a.fd);
+		if (n == cap) {
+			double *p = realloc(lat, 2 * cap * sizeof(*lat));
+
+			if (!p)
+				break;
+			lat = p;
+			cap *= 2;
+		}
+		lat[n] = now() - t0 - wire;
+		if (lat[n] < 0)
+			lat[n] = 0;
+		n++;
+		r->bytes += cfg.msg;
+		/* drop what came back to the peer */
+		tcflush(peer(&cfg.a)->fd, TCIFLUSH);
+	}
+
+	r->secs = now() - start;
+	lat_summary(r, lat, n);
+	free(lat);
+}
+
+static int run(const char *name)
+{
+	struct result r = { .scenario = name };
+	struct spi_counters before = spi_snapshot();
+	int ret = 0;
+
+	if (!strcmp(name, "unidir"))
+		scenario_unidir(&r);
+	else if (!strcmp(name, "bidir"))
+		ret = scenario_bidir(&r);
+	else if (!strcmp(name, "pingpong"))
+		run_pingpong(&r);
+	else if (!strcmp(name, "rs485"))
+		ret = scenario_rs485(&r);
+	else if (!strcmp(name, "tcdrain"))
+		scenario_tcdrain(&r);
+	else
+		ret = -1;
+
+	if (ret) {
+		fprintf(stderr, "%s: skipped\n", name);
+		return ret;
+	}
+	report(&r, before);
+	tcflush(cfg.a.fd, TCIOFLUSH);
+	if (cfg.have_b)
+		tcflush(cfg.b.fd, TCIOFLUSH);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *const all[] = { "unidir", "bidir", "pingpong", "rs485", "tcdrain" };
+	int opt, i, ret = 0;
+
+	cfg.a.fd = cfg.b.fd = -1;
+	while ((opt = getopt(argc, argv, "La:b:jt:r:m:s:")) != -1) {
+		switch (opt) {
+		case 'L':
+			cfg.loop = 1;
+			break;
+		case 'a':
+			cfg.a.path = optarg;
+			break;
+		case 'b':
+			cfg.b.path = optarg;
+			cfg.have_b = 1;
+			break;
+		case 'j':
+			cfg.json = 1;
+			break;
+		case 't':
+			cfg.secs = atof(optarg);
+			break;
+		case 'r':
+			cfg.baud = atoi(optarg);
+			break;
+		case 'm':
+			cfg.msg = atoi(optarg);
+			break;
+		case 's':
+			cfg.debugfs = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (!cfg.a.path || (!cfg.loop && !cfg.have_b) || !cfg.msg || cfg.msg > BENCH_MAX_MSG)
+		goto usage;
+	if (to_speed(cfg.baud) == B0) {
+		fprintf(stderr, "unsupported baud %u\n", cfg.baud);
+		return 1;
+	}
+	if (port_open(&cfg.a) || (cfg.have_b && port_open(&cfg.b)))
+		return 1;
+
+	if (optind < argc) {
+		for (i = optind; i < argc; i++)
+			ret |= run(argv[i]);
+	} else {
+		for (i = 0; i < (int)(sizeof(all) / sizeof(all[0])); i++)
+			if (strcmp(all[i], "bidir") || cfg.have_b)
+				ret |= run(all[i]);
+	}
+	if (cfg.json && cfg.rows)
+		printf("\n]\n");
+
+	port_close(&cfg.a);
+	port_close(&cfg.b);
+
+	return ret ? 1 : 0;
+
+usage:
+	fprintf(stderr,
+		"usage: %s [-L] [-j] [-t sec] [-r baud] [-m bytes] [-s debugfs] -a tty [-b tty] [scenario...]\n"
+		"scenarios: unidir bidir pingpong rs485 tcdrain (default all)\n"
+		"-L puts every port into internal loopback, otherwise a and b must be cross-connected\n",
+		argv[0]);
+	return 1;
+}
@@ -0,0 +1,500 @@
+/*
+ * Register level model of the SPI to Dual UARTs chip ch432.
+ *
+ * ch43x_model_init() takes the crystal clock, CK2X in IER of port 1 doubles
+ * it for both ports like on the chip. SLEEP in IER of port 0 stops the
+ * clock: the shift register holds its byte and bytes arriving at RX are
+ * lost until the bit is cleared again.
+ *
+ * The same file is built into ch432_sim.ko, so it only uses what both the
+ * kernel and a hosted C library provide.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifdef __KERNEL__
+#include <linux/math64.h>
+#include <linux/string.h>
+#define model_div64(a, b) div64_u64(a, b)
+#else
+#include <string.h>
+#define model_div64(a, b) ((a) / (b))
+#endif
+
+#include "ch43x_model.h"
+
+#define REG_RHR 0x00
+#define REG_THR 0x00
+#define REG_IER 0x01
+#define REG_IIR 0x02
+#define REG_FCR 0x02
+#define REG_LCR 0x03
+#define REG_MCR 0x04
+#define REG_LSR 0x05
+#define REG_MSR 0x06
+#define REG_SPR 0x07
+#define REG_DLL 0x00
+#define REG_DLH 0x01
+
+#define IER_RDI	 (1 << 0)
+#define IER_THRI (1 << 1)
+#define IER_RLSI (1 << 2)
+#define IER_MSI	 (1 << 3)
+#define IER_SLEEP (1 << 5) /* port 0 */
+#define IER_CK2X  (1 << 5) /* port 1 */
+#define IER_RESET (1 << 7)
+
+#define FCR_FIFO    (1 << 0)
+#define FCR_RXRESET (1 << 1)
+#define FCR_TXRESET (1 << 2)
+
+#define IIR_NO_INT 0x01
+#define IIR_MSI	   0x00
+#define IIR_THRI   0x02
+#define IIR_RDI	   0x04
+#define IIR_RLSE   0x06
+#define IIR_RTOI   0x0c
+#define IIR_FIFO   0xc0
+
+#define LCR_PARITY  (1 << 3)
+#define LCR_STOPLEN (1 << 2)
+#define LCR_DLAB    (1 << 7)
+
+#define MCR_DTR	 (1 << 0)
+#define MCR_RTS	 (1 << 1)
+#define MCR_OUT1 (1 << 2)
+#define MCR_OUT2 (1 << 3)
+#define MCR_LOOP (1 << 4)
+
+#define LSR_DR	 (1 << 0)
+#define LSR_OE	 (1 << 1)
+#define LSR_THRE (1 << 5)
+#define LSR_TEMT (1 << 6)
+
+#define MSR_CTS (1 << 4)
+#define MSR_DSR (1 << 5)
+#define MSR_RI	(1 << 6)
+#define MSR_DCD (1 << 7)
+
+/* RTOI fires after four character times without RX activity */
+#define RTOI_CHARS 4
+
+static const unsigned int rx_trig[4] = { 1, 4, 8, 14 };
+
+void ch43x_model_init(struct ch43x_model *m, uint32_t xtal)
+{
+	memset(m, 0, sizeof(*m));
+	m->xtal = xtal;
+}
+
+uint32_t ch43x_model_uartclk(const struct ch43x_model *m)
+{
+	return (m->p[1].ier & IER_CK2X) ? m->xtal * 2 : m->xtal;
+}
+
+static bool asleep(const struct ch43x_model *m)
+{
+	return m->p[0].ier & IER_SLEEP;
+}
+
+static unsigned int char_bits(const struct ch43x_model_port *p)
+{
+	return 1 + 5 + (p->lcr & 0x03) + !!(p->lcr & LCR_PARITY) + ((p->lcr & LCR_STOPLEN) ? 2 : 1);
+}
+
+uint64_t ch43x_model_char_ns(const struct ch43x_model *m, int line)
+{
+	const struct ch43x_model_port *p = &m->p[line];
+	unsigned int div = p->dlh << 8 | p->dll;
+	uint32_t clk = ch43x_model_uartclk(m);
+
+	if (!div || !clk)
+		return 0;
+
+	return model_div64((uint64_t)char_bits(p) * div * 16 * 1000000000ull, clk);
+}
+
+/* time between two generated RX bytes, 0 for no traffic */
+static uint64_t rx_gap_ns(const struct ch43x_model_port *p, uint64_t char_ns)
+{
+	if (p->rx_baud)
+		return model_div64((uint64_t)char_bits(p) * 1000000000ull, p->rx_baud);
+	if (p->rx_load_ppm)
+		return model_div64(char_ns * 1000000, p->rx_load_ppm);
+
+	return 0;
+}
+
+void ch43x_model_set_rx_baud(struct ch43x_model *m, int line, uint32_t baud)
+{
+	m->p[line].rx_baud = baud;
+	m->p[line].rx_load_ppm = 0;
+	m->p[line].rx_next_ns = 0;
+}
+
+#ifndef __KERNEL__
+void ch43x_model_set_rx_load(struct ch43x_model *m, int line, double load)
+{
+	m->p[line].rx_baud = 0;
+	m->p[line].rx_load_ppm = load > 0 ? load * 1000000 + 0.5 : 0;
+	m->p[line].rx_next_ns = 0;
+}
+#endif
+
+static void rx_push(struct ch43x_model_port *p, uint8_t ch, uint64_t t)
+{
+	p->rx_last_ns = t;
+	if (p->rx_count == CH43X_MODEL_FIFO_SIZE) {
+		p->rx_overruns++;
+		p->lsr_err |= LSR_OE;
+		return;
+	}
+	p->rx[(p->rx_head + p->rx_count) % CH43X_MODEL_FIFO_SIZE] = ch;
+	p->rx_count++;
+	p->rx_bytes++;
+	if (p->rx_count > p->rx_max)
+		p->rx_max = p->rx_count;
+}
+
+/* moves the next FIFO byte into the shift register, starting at time t */
+static void tx_load(struct ch43x_model_port *p, uint64_t t, uint64_t char_ns)
+{
+	if (!p->tx_count) {
+		p->shift_busy = false;
+		return;
+	}
+	p->shift_byte = p->tx[p->tx_head];
+	p->tx_head = (p->tx_head + 1) % CH43X_MODEL_FIFO_SIZE;
+	p->tx_count--;
+	p->shift_busy = true;
+	p->tx_next_ns = t + char_ns;
+	if (!p->tx_count)
+		p->thri = true;
+}
+
+static void port_advance(struct ch43x_model *m, int line, uint64_t now)
+{
+	struct ch43x_model_port *p = &m->p[line];
+	uint64_t char_ns = ch43x_model_char_ns(m, line);
+	uint64_t gap, n;
+
+	if (!char_ns)
+		return;
+
+	if (asleep(m)) {
+		/* the clock stopped, the byte in the shift register waits */
+		if (p->shift_busy)
+			p->tx_next_ns += now - m->now;
+	} else {
+		while (p->shift_busy && p->tx_next_ns <= now) {
+			uint64_t t = p->tx_next_ns;
+
+			p->tx_sent++;
+			if (p->mcr & MCR_LOOP)
+				rx_push(p, p->shift_byte, t);
+			tx_load(p, t, char_ns);
+		}
+	}
+
+	gap = rx_gap_ns(p, char_ns);
+	if (!gap || (p->mcr & MCR_LOOP))
+		return;
+	if (!p->rx_next_ns)
+		p->rx_next_ns = m->now + gap;
+	if (p->rx_next_ns > now)
+		return;
+	if (asleep(m)) {
+		n = model_div64(now - p->rx_next_ns, gap) + 1;
+		p->rx_asleep += n;
+		p->rx_seq += n;
+		p->rx_next_ns += n * gap;
+		return;
+	}
+	/* after a long unserviced time only the last bytes need a real push */
+	if (p->rx_next_ns + 2 * CH43X_MODEL_FIFO_SIZE * gap < now) {
+		uint64_t skip = model_div64(now - p->rx_next_ns, gap) - 2 * CH43X_MODEL_FIFO_SIZE;
+		uint64_t fill = CH43X_MODEL_FIFO_SIZE - p->rx_count;
+
+		for (fill = skip < fill ? skip : fill; fill; fill--, skip--) {
+			rx_push(p, p->rx_seq++, p->rx_next_ns);
+			p->rx_next_ns += gap;
+		}
+		if (skip) {
+			p->rx_overruns += skip;
+			p->lsr_err |= LSR_OE;
+			p->rx_seq += skip;
+			p->rx_next_ns += skip * gap;
+		}
+	}
+	while (p->rx_next_ns <= now) {
+		rx_push(p, p->rx_seq++, p->rx_next_ns);
+		p->rx_next_ns += gap;
+	}
+}
+
+void ch43x_model_advance(struct ch43x_model *m, uint64_t now)
+{
+	int i;
+
+	if (now <= m->now)
+		return;
+	for (i = 0; i < CH43X_MODEL_NR_UART; i++)
+		port_advance(m, i, now);
+	m->now = now;
+}
+
+static uint8_t iir_id(const struct ch43x_model *m, int line)
+{
+	const struct ch43x_model_port *p = &m->p[line];
+	uint64_t char_ns = ch43x_model_char_ns(m, line);
+
+	if ((p->ier & IER_RLSI) && p->lsr_err)
+		return IIR_RLSE;
+	if ((p->ier & IER_RDI) && p->rx_count >= rx_trig[p->fcr >> 6])
+		return IIR_RDI;
+	if ((p->ier & IER_RDI) && p->rx_count && m->now - p->rx_last_ns >= RTOI_CHARS * char_ns)
+		return IIR_RTOI;
+	if ((p->ier & IER_THRI) && p->thri)
+		return IIR_THRI;
+	if ((p->ier & IER_MSI) && (p->msr & 0x0f))
+		return IIR_MSI;
+
+	return IIR_NO_INT;
+}
+
+bool ch43x_model_irq(struct ch43x_model *m)
+{
+	int i;
+
+	for (i = 0; i < CH43X_MODEL_NR_UART; i++)
+		if (iir_id(m, i) != IIR_NO_INT)
+			return true;
+
+	return false;
+}
+
+static uint64_t port_next_event(const struct ch43x_model *m, int line)
+{
+	const struct ch43x_model_port *p = &m->p[line];
+	uint64_t char_ns = ch43x_model_char_ns(m, line);
+	uint64_t next = CH43X_MODEL_NEVER, gap, t;
+	unsigned int need;
+
+	if (!char_ns)
+		return next;
+
+	/* asleep nothing moves but the RX time-out */
+	if (asleep(m))
+		goto rtoi;
+	if (p->shift_busy && ((p->mcr & MCR_LOOP) || !p->tx_count))
+		next = p->tx_next_ns;
+	else if (p->shift_busy && (p->ier & IER_THRI))
+		next = p->tx_next_ns + (p->tx_count - 1) * char_ns;
+
+	gap = rx_gap_ns(p, char_ns);
+	if (gap && !(p->mcr & MCR_LOOP)) {
+		/* traffic that was just turned on starts one gap after now */
+		t = p->rx_next_ns ? p->rx_next_ns : m->now + gap;
+		need = 0;
+		if ((p->ier & IER_RDI) && p->rx_count < rx_trig[p->fcr >> 6])
+			need = rx_trig[p->fcr >> 6] - p->rx_count;
+		else if (p->ier & IER_RLSI)
+			need = CH43X_MODEL_FIFO_SIZE + 1 - p->rx_count;
+		if (need && t + (need - 1) * gap < next)
+			next = t + (need - 1) * gap;
+	}
+rtoi:
+	t = p->rx_last_ns + RTOI_CHARS * char_ns;
+	if ((p->ier & IER_RDI) && p->rx_count && t > m->now && t < next)
+		next = t;
+
+	return next;
+}
+
+uint64_t ch43x_model_next_event(const struct ch43x_model *m)
+{
+	uint64_t next = CH43X_MODEL_NEVER, t;
+	int i;
+
+	for (i = 0; i < CH43X_MODEL_NR_UART; i++) {
+		t = port_next_event(m, i);
+		if (t < next)
+			next = t;
+	}
+
+	return next;
+}
+
+static uint8_t msr_value(const struct ch43x_model_port *p)
+{
+	uint8_t lines;
+
+	if (!(p->mcr & MCR_LOOP))
+		return p->msr;
+	lines = ((p->mcr & MCR_RTS) ? MSR_CTS : 0) | ((p->mcr & MCR_DTR) ? MSR_DSR : 0) |
+		((p->mcr & MCR_OUT1) ? MSR_RI : 0) | ((p->mcr & MCR_OUT2) ? MSR_DCD : 0);
+
+	return lines | (p->msr & 0x0f);
+}
+
+/* input lines changed from old to new, latches the deltas (RI on trailing edge) */
+static void msr_delta(struct ch43x_model_port *p, uint8_t old, uint8_t new)
+{
+	uint8_t changed = (old ^ new) & 0xf0;
+
+	p->msr |= (changed >> 4) & 0x0b;
+	if ((changed & MSR_RI) && !(new & MSR_RI))
+		p->msr |= 0x04;
+}
+
+void ch43x_model_set_msr(struct ch43x_model *m, int line, uint8_t lines)
+{
+	struct ch43x_model_port *p = &m->p[line];
+
+	msr_delta(p, p->msr, lines);
+	p->msr = (p->msr & 0x0f) | (lines & 0xf0);
+}
+
+uint8_t ch43x_model_read(struct ch43x_model *m, int line, uint8_t reg)
+{
+	struct ch43x_model_port *p = &m->p[line];
+	uint8_t val;
+
+	if ((p->lcr & LCR_DLAB) && reg == REG_DLL)
+		return p->dll;
+	if ((p->lcr & LCR_DLAB) && reg == REG_DLH)
+		return p->dlh;
+
+	switch (reg) {
+	case REG_RHR:
+		if (!p->rx_count)
+			return 0;
+		val = p->rx[p->rx_head];
+		p->rx_head = (p->rx_head + 1) % CH43X_MODEL_FIFO_SIZE;
+		p->rx_count--;
+		p->rx_read++;
+		p->rx_last_ns = m->now;
+		return val;
+	case REG_IER:
+		return p->ier;
+	case REG_IIR:
+		val = iir_id(m, line);
+		if (val == IIR_THRI)
+			p->thri = false;
+		return val | ((p->fcr & FCR_FIFO) ? IIR_FIFO : 0);
+	case REG_LCR:
+		return p->lcr;
+	case REG_MCR:
+		return p->mcr;
+	case REG_LSR:
+		val = p->lsr_err | (p->rx_count ? LSR_DR : 0);
+		if (!p->tx_count)
+			val |= LSR_THRE;
+		if (!p->tx_count && !p->shift_busy)
+			val |= LSR_TEMT;
+		p->lsr_err = 0;
+		return val;
+	case REG_MSR:
+		val = msr_value(p);
+		p->msr &= ~0x0f;
+		return val;
+	default:
+		return p->spr;
+	}
+}
+
+/* IER bit 7 resets the registers and FIFOs of both ports, the input lines stay */
+static void chip_reset(struct ch43x_model *m)
+{
+	int i;
+
+	for (i = 0; i < CH43X_MODEL_NR_UART; i++) {
+		struct ch43x_model_port *p = &m->p[i];
+
+		p->ier = 0;
+		p->fcr = 0;
+		p->lcr = 0;
+		p->mcr = 0;
+		p->msr &= 0xf0;
+		p->spr = 0;
+		p->dll = 0;
+		p->dlh = 0;
+		p->lsr_err = 0;
+		p->rx_head = 0;
+		p->rx_count = 0;
+		p->tx_head = 0;
+		p->tx_count = 0;
+		p->shift_busy = false;
+		p->thri = false;
+	}
+}
+
+void ch43x_model_write(struct ch43x_model *m, int line, uint8_t reg, uint8_t val)
+{
+	struct ch43x_model_port *p = &m->p[line];
+	uint8_t old;
+
+	if ((p->lcr & LCR_DLAB) && reg == REG_DLL) {
+		p->dll = val;
+		return;
+	}
+	if ((p->lcr & LCR_DLAB) && reg == REG_DLH) {
+		p->dlh = val;
+		return;
+	}
+
+	switch (reg) {
+	case REG_THR:
+		p->thri = false;
+		p->tx_bytes++;
+		if (p->tx_count == CH43X_MODEL_FIFO_SIZE) {
+			p->tx_overflows++;
+			return;
+		}
+		p->tx[(p->tx_head + p->tx_count) % CH43X_MODEL_FIFO_SIZE] = val;
+		p->tx_count++;
+		if (!p->shift_busy)
+			tx_load(p, m->now, ch43x_model_char_ns(m, line));
+		return;
+	case REG_IER:
+		if (val & IER_RESET) {
+			chip_reset(m);
+			return;
+		}
+		old = p->ier;
+		p->ier = val;
+		/* like a 16550, enabling THRI with an empty FIFO raises it */
+		if ((val & IER_THRI) && !(old & IER_THRI) && !p->tx_count)
+			p->thri = true;
+		return;
+	case REG_FCR:
+		p->fcr = val & ~(FCR_RXRESET | FCR_TXRESET);
+		if (val & FCR_RXRESET) {
+			p->rx_head = 0;
+			p->rx_count = 0;
+		}
+		if (val & FCR_TXRESET) {
+			p->tx_head = 0;
+			p->tx_count = 0;
+		}
+		return;
+	case REG_LCR:
+		p->lcr = val;
+		return;
+	case REG_MCR:
+		old = msr_value(p);
+		p->mcr = val;
+		/* loopback turns MCR changes into MSR deltas */
+		if (val & MCR_LOOP)
+			msr_delta(p, old, msr_value(p));
+		return;
+	case REG_SPR:
+		p->spr = val;
+		return;
+	default:
+		return;
+	}
+}
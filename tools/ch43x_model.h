@@ -0,0 +1,99 @@
+/*
+ * Register level model of the SPI to Dual UARTs chip ch432.
+ *
+ * Models the parts the driver depends on: the 16 byte RX/TX FIFOs draining
+ * and filling at the programmed baud rate, the IIR priority logic, LSR/MSR,
+ * the DLAB register bank, the sleep mode and the CK2X clock doubler. Time
+ * only moves through ch43x_model_advance(), so the model can run from a
+ * recording, next to a simulated bus or behind ch432_sim.ko, which includes
+ * ch43x_model.c in the kernel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef CH43X_MODEL_H
+#define CH43X_MODEL_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#define CH43X_MODEL_NR_UART   2
+#define CH43X_MODEL_FIFO_SIZE 16
+#define CH43X_MODEL_NEVER     ((uint64_t)-1)
+
+struct ch43x_model_port {
+	/* registers */
+	uint8_t ier;
+	uint8_t fcr;
+	uint8_t lcr;
+	uint8_t mcr;
+	uint8_t msr; /* input lines and latched deltas */
+	uint8_t spr;
+	uint8_t dll;
+	uint8_t dlh;
+	uint8_t lsr_err; /* OE/PE/FE/BI, cleared by an LSR read */
+
+	uint8_t rx[CH43X_MODEL_FIFO_SIZE];
+	unsigned int rx_head;
+	unsigned int rx_count;
+	uint8_t tx[CH43X_MODEL_FIFO_SIZE];
+	unsigned int tx_head;
+	unsigned int tx_count; /* bytes in the TX FIFO */
+	bool shift_busy;       /* a byte is being shifted out */
+	uint8_t shift_byte;
+	bool thri;	       /* THR empty interrupt latched */
+
+	/* generated RX traffic, rx_baud wins over rx_load_ppm, both 0 for none */
+	uint32_t rx_baud;     /* bytes arrive at this rate in the port's frame format */
+	uint32_t rx_load_ppm; /* or at this fraction of the line rate, in ppm */
+	uint8_t rx_seq;	      /* next generated byte */
+	uint64_t rx_next_ns;  /* next byte arrival */
+	uint64_t rx_last_ns;  /* last arrival or RHR read, for RTOI */
+	uint64_t tx_next_ns;  /* end of the byte in the shift register */
+
+	/* counters */
+	uint64_t rx_bytes;     /* arrived at the FIFO */
+	uint64_t rx_read;      /* read from RHR */
+	uint64_t rx_overruns;  /* bytes lost because the FIFO was full */
+	uint64_t rx_asleep;    /* bytes lost because the chip was asleep */
+	unsigned int rx_max;   /* highest FIFO level seen */
+	uint64_t tx_bytes;     /* written to THR */
+	uint64_t tx_sent;      /* shifted out */
+	uint64_t tx_overflows; /* THR writes into a full FIFO */
+};
+
+struct ch43x_model {
+	uint32_t xtal; /* crystal, doubled by CK2X */
+	uint64_t now;
+	struct ch43x_model_port p[CH43X_MODEL_NR_UART];
+};
+
+/* xtal is the crystal clock, the port clock follows CK2X in IER of port 1 */
+void ch43x_model_init(struct ch43x_model *m, uint32_t xtal);
+/* moves the model time forward to now (ns), earlier times are ignored */
+void ch43x_model_advance(struct ch43x_model *m, uint64_t now);
+uint8_t ch43x_model_read(struct ch43x_model *m, int line, uint8_t reg);
+void ch43x_model_write(struct ch43x_model *m, int line, uint8_t reg, uint8_t val);
+/* level of the INT line, true while any port has an interrupt pending */
+bool ch43x_model_irq(struct ch43x_model *m);
+/* earliest time after now the INT line can change on its own, or CH43X_MODEL_NEVER */
+uint64_t ch43x_model_next_event(const struct ch43x_model *m);
+/* uart clock after the CK2X doubler */
+uint32_t ch43x_model_uartclk(const struct ch43x_model *m);
+/* time of one character at the current line settings, 0 if the divisor is 0 */
+uint64_t ch43x_model_char_ns(const struct ch43x_model *m, int line);
+void ch43x_model_set_rx_baud(struct ch43x_model *m, int line, uint32_t baud);
+/* sets the modem input lines (MSR bits 4-7) and latches their deltas */
+void ch43x_model_set_msr(struct ch43x_model *m, int line, uint8_t lines);
+#ifndef __KERNEL__
+void ch43x_model_set_rx_load(struct ch43x_model *m, int line, double load);
+#endif
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Replays a ch432 spi register recording against the chip model.
+ *
+ * The recording comes from the driver's debugfs recorder file:
+ *   echo 65536 > /sys/kernel/debug/ch432-spi0.0/recorder
+ *   ... run the workload ...
+ *   cat /sys/kernel/debug/ch432-spi0.0/recorder > trace.bin
+ *
+ * Every recorded access is applied to the model at its recorded time, with
+ * the line settings the driver programmed. The received data is modelled as
+ * arriving at the given fraction of the line rate (-l, default 1.0, a
+ * saturated line), so the report shows whether the recorded service timing
+ * would keep up with that load and where the RX FIFO overran. -b overrides
+ * the baud rate, -d prints the recording.
+ *
+ *   ch43x_replay [-d] [-l load] [-b baud] trace.bin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ch43x_model.h"
+
+/* file format, same as struct ch43x_rec_header/ch43x_rec_entry in ch432.c */
+#define CH43X_REC_MAGIC	  0x32333443
+#define CH43X_REC_VERSION 1
+#define CH43X_REC_WRITE	  (1 << 0)
+#define CH43X_REC_BURST	  (1 << 1)
+
+struct ch43x_rec_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t entry_size;
+	uint32_t uartclk;
+	uint32_t nr_uart;
+	uint64_t entries;
+	uint64_t lost;
+};
+
+struct ch43x_rec_entry {
+	uint64_t ns;
+	uint32_t spi_ns;
+	uint16_t len;
+	uint8_t port;
+	uint8_t reg;
+	uint8_t flags;
+	uint8_t val;
+	uint8_t reserved[6];
+};
+
+#define REG_DLL	 0x00
+#define REG_DLH	 0x01
+#define REG_IER	 0x01
+#define REG_IIR	 0x02
+#define REG_LCR	 0x03
+#define REG_LSR	 0x05
+#define IER_CK2X (1 << 5)
+#define LCR_DLAB (1 << 7)
+#define LSR_OE	 (1 << 1)
+
+static const char *const reg_names[2][8] = {
+	{ "RHR", "IER", "IIR", "LCR", "MCR", "LSR", "MSR", "SPR" },
+	{ "THR", "IER", "FCR", "LCR", "MCR", "LSR", "MSR", "SPR" },
+};
+
+struct replay_port {
+	uint64_t spi_ns;       /* bus time spent on the port */
+	uint64_t msgs;
+	uint64_t rec_oe;       /* overruns the chip reported in the recording */
+	uint64_t iir_mismatch; /* IIR reads where the model disagrees */
+	uint64_t last_drain;   /* last RHR read */
+	uint64_t max_gap;      /* longest time between RHR reads */
+	uint8_t lcr;	       /* recorded LCR, to tell DLL/DLH from RHR/IER */
+};
+
+static void dump_entry(const struct ch43x_rec_entry *e, uint64_t t0, uint8_t lcr)
+{
+	int write = !!(e->flags & CH43X_REC_WRITE);
+	const char *name = reg_names[write][e->reg & 7];
+
+	if ((lcr & LCR_DLAB) && e->reg == REG_DLL)
+		name = "DLL";
+	else if ((lcr & LCR_DLAB) && e->reg == REG_DLH)
+		name = "DLH";
+
+	printf("%12.3f us port%u %s %s 0x%02x", (e->ns - t0) / 1000.0, e->port, write ? "W" : "R", name, e->val);
+	if (e->flags & CH43X_REC_BURST)
+		printf(" len=%u", e->len);
+	printf(" spi=%u ns\n", e->spi_ns);
+}
+
+static void force_baud(struct ch43x_model *m, int line, unsigned int baud)
+{
+	unsigned int div = ch43x_model_uartclk(m) / 16 / baud;
+	uint8_t lcr = m->p[line].lcr;
+
+	ch43x_model_write(m, line, REG_LCR, lcr | LCR_DLAB);
+	ch43x_model_write(m, line, REG_DLL, div & 0xff);
+	ch43x_model_write(m, line, REG_DLH, div >> 8);
+	ch43x_model_write(m, line, REG_LCR, lcr);
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_port rp[CH43X_MODEL_NR_UART] = { 0 };
+	struct ch43x_rec_header hdr;
+	struct ch43x_rec_entry e;
+	struct ch43x_model m;
+	unsigned int baud = 0;
+	double load = 1.0;
+	uint64_t t0 = 0, t, n;
+	int dump = 0, opt, i, j;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "db:l:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dump = 1;
+			break;
+		case 'b':
+			baud = atoi(optarg);
+			break;
+		case 'l':
+			load = atof(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc)
+		goto usage;
+
+	f = fopen(argv[optind], "rb");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != CH43X_REC_MAGIC ||
+	    hdr.version != CH43X_REC_VERSION || hdr.entry_size != sizeof(e)) {
+		fprintf(stderr, "%s: not a ch432 recording\n", argv[optind]);
+		return 1;
+	}
+	printf("entries %llu, lost %llu, uartclk %u\n", (unsigned long long)hdr.entries,
+	       (unsigned long long)hdr.lost, hdr.uartclk);
+
+	/* the recording holds the doubled port clock, the driver sets CK2X at probe */
+	ch43x_model_init(&m, hdr.uartclk / 2);
+	ch43x_model_write(&m, 1, REG_IER, IER_CK2X);
+	for (n = 0; n < hdr.entries && fread(&e, sizeof(e), 1, f) == 1; n++) {
+		struct replay_port *p;
+
+		if (e.port >= CH43X_MODEL_NR_UART)
+			continue;
+		p = &rp[e.port];
+		if (!n)
+			t0 = e.ns;
+		if (dump)
+			dump_entry(&e, t0, p->lcr);
+
+		t = e.ns - t0;
+		ch43x_model_advance(&m, t);
+		p->spi_ns += e.spi_ns;
+		p->msgs++;
+
+		if (e.flags & CH43X_REC_WRITE) {
+			for (j = 0; j < e.len; j++)
+				ch43x_model_write(&m, e.port, e.reg, e.val);
+			if (e.reg == REG_LCR)
+				p->lcr = e.val;
+			/* the line settings are complete once DLAB is cleared again */
+			if (baud && e.reg == REG_LCR && !(e.val & LCR_DLAB))
+				force_baud(&m, e.port, baud);
+			if (e.reg == REG_LCR)
+				ch43x_model_set_rx_load(&m, e.port, load);
+			continue;
+		}
+
+		if (e.reg == 0 && !(p->lcr & LCR_DLAB)) {
+			if (p->last_drain && t - p->last_drain > p->max_gap)
+				p->max_gap = t - p->last_drain;
+			p->last_drain = t;
+			for (j = 0; j < e.len; j++)
+				ch43x_model_read(&m, e.port, e.reg);
+			continue;
+		}
+		if (e.reg == REG_LSR && (e.val & LSR_OE))
+			p->rec_oe++;
+		if (e.reg == REG_IIR && (ch43x_model_read(&m, e.port, e.reg) & 0x0f) != (e.val & 0x0f))
+			p->iir_mismatch++;
+		else if (e.reg != REG_IIR)
+			ch43x_model_read(&m, e.port, e.reg);
+	}
+	fclose(f);
+	if (n < hdr.entries)
+		fprintf(stderr, "recording truncated after %llu entries\n", (unsigned long long)n);
+
+	printf("duration %.3f ms, rx load %.2f\n", m.now / 1e6, load);
+	for (i = 0; i < CH43X_MODEL_NR_UART; i++) {
+		struct ch43x_model_port *mp = &m.p[i];
+		uint64_t char_ns = ch43x_model_char_ns(&m, i);
+
+		if (!rp[i].msgs)
+			continue;
+		printf("port%d:\n", i);
+		printf("  spi_msgs %llu, spi_time %.3f ms\n", (unsigned long long)rp[i].msgs, rp[i].spi_ns / 1e6);
+		if (char_ns)
+			printf("  char_time %.3f us, fifo_fill_time %.3f us\n", char_ns / 1e3,
+			       char_ns * CH43X_MODEL_FIFO_SIZE / 1e3);
+		printf("  rx_arrived %llu, rx_read %llu, rx_overruns %llu, rx_fifo_max %u\n",
+		       (unsigned long long)mp->rx_bytes, (unsigned long long)mp->rx_read,
+		       (unsigned long long)mp->rx_overruns, mp->rx_max);
+		printf("  max_drain_gap %.3f us, recorded_overruns %llu, iir_mismatch %llu\n", rp[i].max_gap / 1e3,
+		       (unsigned long long)rp[i].rec_oe, (unsigned long long)rp[i].iir_mismatch);
+		printf("  tx_written %llu, tx_sent %llu, tx_overflows %llu\n", (unsigned long long)mp->tx_bytes,
+		       (unsigned long long)mp->tx_sent, (unsigned long long)mp->tx_overflows);
+	}
+
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-d] [-l load] [-b baud] trace.bin\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,408 @@
+/*
+ * Userspace driver library for the SPI to Dual UARTs chip ch432.
+ *
+ * All accesses of one step (status of both ports, a FIFO drain, the port
+ * setup) are batched into a single SPI_IOC_MESSAGE with the chip select
+ * toggled between the register accesses, so a service pass costs a few
+ * ioctls instead of one syscall per register.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+#include "ch43x_spidev.h"
+
+#define CH43X_MAX_OPS	   64
+#define CH43X_MAX_LOOPS	   64
+
+#define CH43X_IER_RDI_BIT  (1 << 0)
+#define CH43X_IER_THRI_BIT (1 << 1)
+#define CH43X_IER_RLSI_BIT (1 << 2)
+#define CH43X_IER_SLEEP_BIT (1 << 5) /* port 0 */
+#define CH43X_IER_CK2X_BIT  (1 << 5) /* port 1 */
+
+#define CH43X_FCR_FIFO_BIT    (1 << 0)
+#define CH43X_FCR_RXRESET_BIT (1 << 1)
+#define CH43X_FCR_TXRESET_BIT (1 << 2)
+#define CH43X_FCR_RXLVLH_BIT  (1 << 7)
+
+#define CH43X_IIR_NO_INT_BIT (1 << 0)
+#define CH43X_IIR_ID_MASK    0x0e
+#define CH43X_IIR_THRI_SRC   0x02
+#define CH43X_IIR_RDI_SRC    0x04
+#define CH43X_IIR_RLSE_SRC   0x06
+#define CH43X_IIR_RTOI_SRC   0x0c
+#define CH43X_IIR_MSI_SRC    0x00
+
+#define CH43X_LCR_WORD_LEN_8 0x03
+#define CH43X_LCR_DLAB_BIT   (1 << 7)
+#define CH43X_MCR_OUT2	     (1 << 3)
+#define CH43X_MCR_LOOP_BIT   (1 << 4)
+
+#define CH43X_LSR_DR_BIT	 (1 << 0)
+#define CH43X_LSR_BRK_ERROR_MASK 0x1E
+
+int ch43x_batch(struct ch43x_dev *d, struct ch43x_op *ops, int n)
+{
+	struct spi_ioc_transfer xfer[CH43X_MAX_OPS];
+	uint8_t txb[CH43X_MAX_OPS][CH43X_FIFO_SIZE + 1];
+	uint8_t rxb[CH43X_MAX_OPS][CH43X_FIFO_SIZE + 1];
+	int i;
+
+	if (n <= 0 || n > CH43X_MAX_OPS)
+		return -EINVAL;
+
+	memset(xfer, 0, sizeof(xfer[0]) * n);
+	for (i = 0; i < n; i++) {
+		if (!ops[i].len || ops[i].len > CH43X_FIFO_SIZE)
+			return -EINVAL;
+		if (ops[i].write) {
+			txb[i][0] = CH43X_CMD_WRITE(ops[i].line, ops[i].reg);
+			memcpy(&txb[i][1], ops[i].buf, ops[i].len);
+		} else {
+			txb[i][0] = CH43X_CMD_READ(ops[i].line, ops[i].reg);
+			memset(&txb[i][1], 0, ops[i].len);
+		}
+		xfer[i].tx_buf = (unsigned long)txb[i];
+		xfer[i].rx_buf = (unsigned long)rxb[i];
+		xfer[i].len = ops[i].len + 1;
+		xfer[i].speed_hz = d->speed_hz;
+		xfer[i].bits_per_word = 8;
+		xfer[i].cs_change = (i != n - 1);
+	}
+
+	if (ioctl(d->spi_fd, SPI_IOC_MESSAGE(n), xfer) < 0)
+		return -errno;
+	d->stats.ioctls++;
+	d->stats.transfers += n;
+
+	for (i = 0; i < n; i++)
+		if (!ops[i].write)
+			memcpy(ops[i].buf, &rxb[i][1], ops[i].len);
+
+	return 0;
+}
+
+int ch43x_read_reg(struct ch43x_dev *d, int line, uint8_t reg, uint8_t *val)
+{
+	struct ch43x_op op = { .line = line, .reg = reg, .len = 1, .buf = val };
+
+	return ch43x_batch(d, &op, 1);
+}
+
+int ch43x_write_reg(struct ch43x_dev *d, int line, uint8_t reg, uint8_t val)
+{
+	struct ch43x_op op = { .line = line, .reg = reg, .write = 1, .len = 1, .buf = &val };
+
+	return ch43x_batch(d, &op, 1);
+}
+
+int ch43x_spr_test(struct ch43x_dev *d, int line)
+{
+	static const uint8_t pattern[] = { 0x55, 0xAA, 0x00, 0xFF };
+	uint8_t val;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < sizeof(pattern); i++) {
+		ret = ch43x_write_reg(d, line, CH43X_SPR_REG, pattern[i]);
+		if (!ret)
+			ret = ch43x_read_reg(d, line, CH43X_SPR_REG, &val);
+		if (ret)
+			return ret;
+		if (val != pattern[i])
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static int ch43x_gpio_open(struct ch43x_dev *d, const char *gpiochip, int gpio_line)
+{
+	struct gpio_v2_line_request req;
+	int fd, ret;
+
+	fd = open(gpiochip, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = gpio_line;
+	req.num_lines = 1;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	strncpy(req.consumer, "ch43x", sizeof(req.consumer) - 1);
+	ret = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	close(fd);
+	if (ret < 0)
+		return -errno;
+
+	fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);
+	d->irq_fd = req.fd;
+
+	return 0;
+}
+
+/* INT is active low, a pass is not done while it is still asserted */
+static int ch43x_int_asserted(struct ch43x_dev *d)
+{
+	struct gpio_v2_line_values vals = { .mask = 1 };
+
+	if (d->irq_fd < 0 || ioctl(d->irq_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &vals) < 0)
+		return 0;
+
+	return !(vals.bits & 1);
+}
+
+int ch43x_open(struct ch43x_dev *d, const char *spidev, uint32_t speed_hz, const char *gpiochip, int gpio_line)
+{
+	uint8_t mode = SPI_MODE_3, bits = 8;
+	struct ch43x_op ops[4];
+	uint8_t zero = 0, ck2x = CH43X_IER_CK2X_BIT;
+	int ret, i;
+
+	memset(d, 0, sizeof(*d));
+	d->irq_fd = -1;
+	d->speed_hz = speed_hz;
+
+	d->spi_fd = open(spidev, O_RDWR | O_CLOEXEC);
+	if (d->spi_fd < 0)
+		return -errno;
+	if (ioctl(d->spi_fd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(d->spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+	    ioctl(d->spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	if (gpiochip) {
+		ret = ch43x_gpio_open(d, gpiochip, gpio_line);
+		if (ret)
+			goto err;
+	}
+
+	for (i = 0; i < CH43X_NR_UART; i++) {
+		ret = ch43x_spr_test(d, i);
+		if (ret)
+			goto err;
+	}
+
+	/* interrupts off, chip awake (port 0 IER) and uart clock doubled (port 1 IER) */
+	d->ier[0] = 0;
+	d->ier[1] = CH43X_IER_CK2X_BIT;
+	ops[0] = (struct ch43x_op){ .line = 0, .reg = CH43X_IER_REG, .write = 1, .len = 1, .buf = &zero };
+	ops[1] = (struct ch43x_op){ .line = 1, .reg = CH43X_IER_REG, .write = 1, .len = 1, .buf = &ck2x };
+	ops[2] = (struct ch43x_op){ .line = 0, .reg = CH43X_MCR_REG, .write = 1, .len = 1, .buf = &zero };
+	ops[3] = (struct ch43x_op){ .line = 1, .reg = CH43X_MCR_REG, .write = 1, .len = 1, .buf = &zero };
+	ret = ch43x_batch(d, ops, 4);
+	if (ret)
+		goto err;
+
+	return 0;
+
+err:
+	ch43x_close(d);
+	return ret;
+}
+
+void ch43x_close(struct ch43x_dev *d)
+{
+	if (d->irq_fd >= 0)
+		close(d->irq_fd);
+	if (d->spi_fd >= 0)
+		close(d->spi_fd);
+	d->irq_fd = -1;
+	d->spi_fd = -1;
+}
+
+int ch43x_port_init(struct ch43x_dev *d, int line, unsigned int baud)
+{
+	unsigned int div = CH43X_UARTCLK / 16 / baud;
+	uint8_t fcr_reset = CH43X_FCR_RXRESET_BIT | CH43X_FCR_TXRESET_BIT;
+	uint8_t fcr = CH43X_FCR_RXLVLH_BIT | CH43X_FCR_FIFO_BIT;
+	uint8_t dlab = CH43X_LCR_DLAB_BIT, dlh = div / 256, dll = div % 256;
+	uint8_t lcr = CH43X_LCR_WORD_LEN_8, mcr = CH43X_MCR_OUT2;
+	struct ch43x_op ops[8];
+	int n = 0;
+
+	if (!div || div > 0xffff)
+		return -EINVAL;
+
+	d->ier[line] |= CH43X_IER_RDI_BIT | CH43X_IER_RLSI_BIT;
+	ops[n++] = (struct ch43x_op){ line, CH43X_FCR_REG, 1, 1, &fcr_reset };
+	ops[n++] = (struct ch43x_op){ line, CH43X_FCR_REG, 1, 1, &fcr };
+	ops[n++] = (struct ch43x_op){ line, CH43X_LCR_REG, 1, 1, &dlab };
+	ops[n++] = (struct ch43x_op){ line, CH43X_DLH_REG, 1, 1, &dlh };
+	ops[n++] = (struct ch43x_op){ line, CH43X_DLL_REG, 1, 1, &dll };
+	ops[n++] = (struct ch43x_op){ line, CH43X_LCR_REG, 1, 1, &lcr };
+	ops[n++] = (struct ch43x_op){ line, CH43X_IER_REG, 1, 1, &d->ier[line] };
+	ops[n++] = (struct ch43x_op){ line, CH43X_MCR_REG, 1, 1, &mcr };
+
+	return ch43x_batch(d, ops, n);
+}
+
+int ch43x_set_loopback(struct ch43x_dev *d, int line, int on)
+{
+	return ch43x_write_reg(d, line, CH43X_MCR_REG, CH43X_MCR_OUT2 | (on ? CH43X_MCR_LOOP_BIT : 0));
+}
+
+int ch43x_start_tx(struct ch43x_dev *d, int line)
+{
+	if (d->tx_active[line])
+		return 0;
+	d->tx_active[line] = 1;
+	d->ier[line] |= CH43X_IER_THRI_BIT;
+
+	return ch43x_write_reg(d, line, CH43X_IER_REG, d->ier[line]);
+}
+
+int ch43x_event_fd(struct ch43x_dev *d)
+{
+	return d->irq_fd;
+}
+
+/*
+ * the tail below the trigger level, byte by byte: RHR is only read behind an
+ * LSR with DR, a byte arriving between a dry LSR and the RHR would be lost
+ */
+static int ch43x_drain(struct ch43x_dev *d, int line, uint8_t *buf, size_t *len, size_t size,
+		       uint8_t *lsr_or)
+{
+	uint8_t lsr, rhr;
+	struct ch43x_op ops[2] = {
+		{ line, CH43X_RHR_REG, 0, 1, &rhr },
+		{ line, CH43X_LSR_REG, 0, 1, &lsr },
+	};
+	int ret;
+
+	ret = ch43x_read_reg(d, line, CH43X_LSR_REG, &lsr);
+	while (!ret && (lsr & CH43X_LSR_DR_BIT) && *len < size) {
+		/* the error bits belong to the byte at the head of the FIFO */
+		*lsr_or |= lsr & CH43X_LSR_BRK_ERROR_MASK;
+		ret = ch43x_batch(d, ops, 2);
+		if (!ret)
+			buf[(*len)++] = rhr;
+	}
+
+	return ret;
+}
+
+static int ch43x_handle_rx(struct ch43x_dev *d, int line, unsigned int iir)
+{
+	uint8_t buf[2 * CH43X_RX_TRIG], lsr = 0;
+	size_t len = 0;
+	int ret;
+
+	/* RDI means at least the trigger level is in the FIFO, take it in one burst */
+	if (iir == CH43X_IIR_RDI_SRC) {
+		struct ch43x_op op = { line, CH43X_RHR_REG, 0, CH43X_RX_TRIG, buf };
+
+		ret = ch43x_batch(d, &op, 1);
+		if (ret)
+			return ret;
+		len = CH43X_RX_TRIG;
+	}
+	/* past the trigger level RDI is pending again and the next pass bursts it */
+	ret = ch43x_drain(d, line, buf, &len, len + CH43X_RX_TRIG, &lsr);
+	if (ret)
+		return ret;
+
+	d->stats.rx_bytes += len;
+	if (len && d->rx)
+		d->rx(d->ctx, line, buf, len, lsr);
+
+	return 0;
+}
+
+static int ch43x_handle_tx(struct ch43x_dev *d, int line)
+{
+	struct ch43x_op op = { line, CH43X_THR_REG, 1, 0, NULL };
+	uint8_t buf[CH43X_FIFO_SIZE];
+	size_t len = d->tx ? d->tx(d->ctx, line, buf, sizeof(buf)) : 0;
+
+	if (!len) {
+		d->tx_active[line] = 0;
+		d->ier[line] &= ~CH43X_IER_THRI_BIT;
+		return ch43x_write_reg(d, line, CH43X_IER_REG, d->ier[line]);
+	}
+
+	op.len = len;
+	op.buf = buf;
+	d->stats.tx_bytes += len;
+
+	return ch43x_batch(d, &op, 1);
+}
+
+int ch43x_service(struct ch43x_dev *d)
+{
+	struct gpio_v2_line_event ev;
+	uint8_t iir[CH43X_NR_UART], msr;
+	struct ch43x_op ops[CH43X_NR_UART];
+	int i, ret, pending, loops = 0;
+
+	if (d->irq_fd >= 0)
+		while (read(d->irq_fd, &ev, sizeof(ev)) == sizeof(ev))
+			d->stats.irqs++;
+
+	do {
+		/* IIR of both ports in one message */
+		for (i = 0; i < CH43X_NR_UART; i++)
+			ops[i] = (struct ch43x_op){ i, CH43X_IIR_REG, 0, 1, &iir[i] };
+		ret = ch43x_batch(d, ops, CH43X_NR_UART);
+		if (ret)
+			return ret;
+		d->stats.passes++;
+
+		pending = 0;
+		for (i = 0; i < CH43X_NR_UART; i++) {
+			if (iir[i] & CH43X_IIR_NO_INT_BIT)
+				continue;
+			pending = 1;
+			switch (iir[i] & CH43X_IIR_ID_MASK) {
+			case CH43X_IIR_RDI_SRC:
+			case CH43X_IIR_RLSE_SRC:
+			case CH43X_IIR_RTOI_SRC:
+				ret = ch43x_handle_rx(d, i, iir[i] & CH43X_IIR_ID_MASK);
+				break;
+			case CH43X_IIR_THRI_SRC:
+				ret = ch43x_handle_tx(d, i);
+				break;
+			case CH43X_IIR_MSI_SRC:
+				ret = ch43x_read_reg(d, i, CH43X_MSR_REG, &msr);
+				break;
+			default:
+				ret = 0;
+				break;
+			}
+			if (ret)
+				return ret;
+		}
+		/* the edge of an event raised during the pass is lost, check the level */
+	} while ((pending || ch43x_int_asserted(d)) && ++loops < CH43X_MAX_LOOPS);
+
+	return 0;
+}
+
+int ch43x_wait_and_service(struct ch43x_dev *d, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = d->irq_fd, .events = POLLIN };
+
+	if (d->irq_fd >= 0) {
+		if (poll(&pfd, 1, timeout_ms) < 0)
+			return -errno;
+	} else if (timeout_ms) {
+		/* no INT line, poll every millisecond */
+		usleep(1000);
+	}
+
+	return ch43x_service(d);
+}
@@ -0,0 +1,106 @@
+/*
+ * Userspace driver library for the SPI to Dual UARTs chip ch432.
+ *
+ * Talks to the chip through /dev/spidevB.C and takes the INT line from the
+ * GPIO character device, for systems where the ch432 kernel module cannot
+ * be loaded. The register command encoding is the same as ch43x_port_read()
+ * and ch43x_port_write() in ch432.c.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef CH43X_SPIDEV_H
+#define CH43X_SPIDEV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CH43X_NR_UART	2
+#define CH43X_FIFO_SIZE 16
+#define CH43X_RX_TRIG	8 /* FCR RX trigger level programmed by ch43x_port_init() */
+
+/* external crystal freq, uart clock is doubled (CK2X) */
+#define CH43X_CRYSTAL_FREQ 22118400
+#define CH43X_UARTCLK	   (CH43X_CRYSTAL_FREQ * 2)
+
+/* register numbers, same as CH43X_*_REG in ch432.c */
+#define CH43X_RHR_REG 0x00
+#define CH43X_THR_REG 0x00
+#define CH43X_IER_REG 0x01
+#define CH43X_IIR_REG 0x02
+#define CH43X_FCR_REG 0x02
+#define CH43X_LCR_REG 0x03
+#define CH43X_MCR_REG 0x04
+#define CH43X_LSR_REG 0x05
+#define CH43X_MSR_REG 0x06
+#define CH43X_SPR_REG 0x07
+#define CH43X_DLL_REG 0x00
+#define CH43X_DLH_REG 0x01
+
+/* SPI command byte of a register access */
+#define CH43X_CMD_READ(line, reg)  (0xFD & (((reg) + (line) * 0x08) << 2))
+#define CH43X_CMD_WRITE(line, reg) (0x02 | (((reg) + (line) * 0x08) << 2))
+
+/* called with the bytes received on a port, lsr is the ORed line status */
+typedef void (*ch43x_rx_cb)(void *ctx, int line, const uint8_t *buf, size_t len, uint8_t lsr);
+/* fills up to max bytes to transmit on a port, returns the count */
+typedef size_t (*ch43x_tx_cb)(void *ctx, int line, uint8_t *buf, size_t max);
+
+struct ch43x_stats {
+	uint64_t ioctls;    /* SPI_IOC_MESSAGE calls */
+	uint64_t transfers; /* transfers (chip selects) */
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t irqs;      /* INT edges */
+	uint64_t passes;    /* service passes */
+};
+
+struct ch43x_dev {
+	int spi_fd;
+	int irq_fd; /* GPIO line request, -1 when polling */
+	uint32_t speed_hz;
+	uint8_t ier[CH43X_NR_UART];
+	ch43x_rx_cb rx;
+	ch43x_tx_cb tx;
+	void *ctx;
+	int tx_active[CH43X_NR_UART];
+	struct ch43x_stats stats;
+};
+
+/*
+ * One register access of a batch. Reads store into buf, writes send buf.
+ * len > 1 gives a FIFO burst on RHR/THR.
+ */
+struct ch43x_op {
+	uint8_t line;
+	uint8_t reg;
+	uint8_t write;
+	uint8_t len;
+	uint8_t *buf;
+};
+
+int ch43x_open(struct ch43x_dev *d, const char *spidev, uint32_t speed_hz, const char *gpiochip, int gpio_line);
+void ch43x_close(struct ch43x_dev *d);
+
+/* runs all ops in a single SPI_IOC_MESSAGE, chip select toggles between ops */
+int ch43x_batch(struct ch43x_dev *d, struct ch43x_op *ops, int n);
+int ch43x_read_reg(struct ch43x_dev *d, int line, uint8_t reg, uint8_t *val);
+int ch43x_write_reg(struct ch43x_dev *d, int line, uint8_t reg, uint8_t val);
+
+int ch43x_spr_test(struct ch43x_dev *d, int line);
+int ch43x_port_init(struct ch43x_dev *d, int line, unsigned int baud);
+int ch43x_set_loopback(struct ch43x_dev *d, int line, int on);
+/* arms the THR empty interrupt, the tx callback is asked for data */
+int ch43x_start_tx(struct ch43x_dev *d, int line);
+
+/* fd for epoll, readable when the INT line fell; -1 without INT line */
+int ch43x_event_fd(struct ch43x_dev *d);
+/* services both ports until the chip has no interrupt pending */
+int ch43x_service(struct ch43x_dev *d);
+/* blocks for INT (or timeout_ms) and services, for simple event loops */
+int ch43x_wait_and_service(struct ch43x_dev *d, int timeout_ms);
+
+#endif
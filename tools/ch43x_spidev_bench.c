@@ -0,0 +1,232 @@
+/*
+ * Loopback throughput comparison between the userspace ch432 library and
+ * the ch432 kernel driver.
+ *
+ * Both modes put a port into internal loopback (MCR LOOP), stream a counting
+ * pattern for the given time and print one CSV line:
+ *   mode,baud,seconds,bytes,bytes_per_sec,errors,spi_msgs_per_byte,spi_xfers_per_byte
+ * The SPI columns are only known in user mode, the kernel driver reports
+ * them in its own statistics.
+ *
+ *   ch43x_spidev_bench user /dev/spidev0.0 10000000 /dev/gpiochip0 17 [baud] [sec] [port]
+ *   ch43x_spidev_bench kernel /dev/ttyWCH0 [baud] [sec]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "ch43x_spidev.h"
+
+/* not exported by the libc headers, the driver maps it to MCR LOOP */
+#ifndef TIOCM_LOOP
+#define TIOCM_LOOP 0x8000
+#endif
+
+#define BENCH_INFLIGHT 256 /* bytes sent but not yet looped back */
+
+struct bench {
+	uint8_t tx_seq;
+	uint8_t rx_seq;
+	uint64_t sent;
+	uint64_t received;
+	uint64_t errors;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_check(struct bench *b, const uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != b->rx_seq)
+			b->errors++;
+		b->rx_seq = buf[i] + 1;
+	}
+	b->received += len;
+}
+
+static size_t bench_fill(struct bench *b, uint8_t *buf, size_t max)
+{
+	size_t i, room = BENCH_INFLIGHT - (b->sent - b->received);
+
+	if (max > room)
+		max = room;
+	for (i = 0; i < max; i++)
+		buf[i] = b->tx_seq++;
+	b->sent += max;
+
+	return max;
+}
+
+static void user_rx(void *ctx, int line, const uint8_t *buf, size_t len, uint8_t lsr)
+{
+	struct bench *b = ctx;
+
+	if (lsr)
+		b->errors++;
+	bench_check(b, buf, len);
+}
+
+static size_t user_tx(void *ctx, int line, uint8_t *buf, size_t max)
+{
+	return bench_fill(ctx, buf, max);
+}
+
+static void report(const char *mode, unsigned int baud, double secs, struct bench *b, const struct ch43x_stats *st)
+{
+	printf("%s,%u,%.2f,%llu,%.0f,%llu,", mode, baud, secs, (unsigned long long)b->received, b->received / secs,
+	       (unsigned long long)b->errors);
+	if (st && b->received)
+		printf("%.3f,%.3f\n", (double)st->ioctls / b->received, (double)st->transfers / b->received);
+	else
+		printf(",\n");
+}
+
+static int bench_user(int argc, char **argv)
+{
+	unsigned int baud = argc > 6 ? atoi(argv[6]) : 921600;
+	double secs = argc > 7 ? atof(argv[7]) : 10, start;
+	int line = argc > 8 ? atoi(argv[8]) : 0;
+	const char *gpiochip = strcmp(argv[4], "-") ? argv[4] : NULL;
+	struct ch43x_dev d;
+	struct bench b = { 0 };
+	int ret;
+
+	ret = ch43x_open(&d, argv[2], atoi(argv[3]), gpiochip, atoi(argv[5]));
+	if (ret) {
+		fprintf(stderr, "ch43x_open: %s\n", strerror(-ret));
+		return 1;
+	}
+	d.rx = user_rx;
+	d.tx = user_tx;
+	d.ctx = &b;
+
+	ret = ch43x_port_init(&d, line, baud);
+	if (!ret)
+		ret = ch43x_set_loopback(&d, line, 1);
+	start = now();
+	while (!ret && now() - start < secs) {
+		ret = ch43x_start_tx(&d, line);
+		if (!ret)
+			ret = ch43x_wait_and_service(&d, 10);
+	}
+	if (ret)
+		fprintf(stderr, "spi: %s\n", strerror(-ret));
+
+	report("user", baud, now() - start, &b, &d.stats);
+	ch43x_set_loopback(&d, line, 0);
+	ch43x_close(&d);
+
+	return ret ? 1 : 0;
+}
+
+static speed_t to_speed(unsigned int baud)
+{
+	switch (baud) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	case 1000000: return B1000000;
+	case 1500000: return B1500000;
+	case 2000000: return B2000000;
+	default: return B0;
+	}
+}
+
+static int bench_kernel(int argc, char **argv)
+{
+	unsigned int baud = argc > 3 ? atoi(argv[3]) : 921600;
+	double secs = argc > 4 ? atof(argv[4]) : 10, start;
+	int loop = TIOCM_LOOP;
+	struct bench b = { 0 };
+	struct termios tio;
+	struct pollfd pfd;
+	uint8_t buf[4096];
+	ssize_t n;
+	int fd;
+
+	if (to_speed(baud) == B0) {
+		fprintf(stderr, "unsupported baud %u\n", baud);
+		return 1;
+	}
+	fd = open(argv[2], O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(argv[2]);
+		return 1;
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	cfsetspeed(&tio, to_speed(baud));
+	tcsetattr(fd, TCSANOW, &tio);
+	ioctl(fd, TIOCMBIS, &loop);
+	tcflush(fd, TCIOFLUSH);
+
+	pfd.fd = fd;
+	start = now();
+	while (now() - start < secs) {
+		pfd.events = POLLIN | (b.sent - b.received < BENCH_INFLIGHT ? POLLOUT : 0);
+		if (poll(&pfd, 1, 100) < 0)
+			break;
+		if (pfd.revents & POLLIN) {
+			n = read(fd, buf, sizeof(buf));
+			if (n > 0)
+				bench_check(&b, buf, n);
+		}
+		if (pfd.revents & POLLOUT) {
+			size_t len = bench_fill(&b, buf, sizeof(buf));
+
+			n = write(fd, buf, len);
+			/* rewind what the tty did not take */
+			if (n < (ssize_t)len) {
+				size_t unsent = len - (n > 0 ? n : 0);
+
+				b.sent -= unsent;
+				b.tx_seq -= unsent;
+			}
+		}
+	}
+
+	report("kernel", baud, now() - start, &b, NULL);
+	ioctl(fd, TIOCMBIC, &loop);
+	close(fd);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 5 && !strcmp(argv[1], "user"))
+		return bench_user(argc, argv);
+	if (argc > 2 && !strcmp(argv[1], "kernel"))
+		return bench_kernel(argc, argv);
+
+	fprintf(stderr, "usage: %s user <spidev> <speed_hz> <gpiochip|-> <gpio_line> [baud] [sec] [port]\n"
+			"       %s kernel <tty> [baud] [sec]\n",
+		argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,1178 @@
+/*
+ * Host harness for the ch432 driver.
+ *
+ * Builds ch432.c unchanged against the kernel API stand-ins in include/ and
+ * runs its data paths with a simulated chip (tools/ch43x_model.c) on the spi
+ * bus, so ch43x_handle_rx, ch43x_handle_tx, ch43x_port_irq and
+ * ch43x_set_termios can be profiled with perf or valgrind on a workstation:
+ *
+ *   gcc -O2 -g -Itools/host/include -o ch43x_host tools/host/ch43x_host.c \
+ *       tools/host/ch43x_host_kernel.c tools/ch43x_model.c
+ *   ./ch43x_host [-r baud] [-t seconds] [-l load] [-n ops] [-s spi_hz]
+ *                [-e fail_hz] [-m msg_ns] [-i irq_ns] [-f fault=prob[,interval[,times]]]
+ *                [-w warmup_ms] [-d delay_us] [-v] [-u | -b budgets | scenario ...]
+ *
+ * Scenarios, all by default:
+ *   rx      port 0 receives a counting pattern at -l times the line rate
+ *   tx      port 0 transmits from a tty buffer that is kept full
+ *   loop    both ports in MCR loopback, transmitting and receiving
+ *   termios -n set_termios calls on an open port, alternating the settings
+ *   mctrl   -n modem line changes, set_mctrl plus a CTS change on the input
+ *   storm   rx on port 0 while port 1 gets a CTS change every 20us and line
+ *           errors on the few bytes it receives
+ *
+ * Time is simulated: an spi message takes -m ns plus its bits at the spi
+ * clock, the irq thread runs -i ns after the INT line falls. -s is the
+ * spi-max-frequency the driver calibrates its clock up to (20MHz without
+ * it), -e the clock above which the bus corrupts read data. Each scenario prints one
+ * CSV line with the spi traffic and the host cpu time spent in the driver
+ * (including the shim and the model) per byte or per operation. -v also
+ * prints the driver's debugfs stats of the ports used.
+ *
+ * -b runs the scenarios listed in a budget file (ch43x_budgets.txt) instead
+ * and compares the spi messages and transfers per byte or operation with the
+ * budgets there. A scenario that lost or misordered bytes or stalled INT
+ * fails as well. The exit status is 1 if any scenario failed, so the check
+ * can gate changes to the bus access paths.
+ *
+ * -u runs unit checks instead: the command byte, divisor, LCR and tty flag
+ * helpers against known values, and the spi messages of single register
+ * operations. The exit status is 1 if one fails.
+ *
+ * -f arms one of the driver's injected faults (fail_spi, corrupt_read,
+ * delay_spi, drop_irq) -w ms into each scenario, with the probability,
+ * interval and times of the kernel fault attributes; -d sets the length of
+ * delay_spi. Every scenario then runs twice, clean and with the faults, and
+ * a "# fault" line reports the throughput loss, the longest time without
+ * delivered data in both runs and the time from the last injected fault to
+ * the next delivered byte. The scripts in faults/ cover each fault.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "../../ch432.c"
+
+#include <time.h>
+#include <unistd.h>
+
+#include "../ch43x_model.h"
+
+#define HOST_TICK_NS  5000	/* idle step of the main loop */
+#define HOST_STALL_NS 100000000 /* INT low this long without an edge */
+#define HOST_STORM_NS 20000	/* noise period on port 1 in the storm scenario */
+
+struct host_line {
+	bool feed; /* keep the tty transmit buffer full */
+	u8 tx_seq;
+	u8 rx_seq;
+	u64 rx_bytes;
+	u64 rx_errors; /* out of sequence */
+	u64 rx_flagged;
+	char rx_flag; /* of the last flagged char */
+	u64 pushes;
+};
+
+struct host_result {
+	const char *name;
+	u64 units; /* bytes or operations */
+	u64 sim_ns;
+	u64 cpu_ns;
+	u64 lost;
+	u64 errors;
+};
+
+static struct spi_controller host_spi_ctlr;
+static struct spi_device host_spi_dev = {
+	.dev = { .init_name = "spi0.0" },
+	.controller = &host_spi_ctlr,
+	.irq = 1,
+};
+static struct spi_driver *drv;
+static struct ch43x_port *s;
+static struct host_line lines[CH43X_MODEL_NR_UART];
+static bool irq_level;
+static u64 irq_low_since;
+static u64 irq_stalls;
+static u64 cpu_ns;
+static u64 irq_ns = 20000;
+static unsigned int baud = 115200;
+static unsigned int nr_ops = 1000;
+static double sim_secs = 1.0;
+static double rx_load = 1.0;
+static u64 storm_next; /* next noise event on port 1, 0 when off */
+
+/* fault runs */
+#define HOST_MAX_FAULTS 4
+
+struct host_fault {
+	char name[16];
+	unsigned long probability;
+	unsigned long interval;
+	long times;
+};
+
+static struct host_fault faults[HOST_MAX_FAULTS];
+static int nr_faults;
+static bool faulted;   /* this run injects faults */
+static u64 fault_arm_at;
+static u64 fault_warmup_ns = 200 * NSEC_PER_MSEC;
+static u32 fault_delay_us;
+
+/* delivered data: bytes at the tty plus bytes shifted out */
+static u64 delivered;
+static u64 last_delivery;
+static u64 max_gap;
+static u64 fault_seen; /* last fault time already matched with a delivery */
+static u64 recovery_ns;
+
+static u64 wall_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int line_of(struct tty_port *tport)
+{
+	int i;
+
+	for (i = 0; i < s->uart.nr; i++)
+		if (s->p[i].port.state && tport == &s->p[i].port.state->port)
+			return i;
+
+	return 0;
+}
+
+void host_tty_rx(struct tty_port *tport, unsigned char ch, char flag)
+{
+	struct host_line *l = &lines[line_of(tport)];
+
+	if (flag != TTY_NORMAL) {
+		l->rx_flagged++;
+		l->rx_flag = flag;
+		return;
+	}
+	if (ch != l->rx_seq)
+		l->rx_errors++;
+	l->rx_seq = ch + 1;
+	l->rx_bytes++;
+}
+
+void host_tty_push(struct tty_port *tport)
+{
+	lines[line_of(tport)].pushes++;
+}
+
+/* like a tty write: queue into the xmit buffer and start the port */
+static void tty_fill(struct uart_port *port)
+{
+	struct host_line *l = &lines[port->line];
+	struct circ_buf *xmit = &port->state->xmit;
+
+	while (CIRC_SPACE(xmit->head, xmit->tail, UART_XMIT_SIZE)) {
+		xmit->buf[xmit->head] = l->tx_seq++;
+		xmit->head = (xmit->head + 1) & (UART_XMIT_SIZE - 1);
+	}
+	port->ops->start_tx(port);
+}
+
+void host_tty_wakeup(struct uart_port *port)
+{
+	if (lines[port->line].feed)
+		tty_fill(port);
+}
+
+static struct fault_attr *fault_attr(const char *name)
+{
+	if (!strcmp(name, "fail_spi"))
+		return &s->faults.fail_spi;
+	if (!strcmp(name, "corrupt_read"))
+		return &s->faults.corrupt_read;
+	if (!strcmp(name, "delay_spi"))
+		return &s->faults.delay_spi;
+	if (!strcmp(name, "drop_irq"))
+		return &s->faults.drop_irq;
+
+	return NULL;
+}
+
+static void debugfs_write_num(const char *dir, const char *file, long val)
+{
+	char path[96], buf[32];
+
+	snprintf(path, sizeof(path), "ch432-%s/%s%s%s", dev_name(&host_spi_dev.dev), dir, *dir ? "/" : "", file);
+	snprintf(buf, sizeof(buf), "%ld", val);
+	host_debugfs_write(path, buf);
+}
+
+/* sets the fault attributes through debugfs like a test script would */
+static void faults_set(bool on)
+{
+	int i;
+
+	for (i = 0; i < nr_faults; i++) {
+		debugfs_write_num(faults[i].name, "interval", faults[i].interval);
+		debugfs_write_num(faults[i].name, "times", on ? faults[i].times : 0);
+		debugfs_write_num(faults[i].name, "probability", on ? faults[i].probability : 0);
+	}
+	if (on && fault_delay_us)
+		debugfs_write_num("", "fault_delay_us", fault_delay_us);
+}
+
+static u64 faults_last(void)
+{
+	u64 last = 0;
+	int i;
+
+	for (i = 0; i < nr_faults; i++)
+		last = max(last, fault_attr(faults[i].name)->last_ns);
+
+	return last;
+}
+
+static u64 faults_hits(void)
+{
+	u64 hits = 0;
+	int i;
+
+	for (i = 0; i < nr_faults; i++)
+		hits += fault_attr(faults[i].name)->hits;
+
+	return hits;
+}
+
+static void track_delivery(void)
+{
+	u64 n = 0, now = host_now(), fault;
+	int i;
+
+	for (i = 0; i < s->uart.nr; i++)
+		n += lines[i].rx_bytes + host_model.p[i].tx_sent;
+	if (n == delivered)
+		return;
+	delivered = n;
+	if (last_delivery && now - last_delivery > max_gap)
+		max_gap = now - last_delivery;
+	last_delivery = now;
+
+	fault = faulted ? faults_last() : 0;
+	if (fault > fault_seen) {
+		recovery_ns = now - fault;
+		fault_seen = fault;
+	}
+}
+
+/* delivers the INT falling edges and runs deferred work until now + ns */
+static void host_run(u64 ns)
+{
+	u64 end = host_now() + ns, t0;
+	bool level;
+
+	while (host_now() < end) {
+		if (fault_arm_at && host_now() >= fault_arm_at) {
+			faults_set(true);
+			fault_arm_at = 0;
+		}
+		track_delivery();
+		if (storm_next && host_now() >= storm_next) {
+			host_model.p[1].msr ^= 0x10;
+			host_model.p[1].msr |= 0x01;
+			if (host_model.p[1].rx_count)
+				host_model.p[1].lsr_err |= CH43X_LSR_FE_BIT;
+			storm_next += HOST_STORM_NS;
+		}
+		t0 = wall_ns();
+		if (host_run_work())
+			cpu_ns += wall_ns() - t0;
+
+		/* an edge latched during the last call counts as well */
+		level = ch43x_model_irq(&host_model);
+		if (level && (!irq_level || host_int_edges)) {
+			host_int_edges = 0;
+			t0 = wall_ns();
+			host_irq(irq_ns);
+			cpu_ns += wall_ns() - t0;
+			irq_level = ch43x_model_irq(&host_model);
+			irq_low_since = host_now();
+			continue;
+		}
+		/* INT still low after a pass: no new edge, the chip stalls */
+		if (level && host_now() - irq_low_since > HOST_STALL_NS) {
+			irq_stalls++;
+			level = false;
+		}
+		irq_level = level;
+		host_advance(HOST_TICK_NS);
+	}
+}
+
+static void host_call_begin(u64 *t0)
+{
+	*t0 = wall_ns();
+}
+
+static void host_call_end(u64 t0)
+{
+	cpu_ns += wall_ns() - t0;
+}
+
+static void port_termios(struct uart_port *port, unsigned int b, tcflag_t cflag)
+{
+	struct ktermios termios = { .c_cflag = cflag | CREAD | CLOCAL, .c_ospeed = b };
+	u64 t0;
+
+	host_call_begin(&t0);
+	port->ops->set_termios(port, &termios, NULL);
+	host_call_end(t0);
+}
+
+static void port_mctrl(struct uart_port *port, unsigned int mctrl)
+{
+	u64 t0;
+
+	host_call_begin(&t0);
+	port->mctrl = mctrl;
+	port->ops->set_mctrl(port, mctrl);
+	host_call_end(t0);
+}
+
+/* the serial core open path: startup, termios, raise DTR/RTS */
+static void port_open(int i, unsigned int mctrl)
+{
+	struct uart_port *port = &s->p[i].port;
+	u64 t0;
+
+	port->state->port.initialized = true;
+	host_call_begin(&t0);
+	port->ops->startup(port);
+	host_call_end(t0);
+	port_termios(port, baud, CS8);
+	port_mctrl(port, TIOCM_DTR | TIOCM_RTS | mctrl);
+	host_run(HOST_TICK_NS);
+}
+
+/* lets the tty buffer and the chip FIFO run empty, at most for a second */
+static void port_drain(int i)
+{
+	struct circ_buf *xmit = &s->p[i].port.state->xmit;
+	struct ch43x_model_port *mp = &host_model.p[i];
+	u64 end = host_now() + NSEC_PER_SEC;
+
+	lines[i].feed = false;
+	while (host_now() < end && (!uart_circ_empty(xmit) || mp->tx_count || mp->shift_busy))
+		host_run(NSEC_PER_MSEC);
+	host_run(10 * NSEC_PER_MSEC);
+}
+
+static void port_close(int i)
+{
+	struct uart_port *port = &s->p[i].port;
+	struct circ_buf *xmit = &port->state->xmit;
+	u64 t0;
+
+	lines[i].feed = false;
+	xmit->head = xmit->tail = 0;
+	host_run(HOST_TICK_NS);
+	host_call_begin(&t0);
+	port->ops->shutdown(port);
+	host_call_end(t0);
+	port->state->port.initialized = false;
+	ch43x_model_set_rx_load(&host_model, i, 0);
+	host_run(HOST_TICK_NS);
+}
+
+static void stats_reset(void)
+{
+	char path[64];
+	int i;
+
+	for (i = 0; i < s->uart.nr; i++) {
+		snprintf(path, sizeof(path), "ch432-%s/port%d/stats", dev_name(&host_spi_dev.dev), i);
+		host_debugfs_write(path, "0");
+		memset(&lines[i], 0, sizeof(lines[i]));
+		host_model.p[i].rx_overruns = 0;
+		host_model.p[i].rx_asleep = 0;
+		host_model.p[i].tx_sent = 0;
+		/* the pattern starts over, lines[] expects 0 next */
+		host_model.p[i].rx_seq = 0;
+	}
+	snprintf(path, sizeof(path), "ch432-%s/busload", dev_name(&host_spi_dev.dev));
+	host_debugfs_write(path, "0");
+	memset(&host_spi, 0, sizeof(host_spi));
+	irq_stalls = 0;
+	cpu_ns = 0;
+	delivered = 0;
+	last_delivery = 0;
+	max_gap = 0;
+	fault_seen = 0;
+	recovery_ns = 0;
+	for (i = 0; i < nr_faults; i++) {
+		fault_attr(faults[i].name)->hits = 0;
+		fault_attr(faults[i].name)->last_ns = 0;
+	}
+	if (faulted)
+		fault_arm_at = host_now() + fault_warmup_ns;
+}
+
+static void stats_print(int i)
+{
+	char path[64], buf[4096];
+
+	snprintf(path, sizeof(path), "ch432-%s/port%d/stats", dev_name(&host_spi_dev.dev), i);
+	if (host_debugfs_read(path, buf, sizeof(buf)) > 0)
+		printf("# port%d stats\n%s", i, buf);
+}
+
+/* the bus hold lines at the end of busload */
+static void hold_print(void)
+{
+	char path[64], buf[8192], *p;
+
+	snprintf(path, sizeof(path), "ch432-%s/busload", dev_name(&host_spi_dev.dev));
+	if (host_debugfs_read(path, buf, sizeof(buf)) <= 0)
+		return;
+	p = strstr(buf, "bus_hold_max_us");
+	if (p)
+		printf("# busload\n%s", p);
+}
+
+static void scenario_rx(struct host_result *r)
+{
+	port_open(0, 0);
+	ch43x_model_set_rx_load(&host_model, 0, rx_load);
+	host_run(r->sim_ns);
+	ch43x_model_set_rx_load(&host_model, 0, 0);
+	host_run(50 * NSEC_PER_MSEC);
+	port_close(0);
+
+	r->units = lines[0].rx_bytes;
+	r->lost = host_model.p[0].rx_overruns + host_model.p[0].rx_asleep;
+	r->errors = lines[0].rx_errors;
+}
+
+static void scenario_tx(struct host_result *r)
+{
+	struct uart_port *port = &s->p[0].port;
+
+	port_open(0, 0);
+	lines[0].feed = true;
+	tty_fill(port);
+	host_run(r->sim_ns);
+	port_drain(0);
+	port_close(0);
+
+	r->units = host_model.p[0].tx_sent;
+	r->lost = host_model.p[0].tx_overflows;
+}
+
+static void scenario_loop(struct host_result *r)
+{
+	int i;
+
+	for (i = 0; i < s->uart.nr; i++) {
+		port_open(i, TIOCM_LOOP);
+		lines[i].feed = true;
+		tty_fill(&s->p[i].port);
+	}
+	host_run(r->sim_ns);
+	for (i = 0; i < s->uart.nr; i++)
+		port_drain(i);
+	for (i = 0; i < s->uart.nr; i++) {
+		port_close(i);
+		r->units += lines[i].rx_bytes;
+		r->lost += host_model.p[i].rx_overruns + host_model.p[i].rx_asleep;
+		r->errors += lines[i].rx_errors;
+	}
+}
+
+static void scenario_termios(struct host_result *r)
+{
+	static const tcflag_t cflags[] = { CS8, CS7 | PARENB, CS8 | CSTOPB | CRTSCTS, CS5 | PARENB | PARODD };
+	struct uart_port *port = &s->p[0].port;
+	unsigned int i;
+
+	port_open(0, 0);
+	stats_reset();
+	for (i = 0; i < nr_ops; i++) {
+		port_termios(port, i & 1 ? 9600 : baud, cflags[i % ARRAY_SIZE(cflags)]);
+		host_run(HOST_TICK_NS);
+	}
+	r->sim_ns = host_now();
+	port_close(0);
+
+	r->units = nr_ops;
+}
+
+static void scenario_mctrl(struct host_result *r)
+{
+	struct uart_port *port = &s->p[0].port;
+	unsigned int i;
+
+	port_open(0, 0);
+	stats_reset();
+	for (i = 0; i < nr_ops; i++) {
+		port_mctrl(port, i & 1 ? TIOCM_DTR : TIOCM_RTS);
+		/* CTS input toggles, the chip latches the delta */
+		host_model.p[0].msr ^= 0x10;
+		host_model.p[0].msr |= 0x01;
+		host_run(NSEC_PER_MSEC);
+	}
+	port_close(0);
+
+	r->units = nr_ops;
+}
+
+static void scenario_storm(struct host_result *r)
+{
+	port_open(0, 0);
+	port_open(1, 0);
+	ch43x_model_set_rx_load(&host_model, 0, rx_load);
+	ch43x_model_set_rx_load(&host_model, 1, 0.05);
+	storm_next = host_now();
+	host_run(r->sim_ns);
+	storm_next = 0;
+	ch43x_model_set_rx_load(&host_model, 0, 0);
+	ch43x_model_set_rx_load(&host_model, 1, 0);
+	host_run(50 * NSEC_PER_MSEC);
+	port_close(1);
+	port_close(0);
+
+	r->units = lines[0].rx_bytes;
+	r->lost = host_model.p[0].rx_overruns + host_model.p[0].rx_asleep;
+	r->errors = lines[0].rx_errors;
+}
+
+static const struct {
+	const char *name;
+	void (*run)(struct host_result *r);
+	bool per_op;
+	int ports; /* ports used, for -v */
+} scenarios[] = {
+	{ "rx", scenario_rx, false, 1 },
+	{ "tx", scenario_tx, false, 1 },
+	{ "loop", scenario_loop, false, 2 },
+	{ "termios", scenario_termios, true, 1 },
+	{ "mctrl", scenario_mctrl, true, 1 },
+	{ "storm", scenario_storm, false, 2 },
+};
+
+/* binds the driver to a chip fresh from power on */
+static int host_probe(void)
+{
+	ch43x_model_init(&host_model, CRYSTAL_FREQ);
+	irq_level = false;
+	irq_low_since = 0;
+	if (drv->probe(&host_spi_dev)) {
+		fprintf(stderr, "probe failed\n");
+		return -1;
+	}
+	s = dev_get_drvdata(&host_spi_dev.dev);
+	if (!host_irq_registered()) {
+		fprintf(stderr, "no irq handler\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Every scenario starts on a newly bound driver and a chip from power on:
+ * FIFO contents, latched interrupts, the watchdog and the spi clock search
+ * of one scenario must not carry over into the next, the results would
+ * depend on the order on the command line.
+ */
+static void run_scenario(int n, int verbose, struct host_result *r)
+{
+	u64 start, units;
+	int i;
+
+	drv->remove(&host_spi_dev);
+	if (host_probe())
+		abort();
+	memset(r, 0, sizeof(*r));
+	r->name = scenarios[n].name;
+	r->sim_ns = sim_secs * NSEC_PER_SEC;
+	stats_reset();
+	start = host_now();
+	scenarios[n].run(r);
+	r->sim_ns = host_now() - start;
+	r->cpu_ns = cpu_ns;
+	units = r->units ? r->units : 1;
+
+	printf("%s%s,%u,%.3f,%llu,%s,%llu,%llu,%llu,%.3f,%.3f,%.1f,%.1f,%llu,%llu,%llu\n", r->name,
+	       faulted ? "+faults" : "", baud,
+	       r->sim_ns / 1e9, (unsigned long long)r->units, scenarios[n].per_op ? "ops" : "bytes",
+	       (unsigned long long)host_spi.msgs, (unsigned long long)host_spi.xfers,
+	       (unsigned long long)host_spi.bytes, (double)host_spi.msgs / units, (double)host_spi.xfers / units,
+	       100.0 * host_spi.ns / (r->sim_ns ? r->sim_ns : 1), (double)r->cpu_ns / units,
+	       (unsigned long long)r->lost, (unsigned long long)r->errors, (unsigned long long)irq_stalls);
+	if (verbose) {
+		for (i = 0; i < scenarios[n].ports; i++)
+			stats_print(i);
+		hold_print();
+	}
+}
+
+/*
+ * Runs a scenario clean and with the faults armed, and reports what the
+ * faults cost: lost throughput, the longest stretch without delivered data
+ * and how long after the last fault data flowed again.
+ */
+static void run_faults(int n, int verbose)
+{
+	struct host_result clean, r;
+	u64 errors = 0, retries = 0, lost = 0, clean_gap;
+	double clean_rate, rate;
+	char desc[256];
+	int i, len = 0;
+
+	run_scenario(n, verbose, &clean);
+	clean_gap = max_gap;
+
+	faulted = true;
+	run_scenario(n, verbose, &r);
+	faulted = false;
+	faults_set(false);
+
+	/* recoveries and resets are per chip, every port counts them */
+	for (i = 0; i < s->uart.nr; i++) {
+		retries += s->p[i].stats.spi_retries;
+		errors += s->p[i].stats.spi_errors;
+		lost += s->p[i].stats.irq_lost;
+	}
+	desc[0] = '\0';
+	for (i = 0; i < nr_faults && len < (int)sizeof(desc); i++)
+		len += snprintf(desc + len, sizeof(desc) - len, "%s%s=%lu,%lu,%ld", i ? "+" : "",
+				faults[i].name, faults[i].probability, faults[i].interval, faults[i].times);
+	/* the scenarios drain their buffers, compare rates rather than totals */
+	clean_rate = clean.sim_ns ? (double)clean.units / clean.sim_ns : 0;
+	rate = r.sim_ns ? (double)r.units / r.sim_ns : 0;
+	printf("# fault %s %u %s injected %llu units %llu/%llu loss %.2f%% max_gap_ms %.3f/%.3f ", r.name, baud,
+	       desc, (unsigned long long)faults_hits(), (unsigned long long)clean.units, (unsigned long long)r.units,
+	       clean_rate ? 100.0 * (clean_rate - rate) / clean_rate : 0, clean_gap / 1e6, max_gap / 1e6);
+	if (fault_seen && recovery_ns)
+		printf("recovery_ms %.3f ", recovery_ns / 1e6);
+	else
+		printf("recovery_ms - ");
+	printf("spi_retries %llu spi_errors %llu recoveries %llu chip_resets %llu irq_lost %llu irq_stalls %llu "
+	       "errors %llu\n",
+	       (unsigned long long)retries, (unsigned long long)errors,
+	       (unsigned long long)s->p[0].stats.recoveries, (unsigned long long)s->p[0].stats.chip_resets,
+	       (unsigned long long)lost, (unsigned long long)irq_stalls, (unsigned long long)r.errors);
+}
+
+/*
+ * Unit checks of the helpers that do no bus access, against values worked
+ * out from the datasheet, and of the spi messages each register operation
+ * may take. The counts run on an open port with the register cache filled,
+ * like the data paths see it.
+ */
+static int unit_failed;
+
+static void unit_check(bool ok, const char *what)
+{
+	printf("# unit %s %s\n", what, ok ? "ok" : "FAIL");
+	unit_failed += !ok;
+}
+
+#define UNIT_CHECK(cond) unit_check(cond, #cond)
+
+static void unit_helpers(void)
+{
+	int line, reg;
+	bool ok = true;
+
+	UNIT_CHECK(ch43x_cmd_read(0, CH43X_RHR_REG) == 0x00);
+	UNIT_CHECK(ch43x_cmd_write(0, CH43X_THR_REG) == 0x02);
+	UNIT_CHECK(ch43x_cmd_read(0, CH43X_LSR_REG) == 0x14);
+	UNIT_CHECK(ch43x_cmd_write(1, CH43X_IER_REG) == 0x26);
+	UNIT_CHECK(ch43x_cmd_read(1, CH43X_SPR_REG) == 0x3c);
+	UNIT_CHECK(ch43x_cmd_write(1, CH43X_SPR_REG) == 0x3e);
+	/* a read and a write of the same register differ in bit 1 only */
+	for (line = 0; line < CH43X_MAX_PORTS; line++)
+		for (reg = 0; reg < 8; reg++)
+			ok &= (ch43x_cmd_read(line, reg) ^ ch43x_cmd_write(line, reg)) == 0x02;
+	unit_check(ok, "cmd_read ^ cmd_write == 0x02 for every register");
+
+	UNIT_CHECK(ch43x_baud_divisor(CRYSTAL_FREQ * 2, 921600) == 3);
+	UNIT_CHECK(ch43x_baud_divisor(CRYSTAL_FREQ * 2, 115200) == 24);
+	UNIT_CHECK(ch43x_baud_divisor(CRYSTAL_FREQ, 9600) == 144);
+	UNIT_CHECK(ch43x_baud_divisor(CRYSTAL_FREQ, 300) == 4608);
+
+	UNIT_CHECK(ch43x_termios_lcr(CS8) == 0x03);
+	UNIT_CHECK(ch43x_termios_lcr(CS5) == 0x00);
+	UNIT_CHECK(ch43x_termios_lcr(CS7 | PARENB) == 0x1a);
+	UNIT_CHECK(ch43x_termios_lcr(CS7 | PARENB | PARODD) == 0x0a);
+	UNIT_CHECK(ch43x_termios_lcr(CS8 | PARENB | PARODD | CMSPAR) == 0x2b);
+	UNIT_CHECK(ch43x_termios_lcr(CS8 | PARENB | CMSPAR) == 0x3b);
+	UNIT_CHECK(ch43x_termios_lcr(CS6 | CSTOPB) == 0x05);
+	UNIT_CHECK(ch43x_termios_lcr(CS8 | PARODD | CMSPAR) == 0x03);
+
+	UNIT_CHECK(ch43x_lsr_flag(0) == TTY_NORMAL);
+	UNIT_CHECK(ch43x_lsr_flag(CH43X_LSR_OE_BIT) == TTY_NORMAL);
+	UNIT_CHECK(ch43x_lsr_flag(CH43X_LSR_FE_BIT) == TTY_FRAME);
+	UNIT_CHECK(ch43x_lsr_flag(CH43X_LSR_PE_BIT | CH43X_LSR_FE_BIT) == TTY_PARITY);
+	UNIT_CHECK(ch43x_lsr_flag(CH43X_LSR_BI_BIT | CH43X_LSR_FE_BIT) == TTY_BREAK);
+}
+
+static void op_read_lsr(struct uart_port *port)
+{
+	ch43x_port_read(port, CH43X_LSR_REG);
+}
+
+static void op_read_lcr(struct uart_port *port)
+{
+	ch43x_port_read(port, CH43X_LCR_REG);
+}
+
+static void op_write_spr(struct uart_port *port)
+{
+	ch43x_port_write(port, CH43X_SPR_REG, 0x55);
+}
+
+static void op_update_ier(struct uart_port *port)
+{
+	ch43x_port_update(port, CH43X_IER_REG, CH43X_IER_MSI_BIT, CH43X_IER_MSI_BIT);
+}
+
+static void op_fifo_write(struct uart_port *port)
+{
+	u8 thr = ch43x_cmd_write(port->line, CH43X_THR_REG);
+	unsigned char buf[CH43X_FIFO_SIZE] = { 0 };
+
+	ch43x_raw_write(port, &thr, buf, sizeof(buf));
+}
+
+static void op_fifo_read(struct uart_port *port)
+{
+	unsigned char buf[CH43X_FIFO_SIZE];
+
+	ch43x_raw_read(port, buf, sizeof(buf));
+}
+
+/* an rx source with the FIFO empty, as a corrupted IIR reports it */
+static void op_rx_no_data(struct uart_port *port)
+{
+	ch43x_handle_rx(port, CH43X_IIR_RDI_SRC);
+}
+
+/* the trigger level in the FIFO: LSR, one RHR burst, LSR */
+static void op_rx_trig(struct uart_port *port)
+{
+	struct ch43x_model_port *mp = &host_model.p[port->line];
+
+	while (mp->rx_count < CH43X_RX_TRIG)
+		mp->rx[(mp->rx_head + mp->rx_count++) % CH43X_MODEL_FIFO_SIZE] = 0;
+	ch43x_handle_rx(port, CH43X_IIR_RDI_SRC);
+}
+
+static void op_set_baud(struct uart_port *port)
+{
+	ch43x_set_baud(port, 115200);
+}
+
+static void op_set_termios(struct uart_port *port)
+{
+	struct ktermios termios = { .c_cflag = CS7 | PARENB | CREAD | CLOCAL, .c_ospeed = 9600 };
+
+	port->ops->set_termios(port, &termios, NULL);
+}
+
+static void op_get_mctrl(struct uart_port *port)
+{
+	port->ops->get_mctrl(port);
+}
+
+/* the MCR write is deferred to a work item */
+static void op_set_mctrl(struct uart_port *port)
+{
+	port->mctrl ^= TIOCM_RTS;
+	port->ops->set_mctrl(port, port->mctrl);
+	host_run(HOST_TICK_NS);
+}
+
+static const struct {
+	const char *name;
+	void (*op)(struct uart_port *port);
+	u64 msgs;
+} unit_ops[] = {
+	{ "port_read LSR", op_read_lsr, 1 },
+	{ "port_read LCR (cached)", op_read_lcr, 0 },
+	{ "port_write SPR", op_write_spr, 1 },
+	{ "port_update IER", op_update_ier, 1 },
+	{ "fifo write 16 bytes", op_fifo_write, 1 },
+	{ "fifo read 16 bytes", op_fifo_read, 1 },
+	{ "handle_rx without DR", op_rx_no_data, CH43X_RX_DR_READS },
+	{ "handle_rx of the trigger level", op_rx_trig, 3 },
+	{ "set_baud", op_set_baud, 4 },
+	{ "set_termios", op_set_termios, 6 },
+	{ "get_mctrl (MSR of the last irq pass)", op_get_mctrl, 0 },
+	{ "set_mctrl", op_set_mctrl, 1 },
+};
+
+/* inside a pass that used up its hold time, every LSR read for DR gives the bus up first */
+static void unit_bus_yield(struct uart_port *port)
+{
+	u32 hold_max = s->bus_hold_max_us;
+	u64 yields;
+
+	s->bus_hold_max_us = 0;
+	ch43x_bus_hold(s);
+	yields = s->busload.hold_yields;
+	ch43x_handle_rx(port, CH43X_IIR_RDI_SRC);
+	yields = s->busload.hold_yields - yields;
+	ch43x_bus_release(s);
+	s->bus_hold_max_us = hold_max;
+	UNIT_CHECK(yields == CH43X_RX_DR_READS);
+}
+
+/* a framing error whose LSR bits another LSR read cleared still reaches the rx path */
+static void unit_lsr_err(struct uart_port *port)
+{
+	struct ch43x_model_port *mp = &host_model.p[port->line];
+	u32 frame = port->icount.frame;
+
+	mp->rx[(mp->rx_head + mp->rx_count++) % CH43X_MODEL_FIFO_SIZE] = 0;
+	mp->lsr_err |= CH43X_LSR_FE_BIT;
+	ch43x_port_read(port, CH43X_LSR_REG);
+	ch43x_handle_rx(port, CH43X_IIR_RTOI_SRC);
+	UNIT_CHECK(port->icount.frame == frame + 1);
+}
+
+/*
+ * handle_rx counts one error per char, break before parity before framing,
+ * and flags the char the same way; every other case has its bits read off
+ * the chip by an earlier LSR read
+ */
+static void unit_rx_errors(struct uart_port *port)
+{
+	static const struct {
+		u8 lsr;
+		char flag;
+	} cases[] = {
+		{ CH43X_LSR_BI_BIT | CH43X_LSR_PE_BIT | CH43X_LSR_FE_BIT, TTY_BREAK },
+		{ CH43X_LSR_BI_BIT | CH43X_LSR_FE_BIT, TTY_BREAK },
+		{ CH43X_LSR_PE_BIT | CH43X_LSR_FE_BIT, TTY_PARITY },
+		{ CH43X_LSR_PE_BIT, TTY_PARITY },
+		{ CH43X_LSR_FE_BIT, TTY_FRAME },
+		{ CH43X_LSR_FE_BIT, TTY_FRAME },
+	};
+	struct ch43x_model_port *mp = &host_model.p[port->line];
+	struct host_line *l = &lines[port->line];
+	unsigned int mask = port->read_status_mask;
+	struct uart_icount icount;
+	int i;
+
+	/* INPCK and BRKINT: the errors reach the tty */
+	port->read_status_mask |= CH43X_LSR_BI_BIT | CH43X_LSR_PE_BIT | CH43X_LSR_FE_BIT;
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		icount = port->icount;
+		l->rx_flag = TTY_NORMAL;
+		mp->rx[(mp->rx_head + mp->rx_count++) % CH43X_MODEL_FIFO_SIZE] = 0;
+		mp->lsr_err |= cases[i].lsr;
+		if (i & 1)
+			ch43x_port_read(port, CH43X_LSR_REG);
+		ch43x_handle_rx(port, CH43X_IIR_RTOI_SRC);
+		UNIT_CHECK(port->icount.brk - icount.brk == (cases[i].flag == TTY_BREAK));
+		UNIT_CHECK(port->icount.parity - icount.parity == (cases[i].flag == TTY_PARITY));
+		UNIT_CHECK(port->icount.frame - icount.frame == (cases[i].flag == TTY_FRAME));
+		UNIT_CHECK(l->rx_flag == cases[i].flag);
+	}
+	port->read_status_mask = mask;
+}
+
+/* a THRI that an IIR read took off the chip unseen, as a corrupted read does, is refilled by the watchdog */
+static void unit_thri_lost(struct uart_port *port)
+{
+	struct ch43x_model_port *mp = &host_model.p[port->line];
+	struct fault_attr *fa = fault_attr("drop_irq");
+	u64 end = host_now() + 100 * NSEC_PER_MSEC, sent;
+
+	lines[port->line].feed = true;
+	tty_fill(port);
+	/* no irq pass sees the THRI */
+	fa->interval = 1;
+	fa->times = -1;
+	fa->probability = 100;
+	while (!mp->thri && host_now() < end)
+		host_run(HOST_TICK_NS);
+	ch43x_port_read(port, CH43X_IIR_REG);
+	fa->probability = 0;
+	sent = mp->tx_sent;
+	host_run(100 * NSEC_PER_MSEC);
+	UNIT_CHECK(mp->tx_sent > sent + CH43X_FIFO_SIZE);
+	port_drain(port->line);
+}
+
+/* a read-modify-write whose read fails reports the error and leaves the change to the shadow */
+static void unit_update_fail(struct uart_port *port)
+{
+	struct fault_attr *fa = fault_attr("fail_spi");
+	unsigned int reg = ch43x_regmap_reg(port->line, CH43X_IER_REG);
+	u8 ier = s->p[port->line].shadow.ier, want = ier ^ CH43X_IER_MSI_BIT;
+	int ret;
+
+	regcache_drop_region(s->regmap, reg, reg);
+	fa->interval = 1;
+	fa->times = 1 + CH43X_SPI_RETRIES;
+	fa->probability = 100;
+	ret = ch43x_port_update(port, CH43X_IER_REG, CH43X_IER_MSI_BIT, want);
+	fa->probability = 0;
+	UNIT_CHECK(ret < 0);
+	UNIT_CHECK(s->p[port->line].shadow.ier == want);
+	/* the recovery writes it */
+	host_run(10 * NSEC_PER_MSEC);
+	UNIT_CHECK(host_model.p[port->line].ier == want);
+	ch43x_port_update(port, CH43X_IER_REG, CH43X_IER_MSI_BIT, ier);
+}
+
+static void unit_msgs(void)
+{
+	struct uart_port *port = &s->p[0].port;
+	char what[96];
+	u64 msgs;
+	int i;
+
+	port_open(0, 0);
+	for (i = 0; i < ARRAY_SIZE(unit_ops); i++) {
+		msgs = host_spi.msgs;
+		unit_ops[i].op(port);
+		msgs = host_spi.msgs - msgs;
+		snprintf(what, sizeof(what), "%s spi_msgs %llu == %llu", unit_ops[i].name, (unsigned long long)msgs,
+			 (unsigned long long)unit_ops[i].msgs);
+		unit_check(msgs == unit_ops[i].msgs, what);
+	}
+	unit_bus_yield(port);
+	unit_lsr_err(port);
+	unit_rx_errors(port);
+	unit_thri_lost(port);
+	unit_update_fail(port);
+	port_close(0);
+}
+
+static int run_units(void)
+{
+	unit_helpers();
+	unit_msgs();
+	printf("# unit %d failed\n", unit_failed);
+
+	return unit_failed;
+}
+
+static int find_scenario(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(scenarios); i++)
+		if (!strcmp(name, scenarios[i].name))
+			return i;
+
+	fprintf(stderr, "unknown scenario %s\n", name);
+	return -1;
+}
+
+/*
+ * Budget file: one "scenario baud msgs_per_unit xfers_per_unit max_gap_ms"
+ * per line, '#' starts a comment. Every entry is run at its baud rate and
+ * fails when either spi count per byte or operation is above its budget,
+ * when the longest stretch without delivered data is above max_gap_ms, when
+ * the scenario moved no data at all, or when it lost or misordered bytes or
+ * stalled the INT line, as a saving that costs data does not count. Returns
+ * the number of failed entries, or -1 if the file cannot be used.
+ */
+static int run_budgets(const char *path, int verbose)
+{
+	struct host_result r;
+	char buf[256], name[32], *p;
+	double max_msgs, max_xfers, max_gap_ms, msgs, xfers, gap_ms;
+	unsigned int rate;
+	int n, ret, line = 0, runs = 0, failed = 0;
+	bool bad;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		p = strchr(buf, '#');
+		if (p)
+			*p = '\0';
+		ret = sscanf(buf, "%31s %u %lf %lf %lf", name, &rate, &max_msgs, &max_xfers, &max_gap_ms);
+		if (ret == EOF)
+			continue;
+		if (ret != 5 || !rate) {
+			fprintf(stderr, "%s:%d: expected: scenario baud msgs_per_unit xfers_per_unit max_gap_ms\n", path,
+				line);
+			goto err;
+		}
+		n = find_scenario(name);
+		if (n < 0)
+			goto err;
+
+		baud = rate;
+		run_scenario(n, verbose, &r);
+		msgs = r.units ? (double)host_spi.msgs / r.units : 0;
+		xfers = r.units ? (double)host_spi.xfers / r.units : 0;
+		gap_ms = max_gap / 1e6;
+		bad = r.lost || r.errors || irq_stalls;
+		ret = !r.units || bad || msgs > max_msgs || xfers > max_xfers || gap_ms > max_gap_ms;
+		printf("# budget %s %u msgs_per_unit %.3f <= %.3f xfers_per_unit %.3f <= %.3f max_gap_ms %.3f <= %.3f %s\n",
+		       name, rate, msgs, max_msgs, xfers, max_xfers, gap_ms, max_gap_ms,
+		       !r.units ? "FAIL (no data)" : bad ? "FAIL (lost, errors or irq_stalls)" : ret ? "FAIL" : "ok");
+		runs++;
+		failed += ret;
+	}
+	fclose(f);
+
+	printf("# budget %d scenarios, %d over budget\n", runs, failed);
+	return failed;
+
+err:
+	fclose(f);
+	return -1;
+}
+
+/* name=probability[,interval[,times]], times -1 for no limit */
+static int parse_fault(const char *arg)
+{
+	struct host_fault *f = &faults[nr_faults];
+	const char *eq = strchr(arg, '=');
+
+	if (nr_faults == HOST_MAX_FAULTS || !eq || eq - arg >= sizeof(f->name))
+		return -1;
+	memcpy(f->name, arg, eq - arg);
+	f->name[eq - arg] = '\0';
+	f->interval = 1;
+	f->times = -1;
+	if (sscanf(eq + 1, "%lu,%lu,%ld", &f->probability, &f->interval, &f->times) < 1)
+		return -1;
+	nr_faults++;
+
+	return 0;
+}
+
+static void run_one(int n, int verbose)
+{
+	struct host_result r;
+
+	if (nr_faults)
+		run_faults(n, verbose);
+	else
+		run_scenario(n, verbose, &r);
+}
+
+int main(int argc, char **argv)
+{
+	const char *budgets = NULL;
+	int opt, i, j, ret = 0, verbose = 0, units = 0;
+
+	while ((opt = getopt(argc, argv, "r:t:l:n:s:e:m:i:f:w:d:b:uv")) != -1) {
+		switch (opt) {
+		case 'r':
+			baud = atoi(optarg);
+			break;
+		case 't':
+			sim_secs = atof(optarg);
+			break;
+		case 'l':
+			rx_load = atof(optarg);
+			break;
+		case 'n':
+			nr_ops = atoi(optarg);
+			break;
+		case 's':
+			host_spi_max_frequency = strtoul(optarg, NULL, 0);
+			host_spi_dev.max_speed_hz = host_spi_max_frequency;
+			break;
+		case 'e':
+			host_spi_fail_hz = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			host_spi_msg_ns = strtoull(optarg, NULL, 0);
+			break;
+		case 'i':
+			irq_ns = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			if (parse_fault(optarg))
+				goto usage;
+			break;
+		case 'w':
+			fault_warmup_ns = strtoull(optarg, NULL, 0) * NSEC_PER_MSEC;
+			break;
+		case 'd':
+			fault_delay_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			budgets = optarg;
+			break;
+		case 'u':
+			units = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (!baud || sim_secs <= 0 || (budgets && nr_faults) || (units && (budgets || nr_faults)))
+		goto usage;
+
+	ch43x_init();
+	drv = host_spi_driver();
+	if (!drv) {
+		fprintf(stderr, "no spi driver\n");
+		return 1;
+	}
+	if (host_probe())
+		return 1;
+	printf("# spi clock %u Hz limit %u Hz failed %u Hz reg_reads_per_sec %u msg_saved_ns %lld\n", s->spi_hz,
+	       s->spi_max_hz, s->spi_failed_hz, s->reg_reads_per_sec, (long long)s->msg_saved_ns);
+	for (i = 0; i < nr_faults; i++) {
+		if (!fault_attr(faults[i].name)) {
+			fprintf(stderr, "unknown fault %s\n", faults[i].name);
+			return 1;
+		}
+	}
+
+	if (!units)
+		printf("scenario,baud,sim_seconds,units,unit,spi_msgs,spi_xfers,spi_bytes,msgs_per_unit,xfers_per_unit,"
+		       "bus_util_percent,host_ns_per_unit,lost,errors,irq_stalls\n");
+	if (units) {
+		ret = run_units() ? 1 : 0;
+	} else if (budgets) {
+		ret = run_budgets(budgets, verbose);
+		ret = ret < 0 ? 2 : ret ? 1 : 0;
+	} else if (optind == argc) {
+		for (i = 0; i < ARRAY_SIZE(scenarios); i++)
+			run_one(i, verbose);
+	}
+	for (j = optind; !budgets && !units && j < argc; j++) {
+		i = find_scenario(argv[j]);
+		if (i < 0) {
+			ret = 1;
+			break;
+		}
+		run_one(i, verbose);
+	}
+
+	drv->remove(&host_spi_dev);
+	ch43x_exit();
+
+	return ret;
+
+usage:
+	fprintf(stderr, "usage: %s [-r baud] [-t seconds] [-l load] [-n ops] [-s spi_hz] [-e fail_hz] [-m msg_ns] [-i irq_ns] "
+			"[-f fault=prob[,interval[,times]]] [-w warmup_ms] [-d delay_us] [-v] "
+			"[-u | -b budgets | rx|tx|loop|termios|mctrl|storm ...]\n",
+		argv[0]);
+	return 1;
+}
@@ -0,0 +1,1176 @@
+/*
+ * Userspace implementation of the kernel APIs declared in
+ * include/ch43x_host_kernel.h, with the ch432 register model on the spi bus.
+ *
+ * An spi message is decoded the way the chip does it: the first byte is the
+ * command (port, register, read/write), every following byte reads or writes
+ * that register again, so RHR/THR bursts move FIFO data. A message takes
+ * host_spi_msg_ns plus its bits at host_spi_hz of simulated time. Above
+ * host_spi_fail_hz read data comes back one bit late, as MISO does on a
+ * trace too long for the clock.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <ch43x_host_kernel.h>
+
+#include "../ch43x_model.h"
+
+struct ch43x_model host_model;
+struct host_spi_stats host_spi;
+u64 host_spi_hz = 20000000;
+u64 host_spi_fail_hz;
+u32 host_spi_max_frequency;
+u64 host_spi_msg_ns = 2000;
+int host_verbose;
+
+struct bus_type spi_bus_type = { .name = "spi" };
+
+static u64 host_clock;
+
+u64 host_now(void)
+{
+	return host_clock;
+}
+
+void host_advance(u64 ns)
+{
+	host_clock += ns;
+	ch43x_model_advance(&host_model, host_clock);
+}
+
+void host_delay(u64 ns)
+{
+	host_advance(ns);
+}
+
+struct task_struct host_task = { .pid = 1 };
+
+void host_mutex_lock(struct mutex *lock, const char *name)
+{
+	if (lock->locked) {
+		fprintf(stderr, "deadlock: %s taken twice\n", name);
+		abort();
+	}
+	lock->locked = 1;
+}
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (!size)
+		return 0;
+	va_start(ap, fmt);
+	n = vsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+
+	return n < (int)size ? n : (int)size - 1;
+}
+
+size_t strscpy(char *dst, const char *src, size_t size)
+{
+	snprintf(dst, size, "%s", src);
+	return strlen(dst);
+}
+
+void *devm_kzalloc(struct device *dev, size_t size, gfp_t gfp)
+{
+	return calloc(1, size);
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+	char *end;
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(s, &end, base);
+	if (errno || end == s || (*end && *end != '\n') || v > U32_MAX)
+		return -EINVAL;
+	*res = v;
+
+	return 0;
+}
+
+int kstrtouint_from_user(const char __user *s, size_t count, unsigned int base, unsigned int *res)
+{
+	char buf[32];
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	memcpy(buf, s, count);
+	buf[count] = '\0';
+
+	return kstrtouint(buf, base, res);
+}
+
+/* work and timers */
+static struct work_struct *work_head, **work_tail = &work_head;
+
+#define HOST_MAX_TIMERS 16
+static struct hrtimer *timers[HOST_MAX_TIMERS];
+
+bool schedule_work(struct work_struct *work)
+{
+	if (work->pending)
+		return false;
+	work->pending = true;
+	work->next = NULL;
+	*work_tail = work;
+	work_tail = &work->next;
+
+	return true;
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+	struct work_struct **w;
+
+	if (!work->pending)
+		return false;
+	for (w = &work_head; *w; w = &(*w)->next) {
+		if (*w != work)
+			continue;
+		*w = work->next;
+		if (!*w)
+			work_tail = w;
+		break;
+	}
+	work->pending = false;
+
+	return true;
+}
+
+void hrtimer_init(struct hrtimer *timer, int clock_id, enum hrtimer_mode mode)
+{
+	memset(timer, 0, sizeof(*timer));
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode)
+{
+	int i, free = -1;
+
+	timer->expires = mode == HRTIMER_MODE_REL ? host_clock + tim : (u64)tim;
+	if (timer->queued)
+		return;
+	for (i = 0; i < HOST_MAX_TIMERS; i++)
+		if (!timers[i] && free < 0)
+			free = i;
+	if (free < 0) {
+		fprintf(stderr, "too many hrtimers\n");
+		abort();
+	}
+	timers[free] = timer;
+	timer->queued = true;
+}
+
+int hrtimer_cancel(struct hrtimer *timer)
+{
+	int i;
+
+	if (!timer->queued)
+		return 0;
+	for (i = 0; i < HOST_MAX_TIMERS; i++)
+		if (timers[i] == timer)
+			timers[i] = NULL;
+	timer->queued = false;
+
+	return 1;
+}
+
+/* the expiry moves by whole intervals past now, as in the kernel */
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval)
+{
+	u64 n;
+
+	if (timer->expires > host_clock)
+		return 0;
+	n = (host_clock - timer->expires) / interval + 1;
+	timer->expires += n * interval;
+
+	return n;
+}
+
+static enum hrtimer_restart host_delayed_work_fn(struct hrtimer *timer)
+{
+	schedule_work(&container_of(timer, struct delayed_work, timer)->work);
+
+	return HRTIMER_NORESTART;
+}
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay)
+{
+	if (dwork->work.pending || dwork->timer.queued)
+		return false;
+	if (!delay)
+		return schedule_work(&dwork->work);
+	dwork->timer.function = host_delayed_work_fn;
+	hrtimer_start(&dwork->timer, (u64)delay * (NSEC_PER_SEC / HZ), HRTIMER_MODE_REL);
+
+	return true;
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	bool queued = hrtimer_cancel(&dwork->timer);
+
+	return cancel_work_sync(&dwork->work) || queued;
+}
+
+int host_run_work(void)
+{
+	struct work_struct *w;
+	int i, n = 0;
+
+	for (i = 0; i < HOST_MAX_TIMERS; i++) {
+		struct hrtimer *t = timers[i];
+
+		if (!t || t->expires > host_clock)
+			continue;
+		timers[i] = NULL;
+		t->queued = false;
+		if (t->function(t) == HRTIMER_RESTART)
+			hrtimer_start(t, t->expires, HRTIMER_MODE_ABS);
+		n++;
+	}
+
+	while ((w = work_head)) {
+		work_head = w->next;
+		if (!work_head)
+			work_tail = &work_head;
+		w->pending = false;
+		w->func(w);
+		n++;
+	}
+
+	return n;
+}
+
+/* kfifo */
+int __kfifo_alloc(struct __kfifo *fifo, unsigned int size, size_t esize)
+{
+	size = roundup_pow_of_two(size);
+	fifo->in = 0;
+	fifo->out = 0;
+	fifo->esize = esize;
+	fifo->mask = size - 1;
+	fifo->data = calloc(size, esize);
+
+	return fifo->data ? 0 : -ENOMEM;
+}
+
+void __kfifo_free(struct __kfifo *fifo)
+{
+	free(fifo->data);
+	fifo->data = NULL;
+}
+
+unsigned int __kfifo_in(struct __kfifo *fifo, const void *buf, unsigned int len)
+{
+	unsigned int i, space = fifo->mask + 1 - (fifo->in - fifo->out);
+
+	len = min(len, space);
+	for (i = 0; i < len; i++, fifo->in++)
+		memcpy((char *)fifo->data + (fifo->in & fifo->mask) * fifo->esize,
+		       (const char *)buf + i * fifo->esize, fifo->esize);
+
+	return len;
+}
+
+unsigned int __kfifo_out(struct __kfifo *fifo, void *buf, unsigned int len)
+{
+	unsigned int i;
+
+	len = min(len, fifo->in - fifo->out);
+	for (i = 0; i < len; i++, fifo->out++)
+		memcpy((char *)buf + i * fifo->esize,
+		       (const char *)fifo->data + (fifo->out & fifo->mask) * fifo->esize, fifo->esize);
+
+	return len;
+}
+
+/* files */
+int nonseekable_open(struct inode *inode, struct file *filp)
+{
+	return 0;
+}
+
+loff_t no_llseek(struct file *file, loff_t offset, int whence)
+{
+	return -ESPIPE;
+}
+
+loff_t default_llseek(struct file *file, loff_t offset, int whence)
+{
+	return -ESPIPE;
+}
+
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos, const void *from, size_t available)
+{
+	loff_t pos = *ppos;
+
+	if (pos < 0)
+		return -EINVAL;
+	if ((size_t)pos >= available || !count)
+		return 0;
+	count = min(count, available - (size_t)pos);
+	memcpy(to, (const char *)from + pos, count);
+	*ppos = pos + count;
+
+	return count;
+}
+
+int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff)
+{
+	return -ENODEV;
+}
+
+/* seq_file */
+void seq_printf(struct seq_file *m, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(m->buf + m->count, m->size - m->count, fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		m->count = min(m->count + n, m->size - 1);
+}
+
+void seq_puts(struct seq_file *m, const char *s)
+{
+	seq_printf(m, "%s", s);
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *), void *data)
+{
+	struct seq_file *m = calloc(1, sizeof(*m));
+
+	if (!m)
+		return -ENOMEM;
+	m->show = show;
+	m->private = data;
+	file->private_data = m;
+
+	return 0;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+
+	free(m->buf);
+	free(m);
+
+	return 0;
+}
+
+ssize_t seq_read(struct file *file, char __user *buf, size_t size, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+
+	if (!m->buf) {
+		m->size = 16384;
+		m->buf = calloc(1, m->size);
+		if (!m->buf)
+			return -ENOMEM;
+		m->show(m, NULL);
+	}
+
+	return simple_read_from_buffer(buf, size, ppos, m->buf, m->count);
+}
+
+loff_t seq_lseek(struct file *file, loff_t offset, int whence)
+{
+	return -ESPIPE;
+}
+
+/* debugfs */
+#define HOST_MAX_DENTRIES 96
+static struct dentry dentries[HOST_MAX_DENTRIES];
+static int nr_dentries;
+
+static struct dentry *debugfs_add(const char *name, struct dentry *parent, void *data,
+				  const struct file_operations *fops)
+{
+	struct dentry *d;
+
+	if (nr_dentries == HOST_MAX_DENTRIES)
+		return ERR_PTR(-ENOMEM);
+	d = &dentries[nr_dentries++];
+	snprintf(d->name, sizeof(d->name), "%s", name);
+	d->parent = parent;
+	d->data = data;
+	d->fops = fops;
+
+	return d;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	return debugfs_add(name, parent, NULL, NULL);
+}
+
+struct dentry *debugfs_create_file(const char *name, unsigned short mode, struct dentry *parent, void *data,
+				   const struct file_operations *fops)
+{
+	return debugfs_add(name, parent, data, fops);
+}
+
+/* number files: u32, unsigned long and long values */
+enum { HOST_NUM_U32, HOST_NUM_ULONG, HOST_NUM_LONG };
+
+struct host_num {
+	void *value;
+	int type;
+};
+
+#define HOST_MAX_NUMS 32
+static struct host_num host_nums[HOST_MAX_NUMS];
+static int nr_host_nums;
+
+static int host_num_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static ssize_t host_num_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct host_num *n = file->private_data;
+	char tmp[32];
+	long long v;
+	size_t len;
+
+	v = n->type == HOST_NUM_U32 ? *(u32 *)n->value :
+	    n->type == HOST_NUM_ULONG ? (long long)*(unsigned long *)n->value : *(long *)n->value;
+	len = snprintf(tmp, sizeof(tmp), "%lld\n", v);
+	if (*ppos >= len)
+		return 0;
+	len = min_t(size_t, count, len - *ppos);
+	memcpy(buf, tmp + *ppos, len);
+	*ppos += len;
+
+	return len;
+}
+
+static ssize_t host_num_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct host_num *n = file->private_data;
+	char tmp[32];
+	long long v;
+
+	if (count >= sizeof(tmp))
+		return -EINVAL;
+	memcpy(tmp, buf, count);
+	tmp[count] = '\0';
+	v = strtoll(tmp, NULL, 0);
+	if (n->type == HOST_NUM_U32)
+		*(u32 *)n->value = v;
+	else if (n->type == HOST_NUM_ULONG)
+		*(unsigned long *)n->value = v;
+	else
+		*(long *)n->value = v;
+
+	return count;
+}
+
+static int host_num_release(struct inode *inode, struct file *file)
+{
+	return 0;
+}
+
+static const struct file_operations host_num_fops = {
+	.open = host_num_open,
+	.read = host_num_read,
+	.write = host_num_write,
+	.release = host_num_release,
+};
+
+static struct dentry *host_num_create(const char *name, struct dentry *parent, void *value, int type)
+{
+	struct host_num *n;
+
+	if (nr_host_nums == HOST_MAX_NUMS)
+		return ERR_PTR(-ENOMEM);
+	n = &host_nums[nr_host_nums++];
+	n->value = value;
+	n->type = type;
+
+	return debugfs_add(name, parent, n, &host_num_fops);
+}
+
+struct dentry *debugfs_create_u32(const char *name, unsigned short mode, struct dentry *parent, u32 *value)
+{
+	return host_num_create(name, parent, value, HOST_NUM_U32);
+}
+
+void debugfs_remove_recursive(struct dentry *dentry)
+{
+	nr_dentries = 0;
+	nr_host_nums = 0;
+}
+
+/* regmap */
+#define HOST_REGMAP_MAX 64
+
+struct regmap {
+	struct device *dev;
+	const struct regmap_bus *bus;
+	void *context;
+	struct regmap_config config;
+	unsigned int cache[HOST_REGMAP_MAX];
+	bool cached[HOST_REGMAP_MAX];
+	char name[64];
+};
+
+static struct regmap host_regmap;
+
+static void regmap_lock(struct regmap *map)
+{
+	if (map->config.lock)
+		map->config.lock(map->config.lock_arg);
+}
+
+static void regmap_unlock(struct regmap *map)
+{
+	if (map->config.unlock)
+		map->config.unlock(map->config.lock_arg);
+}
+
+static bool regmap_volatile(struct regmap *map, unsigned int reg)
+{
+	return map->config.cache_type == REGCACHE_NONE ||
+	       (map->config.volatile_reg && map->config.volatile_reg(map->dev, reg));
+}
+
+static int regmap_check(struct regmap *map, unsigned int reg, bool (*allowed)(struct device *, unsigned int))
+{
+	if (reg > map->config.max_register || reg >= HOST_REGMAP_MAX)
+		return -EINVAL;
+	if (allowed && !allowed(map->dev, reg))
+		return -EIO;
+	return 0;
+}
+
+static int regmap_read_locked(struct regmap *map, unsigned int reg, unsigned int *val)
+{
+	int ret = regmap_check(map, reg, map->config.readable_reg);
+
+	if (ret)
+		return ret;
+	if (!regmap_volatile(map, reg) && map->cached[reg]) {
+		*val = map->cache[reg];
+		return 0;
+	}
+	ret = map->bus->reg_read(map->context, reg, val);
+	if (!ret && !regmap_volatile(map, reg)) {
+		map->cache[reg] = *val;
+		map->cached[reg] = true;
+	}
+
+	return ret;
+}
+
+static int regmap_write_locked(struct regmap *map, unsigned int reg, unsigned int val)
+{
+	int ret = regmap_check(map, reg, map->config.writeable_reg);
+
+	if (ret)
+		return ret;
+	/* the cache keeps the value even if the bus write fails, like regcache */
+	if (!regmap_volatile(map, reg)) {
+		map->cache[reg] = val;
+		map->cached[reg] = true;
+	}
+
+	return map->bus->reg_write(map->context, reg, val);
+}
+
+int regmap_read(struct regmap *map, unsigned int reg, unsigned int *val)
+{
+	int ret;
+
+	regmap_lock(map);
+	ret = regmap_read_locked(map, reg, val);
+	regmap_unlock(map);
+
+	return ret;
+}
+
+int regmap_write(struct regmap *map, unsigned int reg, unsigned int val)
+{
+	int ret;
+
+	regmap_lock(map);
+	ret = regmap_write_locked(map, reg, val);
+	regmap_unlock(map);
+
+	return ret;
+}
+
+int regmap_bulk_write(struct regmap *map, unsigned int reg, const void *val, size_t val_count)
+{
+	size_t i;
+	int ret = 0;
+
+	regmap_lock(map);
+	for (i = 0; i < val_count && !ret; i++)
+		ret = regmap_write_locked(map, reg + i, ((const u8 *)val)[i]);
+	regmap_unlock(map);
+
+	return ret;
+}
+
+int regmap_update_bits_base(struct regmap *map, unsigned int reg, unsigned int mask, unsigned int val, bool *change,
+			    bool async, bool force)
+{
+	unsigned int orig, tmp;
+	int ret;
+
+	regmap_lock(map);
+	ret = regmap_read_locked(map, reg, &orig);
+	if (ret)
+		goto out;
+	tmp = (orig & ~mask) | (val & mask);
+	if (force || tmp != orig)
+		ret = regmap_write_locked(map, reg, tmp);
+	if (change)
+		*change = !ret && tmp != orig;
+out:
+	regmap_unlock(map);
+
+	return ret;
+}
+
+int regcache_drop_region(struct regmap *map, unsigned int min, unsigned int max)
+{
+	unsigned int reg;
+
+	regmap_lock(map);
+	for (reg = min; reg <= max && reg < HOST_REGMAP_MAX; reg++)
+		map->cached[reg] = false;
+	regmap_unlock(map);
+
+	return 0;
+}
+
+static int regmap_registers_show(struct seq_file *m, void *v)
+{
+	struct regmap *map = m->private;
+	unsigned int reg, val;
+
+	for (reg = 0; reg <= map->config.max_register && reg < HOST_REGMAP_MAX; reg++) {
+		if (map->config.readable_reg && !map->config.readable_reg(map->dev, reg))
+			continue;
+		if (map->config.precious_reg && map->config.precious_reg(map->dev, reg))
+			continue;
+		if (regmap_read(map, reg, &val))
+			seq_printf(m, "%x: XX\n", reg);
+		else
+			seq_printf(m, "%x: %02x\n", reg, val);
+	}
+
+	return 0;
+}
+
+static int regmap_registers_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, regmap_registers_show, inode->i_private);
+}
+
+static const struct file_operations regmap_registers_fops = {
+	.open = regmap_registers_open,
+	.read = seq_read,
+	.release = single_release,
+};
+
+/* one chip in the harness, one map */
+struct regmap *devm_regmap_init(struct device *dev, const struct regmap_bus *bus, void *bus_context,
+				const struct regmap_config *config)
+{
+	struct regmap *map = &host_regmap;
+	struct dentry *dir;
+
+	if (config->max_register >= HOST_REGMAP_MAX)
+		return ERR_PTR(-EINVAL);
+	memset(map, 0, sizeof(*map));
+	map->dev = dev;
+	map->bus = bus;
+	map->context = bus_context;
+	map->config = *config;
+	snprintf(map->name, sizeof(map->name), "%s-%s", dev_name(dev), config->name);
+	dir = debugfs_create_dir(map->name, debugfs_create_dir("regmap", NULL));
+	debugfs_create_file("registers", 0400, dir, map, &regmap_registers_fops);
+
+	return map;
+}
+
+/* fault injection */
+static u32 host_fault_seed = 0x43483432;
+
+static unsigned int host_fault_random(void)
+{
+	/* xorshift32, the same sequence on every run */
+	host_fault_seed ^= host_fault_seed << 13;
+	host_fault_seed ^= host_fault_seed >> 17;
+	host_fault_seed ^= host_fault_seed << 5;
+
+	return host_fault_seed;
+}
+
+bool should_fail(struct fault_attr *attr, ssize_t size)
+{
+	if (attr->times == 0)
+		return false;
+	if (attr->space > size) {
+		attr->space -= size;
+		return false;
+	}
+	if (attr->interval > 1) {
+		attr->count++;
+		if (attr->count % attr->interval)
+			return false;
+	}
+	if (attr->probability <= host_fault_random() % 100)
+		return false;
+	if (attr->times != -1)
+		attr->times--;
+	attr->hits++;
+	attr->last_ns = host_clock;
+
+	return true;
+}
+
+struct dentry *fault_create_debugfs_attr(const char *name, struct dentry *parent, struct fault_attr *attr)
+{
+	struct dentry *dir = debugfs_create_dir(name, parent);
+
+	if (IS_ERR(dir))
+		return dir;
+	host_num_create("probability", dir, &attr->probability, HOST_NUM_ULONG);
+	host_num_create("interval", dir, &attr->interval, HOST_NUM_ULONG);
+	host_num_create("times", dir, &attr->times, HOST_NUM_LONG);
+	host_num_create("space", dir, &attr->space, HOST_NUM_LONG);
+	host_num_create("verbose", dir, &attr->verbose, HOST_NUM_ULONG);
+
+	return dir;
+}
+
+static size_t debugfs_path(const struct dentry *d, char *buf, size_t size)
+{
+	size_t len = d->parent ? debugfs_path(d->parent, buf, size) : 0;
+
+	if (len && len < size)
+		buf[len++] = '/';
+	if (len < size)
+		len += strlen(strncpy(buf + len, d->name, size - len));
+	if (len >= size)
+		len = size - 1;
+	buf[len] = '\0';
+
+	return len;
+}
+
+static struct dentry *debugfs_lookup(const char *path)
+{
+	char name[256];
+	int i;
+
+	for (i = 0; i < nr_dentries; i++) {
+		debugfs_path(&dentries[i], name, sizeof(name));
+		if (dentries[i].fops && !strcmp(name, path))
+			return &dentries[i];
+	}
+
+	return NULL;
+}
+
+ssize_t host_debugfs_read(const char *path, char *buf, size_t size)
+{
+	struct dentry *d = debugfs_lookup(path);
+	struct inode inode = { .i_private = d ? d->data : NULL };
+	struct file file = { .f_mode = FMODE_READ, .f_inode = &inode };
+	loff_t pos = 0;
+	ssize_t n, len = 0;
+	int ret;
+
+	if (!d || !size)
+		return -ENOENT;
+	ret = d->fops->open(&inode, &file);
+	if (ret)
+		return ret;
+	while ((n = d->fops->read(&file, buf + len, size - 1 - len, &pos)) > 0)
+		len += n;
+	buf[len] = '\0';
+	d->fops->release(&inode, &file);
+
+	return n < 0 ? n : len;
+}
+
+ssize_t host_debugfs_write(const char *path, const char *buf)
+{
+	struct dentry *d = debugfs_lookup(path);
+	struct inode inode = { .i_private = d ? d->data : NULL };
+	struct file file = { .f_mode = FMODE_WRITE, .f_inode = &inode };
+	loff_t pos = 0;
+	ssize_t n;
+	int ret;
+
+	if (!d)
+		return -ENOENT;
+	ret = d->fops->open(&inode, &file);
+	if (ret)
+		return ret;
+	n = d->fops->write(&file, buf, strlen(buf), &pos);
+	d->fops->release(&inode, &file);
+
+	return n;
+}
+
+/* sysfs */
+int sysfs_create_group(struct kobject *kobj, const struct attribute_group *grp)
+{
+	return 0;
+}
+
+void sysfs_remove_group(struct kobject *kobj, const struct attribute_group *grp)
+{
+}
+
+int sysfs_create_link(struct kobject *kobj, struct kobject *target, const char *name)
+{
+	return 0;
+}
+
+void sysfs_remove_link(struct kobject *kobj, const char *name)
+{
+}
+
+/* irq */
+static struct {
+	irq_handler_t handler;
+	irq_handler_t thread_fn;
+	unsigned int irq;
+	void *dev_id;
+} host_irq_desc;
+
+int devm_request_threaded_irq(struct device *dev, unsigned int irq, irq_handler_t handler, irq_handler_t thread_fn,
+			      unsigned long irqflags, const char *devname, void *dev_id)
+{
+	host_irq_desc.handler = handler;
+	host_irq_desc.thread_fn = thread_fn;
+	host_irq_desc.irq = irq;
+	host_irq_desc.dev_id = dev_id;
+
+	return 0;
+}
+
+void devm_free_irq(struct device *dev, unsigned int irq, void *dev_id)
+{
+	memset(&host_irq_desc, 0, sizeof(host_irq_desc));
+}
+
+bool host_irq_registered(void)
+{
+	return host_irq_desc.thread_fn != NULL;
+}
+
+void host_irq(u64 latency_ns)
+{
+	irqreturn_t ret = IRQ_WAKE_THREAD;
+
+	if (!host_irq_desc.thread_fn)
+		return;
+	if (host_irq_desc.handler)
+		ret = host_irq_desc.handler(host_irq_desc.irq, host_irq_desc.dev_id);
+	if (ret != IRQ_WAKE_THREAD)
+		return;
+	host_advance(latency_ns);
+	host_irq_desc.thread_fn(host_irq_desc.irq, host_irq_desc.dev_id);
+}
+
+/* misc devices */
+int misc_register(struct miscdevice *misc)
+{
+	misc->this_device = misc->parent;
+	return 0;
+}
+
+void misc_deregister(struct miscdevice *misc)
+{
+	misc->this_device = NULL;
+}
+
+/* spi */
+static struct spi_driver *registered_driver;
+
+int spi_register_driver(struct spi_driver *sdrv)
+{
+	registered_driver = sdrv;
+	return 0;
+}
+
+void spi_unregister_driver(struct spi_driver *sdrv)
+{
+	registered_driver = NULL;
+}
+
+struct spi_driver *host_spi_driver(void)
+{
+	return registered_driver;
+}
+
+/* the only device property is the spi-max-frequency given with -s */
+int device_property_read_u32(struct device *dev, const char *propname, u32 *val)
+{
+	if (strcmp(propname, "spi-max-frequency") || !host_spi_max_frequency)
+		return -EINVAL;
+	*val = host_spi_max_frequency;
+
+	return 0;
+}
+
+int spi_setup(struct spi_device *spi)
+{
+	if (spi->max_speed_hz)
+		host_spi_hz = spi->max_speed_hz;
+	return 0;
+}
+
+/* one chip select period: command byte, then data bytes for that register */
+struct host_cs {
+	u8 cmd;
+	unsigned int pos;
+};
+
+static void host_cs_byte(struct host_cs *cs, const u8 *tx, u8 *rx)
+{
+	int line = cs->cmd >> 5;
+	u8 reg = (cs->cmd >> 2) & 0x07;
+	u8 val = 0;
+
+	if (!cs->pos++) {
+		cs->cmd = tx ? *tx : 0;
+		val = 0xff;
+	} else if (cs->cmd & 0x02) {
+		ch43x_model_write(&host_model, line, reg, tx ? *tx : 0);
+	} else {
+		val = ch43x_model_read(&host_model, line, reg);
+		if (host_spi_fail_hz && host_spi_hz > host_spi_fail_hz)
+			val = (val >> 1) | 0x80;
+	}
+	if (rx)
+		*rx = val;
+}
+
+/*
+ * INT can fall and rise again inside one driver call (a recovery toggling
+ * IER, the chip re-asserting while the thread still drains it); the kernel
+ * latches such an edge, so sample the line after every message as well.
+ */
+u64 host_int_edges;
+static bool host_int_level;
+
+static void host_latch_edge(void)
+{
+	bool level = ch43x_model_irq(&host_model);
+
+	if (level && !host_int_level)
+		host_int_edges++;
+	host_int_level = level;
+}
+
+static void host_spi_account(unsigned int xfers, unsigned int bytes)
+{
+	u64 ns = host_spi_msg_ns + (u64)bytes * 8 * NSEC_PER_SEC / host_spi_hz;
+
+	host_spi.msgs++;
+	host_spi.xfers += xfers;
+	host_spi.bytes += bytes;
+	host_spi.ns += ns;
+	host_advance(ns);
+}
+
+static int host_spi_transfer(struct spi_device *spi, struct spi_message *message)
+{
+	struct host_cs cs = { 0 };
+	struct spi_transfer *t;
+	unsigned int i, xfers = 0, bytes = 0;
+
+	ch43x_model_advance(&host_model, host_clock);
+	list_for_each_entry(t, &message->transfers, transfer_list) {
+		for (i = 0; i < t->len; i++)
+			host_cs_byte(&cs, t->tx_buf ? (const u8 *)t->tx_buf + i : NULL,
+				     t->rx_buf ? (u8 *)t->rx_buf + i : NULL);
+		xfers++;
+		bytes += t->len;
+	}
+	message->actual_length = bytes;
+	message->status = 0;
+	host_spi_account(xfers, bytes);
+	host_latch_edge();
+
+	return 0;
+}
+
+/*
+ * The kernel's spi_sync waits for the bus lock, with one thread that is a
+ * deadlock; spi_sync_locked must only be used by the holder.
+ */
+int spi_sync(struct spi_device *spi, struct spi_message *message)
+{
+	if (spi->controller && spi->controller->bus_lock_flag) {
+		fprintf(stderr, "deadlock: spi_sync with the spi bus locked\n");
+		abort();
+	}
+	return host_spi_transfer(spi, message);
+}
+
+int spi_sync_locked(struct spi_device *spi, struct spi_message *message)
+{
+	if (!spi->controller || !spi->controller->bus_lock_flag) {
+		fprintf(stderr, "spi_sync_locked without the spi bus locked\n");
+		abort();
+	}
+	return host_spi_transfer(spi, message);
+}
+
+int spi_bus_lock(struct spi_controller *ctlr)
+{
+	if (ctlr->bus_lock_flag) {
+		fprintf(stderr, "deadlock: spi bus locked twice\n");
+		abort();
+	}
+	ctlr->bus_lock_flag = 1;
+	return 0;
+}
+
+int spi_bus_unlock(struct spi_controller *ctlr)
+{
+	ctlr->bus_lock_flag = 0;
+	return 0;
+}
+
+int spi_write_then_read(struct spi_device *spi, const void *txbuf, unsigned int n_tx, void *rxbuf, unsigned int n_rx)
+{
+	struct spi_transfer t[2] = {
+		{ .tx_buf = txbuf, .len = n_tx },
+		{ .rx_buf = rxbuf, .len = n_rx },
+	};
+	struct spi_message m;
+
+	spi_message_init(&m);
+	spi_message_add_tail(&t[0], &m);
+	if (n_rx)
+		spi_message_add_tail(&t[1], &m);
+
+	return spi_sync(spi, &m);
+}
+
+/* serial core */
+int uart_register_driver(struct uart_driver *uart)
+{
+	return 0;
+}
+
+void uart_unregister_driver(struct uart_driver *uart)
+{
+}
+
+int uart_add_one_port(struct uart_driver *reg, struct uart_port *port)
+{
+	struct uart_state *state = calloc(1, sizeof(*state));
+
+	if (!state)
+		return -ENOMEM;
+	state->xmit.buf = calloc(1, UART_XMIT_SIZE);
+	if (!state->xmit.buf) {
+		free(state);
+		return -ENOMEM;
+	}
+	mutex_init(&state->port.mutex);
+	port->state = state;
+	port->cons = reg->cons;
+
+	return 0;
+}
+
+void uart_remove_one_port(struct uart_driver *reg, struct uart_port *port)
+{
+	free(port->state->xmit.buf);
+	free(port->state);
+	port->state = NULL;
+}
+
+void uart_write_wakeup(struct uart_port *port)
+{
+	host_tty_wakeup(port);
+}
+
+void uart_handle_cts_change(struct uart_port *port, bool active)
+{
+	port->icount.cts++;
+}
+
+unsigned int uart_get_baud_rate(struct uart_port *port, struct ktermios *termios, const struct ktermios *old,
+				unsigned int min, unsigned int max)
+{
+	unsigned int baud = termios->c_ospeed;
+
+	if (baud >= min && baud <= max)
+		return baud;
+	if (old && old->c_ospeed >= min && old->c_ospeed <= max)
+		return old->c_ospeed;
+
+	return baud < min ? min : max;
+}
+
+void uart_update_timeout(struct uart_port *port, unsigned int cflag, unsigned int baud)
+{
+	/* start, 8 data, parity, 2 stop bits for the whole FIFO */
+	port->timeout = (u64)12 * port->fifosize * HZ / baud + HZ / 50;
+}
+
+int tty_insert_flip_char(struct tty_port *port, unsigned char ch, char flag)
+{
+	host_tty_rx(port, ch, flag);
+	return 1;
+}
+
+void tty_flip_buffer_push(struct tty_port *port)
+{
+	host_tty_push(port);
+}
+
+void uart_insert_char(struct uart_port *port, unsigned int status, unsigned int overrun, unsigned int ch,
+		      unsigned int flag)
+{
+	struct tty_port *tport = &port->state->port;
+
+	if ((status & port->ignore_status_mask & ~overrun) == 0)
+		tty_insert_flip_char(tport, ch, flag);
+	if (status & ~port->ignore_status_mask & overrun)
+		tty_insert_flip_char(tport, 0, TTY_OVERRUN);
+}
+
+void uart_parse_options(const char *options, int *baud, int *parity, int *bits, int *flow)
+{
+	*baud = atoi(options);
+}
+
+int uart_set_options(struct uart_port *port, struct console *co, int baud, int parity, int bits, int flow)
+{
+	return 0;
+}
+
+struct tty_driver *uart_console_device(struct console *co, int *index)
+{
+	return NULL;
+}
@@ -0,0 +1,6 @@
+#!/bin/sh
+# Corrupted reads: one flipped bit in every 2000th read on average, seen as
+# bad data, bogus IIR values and line status errors. A corrupted IIR read can
+# also clear a THRI unseen, tx then waits for the watchdog to refill.
+HOST=${CH43X_HOST:-./ch43x_host}
+"$HOST" "$@" -f corrupt_read=100,2000 rx tx loop
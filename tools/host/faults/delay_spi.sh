@@ -0,0 +1,5 @@
+#!/bin/sh
+# Delayed completions: every 200th transfer completes 2ms late, long enough
+# for the 16 byte rx fifo to overrun at 921600.
+HOST=${CH43X_HOST:-./ch43x_host}
+"$HOST" "$@" -d 2000 -f delay_spi=100,200 rx tx loop
@@ -0,0 +1,6 @@
+#!/bin/sh
+# Failed spi transfers: a 40 message outage that needs the recovery work,
+# then sporadic failures the per-access retry absorbs.
+HOST=${CH43X_HOST:-./ch43x_host}
+"$HOST" "$@" -f fail_spi=100,1,40 rx tx loop || exit
+"$HOST" "$@" -f fail_spi=1 rx tx loop
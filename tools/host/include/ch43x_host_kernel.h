@@ -0,0 +1,1160 @@
+/*
+ * Userspace stand-in for the kernel APIs used by ch432.c.
+ *
+ * Every linux/ header that ch432.c includes resolves to this file when
+ * tools/host/include is on the include path, so the driver source builds
+ * unchanged as a normal program. Only what the driver uses is provided, with
+ * the semantics it depends on:
+ *
+ * - spi messages go to the register model in tools/ch43x_model.c, one
+ *   command byte followed by the data bytes, and take simulated bus time
+ * - time is simulated, ktime_get_ns(), jiffies and the delays all use the
+ *   clock in ch43x_host_kernel.c
+ * - the harness runs queued work items and expired hrtimers itself, there
+ *   is a single thread, so a mutex taken twice aborts instead of blocking
+ * - the tty flip buffer, uart_write_wakeup() and the irq handlers call the
+ *   host_* hooks at the end of this file
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef CH43X_HOST_KERNEL_H
+#define CH43X_HOST_KERNEL_H
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <asm/termios.h>
+#include <linux/ioctl.h>
+#include <linux/serial.h>
+#include <linux/serial_reg.h>
+#include <linux/types.h>
+
+/* kernel version the driver is built for, before the 6.10 xmit kfifo */
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + ((c) > 255 ? 255 : (c)))
+#define LINUX_VERSION_CODE	KERNEL_VERSION(6, 6, 0)
+
+#define KBUILD_MODNAME "ch432"
+
+/* kconfig */
+#define __ARG_PLACEHOLDER_1 0,
+#define __take_second_arg(__ignored, val, ...) val
+#define ____is_defined(arg1_or_junk) __take_second_arg(arg1_or_junk 1, 0)
+#define ___is_defined(val) ____is_defined(__ARG_PLACEHOLDER_##val)
+#define __is_defined(x) ___is_defined(x)
+#define IS_ENABLED(option) __is_defined(option)
+
+/* fault injection is always there, the harness scenarios use it */
+#define CONFIG_FAULT_INJECTION		1
+#define CONFIG_FAULT_INJECTION_DEBUG_FS 1
+
+/* types */
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef s64 ktime_t;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+typedef unsigned int __poll_t;
+
+#define __user
+#define __force
+#define __iomem
+#define __init
+#define __exit
+#define __maybe_unused __attribute__((unused))
+#define likely(x)      __builtin_expect(!!(x), 1)
+#define unlikely(x)    __builtin_expect(!!(x), 0)
+
+#define U16_MAX ((u16)~0U)
+#define U32_MAX ((u32)~0U)
+
+#define GFP_KERNEL 0
+#define PAGE_SIZE  4096UL
+
+#define ENOIOCTLCMD 515
+#define ERESTARTSYS 512
+
+#define NSEC_PER_USEC 1000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC  1000000000ULL
+
+/* helpers */
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(a, b)			({ typeof(a) __a = (a); typeof(b) __b = (b); __a < __b ? __a : __b; })
+#define max(a, b)			({ typeof(a) __a = (a); typeof(b) __b = (b); __a > __b ? __a : __b; })
+#define min_t(type, a, b)		min((type)(a), (type)(b))
+#define max_t(type, a, b)		max((type)(a), (type)(b))
+#define min3(a, b, c)			min(min(a, b), c)
+#define min_not_zero(a, b)		({ typeof(a) __x = (a); typeof(b) __y = (b); !__x ? __y : !__y ? __x : min(__x, __y); })
+#define DIV_ROUND_CLOSEST(x, divisor)	(((x) + ((divisor) / 2)) / (divisor))
+#define DIV_ROUND_UP(n, d)		(((n) + (d) - 1) / (d))
+
+#define READ_ONCE(x)	      (*(const volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val)    (*(volatile typeof(x) *)&(x) = (val))
+#define smp_load_acquire(p)   __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define xchg(p, v)	      __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+
+#define do_div(n, base)                                  \
+	({                                               \
+		u32 __base = (base);                     \
+		u32 __rem = (u32)((n) % __base);         \
+		(n) /= __base;                           \
+		__rem;                                   \
+	})
+
+static inline u64 div_u64(u64 a, u32 b)
+{
+	return a / b;
+}
+
+static inline u64 div64_u64(u64 a, u64 b)
+{
+	return a / b;
+}
+
+static inline s64 div_s64(s64 a, s32 b)
+{
+	return a / b;
+}
+
+static inline int fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+	return n <= 1 ? 1 : 1UL << (64 - __builtin_clzl(n - 1));
+}
+
+/* bitmaps */
+#define BITS_PER_LONG		 64
+#define BITS_TO_LONGS(nr)	 DIV_ROUND_UP(nr, BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+
+static inline void set_bit(unsigned int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline bool test_bit(unsigned int nr, const unsigned long *addr)
+{
+	return addr[nr / BITS_PER_LONG] & (1UL << (nr % BITS_PER_LONG));
+}
+
+static inline unsigned int find_next_bit(const unsigned long *addr, unsigned int size, unsigned int off)
+{
+	while (off < size && !test_bit(off, addr))
+		off++;
+	return off;
+}
+
+static inline void bitmap_zero(unsigned long *dst, unsigned int nbits)
+{
+	memset(dst, 0, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+static inline bool bitmap_empty(const unsigned long *src, unsigned int nbits)
+{
+	return find_next_bit(src, nbits, 0) >= nbits;
+}
+
+#define for_each_set_bit(bit, addr, size) \
+	for ((bit) = find_next_bit((addr), (size), 0); (bit) < (size); (bit) = find_next_bit((addr), (size), (bit) + 1))
+
+/* errors in pointers */
+#define MAX_ERRNO 4095
+#define IS_ERR_VALUE(x) ((unsigned long)(void *)(x) >= (unsigned long)-MAX_ERRNO)
+
+static inline void *ERR_PTR(long error)
+{
+	return (void *)error;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+	return IS_ERR_VALUE(ptr);
+}
+
+static inline bool IS_ERR_OR_NULL(const void *ptr)
+{
+	return !ptr || IS_ERR_VALUE(ptr);
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline int PTR_ERR_OR_ZERO(const void *ptr)
+{
+	return IS_ERR(ptr) ? PTR_ERR(ptr) : 0;
+}
+
+/* lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define INIT_LIST_HEAD(l) ((l)->next = (l)->prev = (l))
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_for_each_entry(pos, head, member)                                       \
+	for (pos = list_entry((head)->next, typeof(*pos), member); &pos->member != (head); \
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+static inline void list_add_tail(struct list_head *n, struct list_head *head)
+{
+	n->prev = head->prev;
+	n->next = head;
+	head->prev->next = n;
+	head->prev = n;
+}
+
+/* printing */
+#define KERN_ERR  ""
+#define KERN_WARNING ""
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+
+extern int host_verbose;
+
+#define printk(fmt, ...)                                \
+	do {                                            \
+		if (host_verbose)                       \
+			printf(fmt, ##__VA_ARGS__);     \
+	} while (0)
+#define no_printk(fmt, ...)                                \
+	do {                                               \
+		if (0)                                     \
+			printf(fmt, ##__VA_ARGS__);        \
+	} while (0)
+
+/* errors always go to stderr, the rest only with host_verbose */
+#define dev_err(dev, fmt, ...)	fprintf(stderr, "%s: " fmt, dev_name(dev), ##__VA_ARGS__)
+#define dev_warn(dev, fmt, ...) fprintf(stderr, "%s: " fmt, dev_name(dev), ##__VA_ARGS__)
+#define dev_info(dev, fmt, ...) printk("%s: " fmt, dev_name(dev), ##__VA_ARGS__)
+#define dev_err_ratelimited	dev_err
+#define dev_warn_ratelimited	dev_warn
+#if defined(DEBUG)
+#define dev_dbg(dev, fmt, ...) printk("%s: " fmt, dev_name(dev), ##__VA_ARGS__)
+#else
+#define dev_dbg(dev, fmt, ...) no_printk("%s: " fmt, dev_name(dev), ##__VA_ARGS__)
+#endif
+#if defined(VERBOSE_DEBUG)
+#define dev_vdbg dev_dbg
+#else
+#define dev_vdbg(dev, fmt, ...) no_printk("%s: " fmt, dev_name(dev), ##__VA_ARGS__)
+#endif
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+size_t strscpy(char *dst, const char *src, size_t size);
+
+/* module */
+struct module;
+#define THIS_MODULE ((struct module *)0)
+#define MODULE_AUTHOR(x)	      extern int __host_module_info
+#define MODULE_DESCRIPTION(x)	      extern int __host_module_info
+#define MODULE_LICENSE(x)	      extern int __host_module_info
+#define MODULE_ALIAS(x)		      extern int __host_module_info
+#define MODULE_DEVICE_TABLE(type, name) extern int __host_module_info
+#define MODULE_PARM_DESC(x, y)	      extern int __host_module_info
+#define module_init(fn)		      extern int __host_module_info
+#define module_exit(fn)		      extern int __host_module_info
+
+/* time */
+#define HZ 1000
+
+u64 host_now(void);
+void host_delay(u64 ns);
+
+#define jiffies		      ((unsigned long)(host_now() / (NSEC_PER_SEC / HZ)))
+#define time_before(a, b)     ((long)((a) - (b)) < 0)
+#define time_after(a, b)      time_before(b, a)
+#define msecs_to_jiffies(ms)  ((unsigned long)(ms) * HZ / 1000)
+
+static inline u64 ktime_get_ns(void)
+{
+	return host_now();
+}
+
+static inline ktime_t ns_to_ktime(u64 ns)
+{
+	return ns;
+}
+
+static inline ktime_t ms_to_ktime(u64 ms)
+{
+	return ms * NSEC_PER_MSEC;
+}
+
+static inline void udelay(unsigned long us)
+{
+	host_delay(us * NSEC_PER_USEC);
+}
+
+static inline void mdelay(unsigned long ms)
+{
+	host_delay(ms * NSEC_PER_MSEC);
+}
+
+static inline void msleep(unsigned int ms)
+{
+	host_delay(ms * NSEC_PER_MSEC);
+}
+
+static inline unsigned long msleep_interruptible(unsigned int ms)
+{
+	host_delay(ms * NSEC_PER_MSEC);
+	return 0;
+}
+
+static inline void usleep_range(unsigned long min_us, unsigned long max_us)
+{
+	host_delay(min_us * NSEC_PER_USEC);
+}
+
+static inline void cond_resched(void)
+{
+}
+
+/* the one task the harness runs everything in */
+struct task_struct {
+	int pid;
+};
+
+extern struct task_struct host_task;
+
+#define current		  (&host_task)
+#define signal_pending(task) 0
+
+/* locking, single threaded */
+struct mutex {
+	int locked;
+	const char *name;
+};
+
+void host_mutex_lock(struct mutex *lock, const char *name);
+
+#define mutex_init(lock)		  ((lock)->locked = 0, (lock)->name = #lock)
+#define mutex_destroy(lock)		  ((void)(lock))
+#define mutex_lock(lock)		  host_mutex_lock(lock, #lock)
+#define mutex_lock_interruptible(lock)	  (host_mutex_lock(lock, #lock), 0)
+#define mutex_unlock(lock)		  ((lock)->locked = 0)
+
+static inline int mutex_trylock(struct mutex *lock)
+{
+	if (lock->locked)
+		return 0;
+	lock->locked = 1;
+	return 1;
+}
+
+typedef struct {
+	int dummy;
+} spinlock_t;
+
+#define spin_lock_init(lock)		  ((void)(lock))
+#define spin_lock_irqsave(lock, flags)	  ((void)(lock), (flags) = 0)
+#define spin_unlock_irqrestore(lock, flags) ((void)(lock), (void)(flags))
+
+struct kref {
+	int refcount;
+};
+
+static inline void kref_init(struct kref *kref)
+{
+	kref->refcount = 1;
+}
+
+static inline void kref_get(struct kref *kref)
+{
+	kref->refcount++;
+}
+
+static inline int kref_put(struct kref *kref, void (*release)(struct kref *kref))
+{
+	if (--kref->refcount)
+		return 0;
+	release(kref);
+	return 1;
+}
+
+/* wait queues and completions, nothing ever sleeps */
+typedef struct {
+	int dummy;
+} wait_queue_head_t;
+
+#define init_waitqueue_head(wq)		  ((void)(wq))
+#define wake_up_interruptible(wq)	  ((void)(wq))
+#define wait_event_interruptible(wq, cond) ((cond) ? 0 : -ERESTARTSYS)
+
+struct completion {
+	unsigned int done;
+};
+
+#define init_completion(x)   ((x)->done = 0)
+#define reinit_completion(x) ((x)->done = 0)
+#define complete(x)	     ((x)->done++)
+
+static inline unsigned long wait_for_completion_timeout(struct completion *x, unsigned long timeout)
+{
+	if (x->done)
+		return x->done--, timeout ? timeout : 1;
+	host_delay((u64)timeout * (NSEC_PER_SEC / HZ));
+	return 0;
+}
+
+/* work, run by the harness */
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	work_func_t func;
+	bool pending;
+	struct work_struct *next;
+};
+
+#define INIT_WORK(w, f) ((w)->func = (f), (w)->pending = false, (w)->next = NULL)
+#define work_pending(w) ((w)->pending)
+
+bool schedule_work(struct work_struct *work);
+bool cancel_work_sync(struct work_struct *work);
+
+/* hrtimers, run by the harness */
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS,
+	HRTIMER_MODE_REL,
+};
+
+#define CLOCK_MONOTONIC 1
+
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *timer);
+	u64 expires;
+	bool queued;
+};
+
+void hrtimer_init(struct hrtimer *timer, int clock_id, enum hrtimer_mode mode);
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode);
+int hrtimer_cancel(struct hrtimer *timer);
+#define hrtimer_try_to_cancel(timer) hrtimer_cancel(timer)
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval);
+
+/* delayed work, an hrtimer that queues the work when it expires */
+struct delayed_work {
+	struct work_struct work;
+	struct hrtimer timer;
+};
+
+#define INIT_DELAYED_WORK(dw, f) (INIT_WORK(&(dw)->work, (f)), hrtimer_init(&(dw)->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL))
+#define to_delayed_work(w)	 container_of(w, struct delayed_work, work)
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+
+/* memory */
+#define kmalloc(size, gfp) malloc(size)
+#define kzalloc(size, gfp) calloc(1, size)
+#define kfree(p)	   free(p)
+#define vmalloc(size)	   malloc(size)
+#define vmalloc_user(size) calloc(1, size)
+#define vfree(p)	   free(p)
+#define kstrndup(s, n, gfp) strndup(s, n)
+
+struct device;
+void *devm_kzalloc(struct device *dev, size_t size, gfp_t gfp);
+
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+int kstrtouint_from_user(const char __user *s, size_t count, unsigned int base, unsigned int *res);
+
+/* kfifo, elements of esize bytes in a power of 2 ring */
+struct __kfifo {
+	unsigned int in;
+	unsigned int out;
+	unsigned int mask;
+	unsigned int esize;
+	void *data;
+};
+
+struct kfifo {
+	struct __kfifo kfifo;
+	unsigned char *type;
+};
+
+#define DECLARE_KFIFO(fifo, eltype, size) \
+	struct {                          \
+		struct __kfifo kfifo;     \
+		eltype *type;             \
+		eltype buf[size];         \
+	} fifo
+#define INIT_KFIFO(fifo)                                                  \
+	((fifo).kfifo.in = (fifo).kfifo.out = 0,                          \
+	 (fifo).kfifo.mask = ARRAY_SIZE((fifo).buf) - 1,                  \
+	 (fifo).kfifo.esize = sizeof((fifo).buf[0]), (fifo).kfifo.data = (fifo).buf)
+
+int __kfifo_alloc(struct __kfifo *fifo, unsigned int size, size_t esize);
+void __kfifo_free(struct __kfifo *fifo);
+unsigned int __kfifo_in(struct __kfifo *fifo, const void *buf, unsigned int len);
+unsigned int __kfifo_out(struct __kfifo *fifo, void *buf, unsigned int len);
+
+#define kfifo_alloc(fifo, size, gfp) __kfifo_alloc(&(fifo)->kfifo, size, sizeof(*(fifo)->type))
+#define kfifo_free(fifo)	     __kfifo_free(&(fifo)->kfifo)
+#define kfifo_len(fifo)		     ((fifo)->kfifo.in - (fifo)->kfifo.out)
+#define kfifo_is_empty(fifo)	     (kfifo_len(fifo) == 0)
+#define kfifo_is_full(fifo)	     (kfifo_len(fifo) > (fifo)->kfifo.mask)
+#define kfifo_in(fifo, buf, n)	     __kfifo_in(&(fifo)->kfifo, buf, n)
+#define kfifo_out(fifo, buf, n)	     __kfifo_out(&(fifo)->kfifo, buf, n)
+#define kfifo_put(fifo, val)                                          \
+	({                                                            \
+		typeof(*(fifo)->type) __val = (val);                  \
+		__kfifo_in(&(fifo)->kfifo, &__val, 1);                \
+	})
+#define kfifo_get(fifo, val) __kfifo_out(&(fifo)->kfifo, val, 1)
+#define kfifo_skip(fifo)     ((void)(fifo)->kfifo.out++)
+#define kfifo_to_user(fifo, to, n, copied)                             \
+	({                                                             \
+		*(copied) = __kfifo_out(&(fifo)->kfifo, to, n);        \
+		0;                                                     \
+	})
+#define kfifo_from_user(fifo, from, n, copied)                         \
+	({                                                             \
+		*(copied) = __kfifo_in(&(fifo)->kfifo, from, n);       \
+		0;                                                     \
+	})
+
+/* files */
+#define FMODE_READ  0x1
+#define FMODE_WRITE 0x2
+#ifndef O_NONBLOCK
+#define O_NONBLOCK 04000
+#endif
+
+#ifndef S_IRUGO
+#define S_IRUGO 0444
+#endif
+#ifndef S_IWUSR
+#define S_IWUSR 0200
+#endif
+
+#define EPOLLIN	    0x00000001
+#define EPOLLOUT    0x00000004
+#define EPOLLHUP    0x00000010
+#define EPOLLRDNORM 0x00000040
+#define EPOLLWRNORM 0x00000100
+
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	unsigned int f_flags;
+	fmode_t f_mode;
+	void *private_data;
+	struct inode *f_inode;
+};
+
+struct vm_area_struct {
+	unsigned long vm_pgoff;
+};
+
+typedef struct poll_table_struct {
+	int dummy;
+} poll_table;
+
+#define poll_wait(file, wq, p) ((void)(wq))
+
+struct file_operations {
+	struct module *owner;
+	loff_t (*llseek)(struct file *, loff_t, int);
+	ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+	ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+	__poll_t (*poll)(struct file *, poll_table *);
+	int (*mmap)(struct file *, struct vm_area_struct *);
+	int (*open)(struct inode *, struct file *);
+	int (*release)(struct inode *, struct file *);
+};
+
+static inline struct inode *file_inode(const struct file *f)
+{
+	return f->f_inode;
+}
+
+int nonseekable_open(struct inode *inode, struct file *filp);
+loff_t no_llseek(struct file *file, loff_t offset, int whence);
+loff_t default_llseek(struct file *file, loff_t offset, int whence);
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos, const void *from, size_t available);
+int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff);
+
+/* seq_file, show() output collected in a buffer */
+struct seq_file {
+	char *buf;
+	size_t size;
+	size_t count;
+	int (*show)(struct seq_file *m, void *v);
+	void *private;
+};
+
+void seq_printf(struct seq_file *m, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void seq_puts(struct seq_file *m, const char *s);
+int single_open(struct file *file, int (*show)(struct seq_file *, void *), void *data);
+int single_release(struct inode *inode, struct file *file);
+ssize_t seq_read(struct file *file, char __user *buf, size_t size, loff_t *ppos);
+loff_t seq_lseek(struct file *file, loff_t offset, int whence);
+
+/* debugfs, the files are kept in a table the harness can read */
+struct dentry {
+	char name[64];
+	struct dentry *parent;
+	void *data;
+	const struct file_operations *fops;
+};
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, unsigned short mode, struct dentry *parent, void *data,
+				   const struct file_operations *fops);
+struct dentry *debugfs_create_u32(const char *name, unsigned short mode, struct dentry *parent, u32 *value);
+void debugfs_remove_recursive(struct dentry *dentry);
+
+/*
+ * regmap with a register cache for the registers that are not volatile.
+ * Reads of a cached register come from the cache once it was read or
+ * written, writes go to the cache and the bus, bulk writes are single
+ * writes. Update bits reads and writes under one lock, and skips the write
+ * of an unchanged value unless forced. The register dump is regmap/<device>-<name>/registers in debugfs
+ * and skips precious registers like the kernel one.
+ */
+enum regcache_type { REGCACHE_NONE, REGCACHE_RBTREE, REGCACHE_FLAT, REGCACHE_MAPLE };
+
+struct regmap_bus {
+	int (*reg_read)(void *context, unsigned int reg, unsigned int *val);
+	int (*reg_write)(void *context, unsigned int reg, unsigned int val);
+};
+
+struct regmap_config {
+	const char *name;
+	int reg_bits;
+	int val_bits;
+	unsigned int max_register;
+	bool (*volatile_reg)(struct device *dev, unsigned int reg);
+	bool (*precious_reg)(struct device *dev, unsigned int reg);
+	bool (*readable_reg)(struct device *dev, unsigned int reg);
+	bool (*writeable_reg)(struct device *dev, unsigned int reg);
+	enum regcache_type cache_type;
+	void (*lock)(void *arg);
+	void (*unlock)(void *arg);
+	void *lock_arg;
+};
+
+struct regmap;
+
+struct regmap *devm_regmap_init(struct device *dev, const struct regmap_bus *bus, void *bus_context,
+				const struct regmap_config *config);
+int regmap_read(struct regmap *map, unsigned int reg, unsigned int *val);
+int regmap_write(struct regmap *map, unsigned int reg, unsigned int val);
+int regmap_bulk_write(struct regmap *map, unsigned int reg, const void *val, size_t val_count);
+int regmap_update_bits_base(struct regmap *map, unsigned int reg, unsigned int mask, unsigned int val, bool *change,
+			    bool async, bool force);
+int regcache_drop_region(struct regmap *map, unsigned int min, unsigned int max);
+
+static inline int regmap_update_bits(struct regmap *map, unsigned int reg, unsigned int mask, unsigned int val)
+{
+	return regmap_update_bits_base(map, reg, mask, val, NULL, false, false);
+}
+
+static inline int regmap_write_bits(struct regmap *map, unsigned int reg, unsigned int mask, unsigned int val)
+{
+	return regmap_update_bits_base(map, reg, mask, val, NULL, false, true);
+}
+
+/*
+ * fault injection, should_fail() follows lib/fault-inject.c for probability,
+ * interval, times and space with a fixed seed random sequence. The harness
+ * reads hits and last_ns.
+ */
+struct fault_attr {
+	unsigned long probability; /* percent */
+	unsigned long interval;
+	long times; /* -1 without limit */
+	long space;
+	unsigned long verbose;
+	unsigned long count;
+	u64 hits;
+	u64 last_ns; /* time of the last failure */
+};
+
+#define FAULT_ATTR_INITIALIZER	  { .interval = 1, .times = 1, .verbose = 2 }
+#define DECLARE_FAULT_ATTR(name) struct fault_attr name = FAULT_ATTR_INITIALIZER
+
+bool should_fail(struct fault_attr *attr, ssize_t size);
+struct dentry *fault_create_debugfs_attr(const char *name, struct dentry *parent, struct fault_attr *attr);
+
+/* sysfs */
+struct kobject {
+	const char *name;
+};
+
+struct attribute {
+	const char *name;
+	unsigned short mode;
+};
+
+struct attribute_group {
+	const char *name;
+	struct attribute **attrs;
+};
+
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *dev, struct device_attribute *attr, char *buf);
+	ssize_t (*store)(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+};
+
+#define DEVICE_ATTR(_name, _mode, _show, _store) \
+	struct device_attribute dev_attr_##_name = { { #_name, _mode }, _show, _store }
+
+int sysfs_create_group(struct kobject *kobj, const struct attribute_group *grp);
+void sysfs_remove_group(struct kobject *kobj, const struct attribute_group *grp);
+int sysfs_create_link(struct kobject *kobj, struct kobject *target, const char *name);
+void sysfs_remove_link(struct kobject *kobj, const char *name);
+
+/* devices and device tree */
+struct device_node {
+	const char *name;
+};
+
+struct fwnode_handle {
+	int dummy;
+};
+
+struct of_device_id {
+	char compatible[128];
+	const void *data;
+};
+
+struct bus_type {
+	const char *name;
+};
+
+struct device_driver {
+	const char *name;
+	struct bus_type *bus;
+	struct module *owner;
+	const struct of_device_id *of_match_table;
+};
+
+struct device {
+	const char *init_name;
+	struct device *parent;
+	void *driver_data;
+	struct device_node *of_node;
+	struct fwnode_handle *fwnode;
+	struct kobject kobj;
+	void (*release)(struct device *dev);
+};
+
+/* per port devices only exist for device tree child nodes, never on the host */
+static inline void device_initialize(struct device *dev)
+{
+}
+
+static inline int device_add(struct device *dev)
+{
+	return -ENODEV;
+}
+
+static inline void put_device(struct device *dev)
+{
+	dev->release(dev);
+}
+
+static inline void device_unregister(struct device *dev)
+{
+	put_device(dev);
+}
+
+#define dev_set_name(dev, fmt, ...) 0
+
+static inline const char *dev_name(const struct device *dev)
+{
+	return dev->init_name;
+}
+
+static inline void *dev_get_drvdata(const struct device *dev)
+{
+	return dev->driver_data;
+}
+
+static inline void dev_set_drvdata(struct device *dev, void *data)
+{
+	dev->driver_data = data;
+}
+
+#define of_match_ptr(ptr)		       (ptr)
+#define of_fwnode_handle(node)		       ((struct fwnode_handle *)(node))
+#define of_node_put(node)		       ((void)(node))
+#define for_each_available_child_of_node(parent, child) \
+	for ((child) = NULL; (child) != NULL;)
+
+static inline int of_property_read_u32(const struct device_node *np, const char *name, u32 *out)
+{
+	return -EINVAL;
+}
+
+int device_property_read_u32(struct device *dev, const char *propname, u32 *val);
+
+/* clocks and gpios, unused on the host */
+struct clk;
+
+static inline int gpio_to_irq(unsigned int gpio)
+{
+	return -ENXIO;
+}
+
+static inline int devm_gpio_request(struct device *dev, unsigned int gpio, const char *label)
+{
+	return 0;
+}
+
+static inline int gpio_direction_input(unsigned int gpio)
+{
+	return 0;
+}
+
+/* irqs, the harness raises the registered handler */
+typedef enum irqreturn {
+	IRQ_NONE,
+	IRQ_HANDLED,
+	IRQ_WAKE_THREAD,
+} irqreturn_t;
+
+typedef irqreturn_t (*irq_handler_t)(int irq, void *dev_id);
+
+#define IRQF_TRIGGER_FALLING 0x00000002
+#define IRQF_ONESHOT	     0x00002000
+
+int devm_request_threaded_irq(struct device *dev, unsigned int irq, irq_handler_t handler, irq_handler_t thread_fn,
+			      unsigned long irqflags, const char *devname, void *dev_id);
+void devm_free_irq(struct device *dev, unsigned int irq, void *dev_id);
+
+static inline void synchronize_irq(unsigned int irq)
+{
+}
+
+/* the harness never runs work and the irq thread at the same time */
+static inline void disable_irq(unsigned int irq)
+{
+}
+
+static inline void enable_irq(unsigned int irq)
+{
+}
+
+static inline int irq_set_irq_type(unsigned int irq, unsigned int type)
+{
+	return 0;
+}
+
+/* misc devices */
+#define MISC_DYNAMIC_MINOR 255
+
+struct miscdevice {
+	int minor;
+	const char *name;
+	const struct file_operations *fops;
+	struct device *parent;
+	struct device *this_device;
+};
+
+int misc_register(struct miscdevice *misc);
+void misc_deregister(struct miscdevice *misc);
+
+/* spi */
+#define SPI_CPHA   0x01
+#define SPI_CPOL   0x02
+#define SPI_MODE_3 (SPI_CPOL | SPI_CPHA)
+
+extern struct bus_type spi_bus_type;
+
+struct spi_controller {
+	int bus_lock_flag;
+};
+
+struct spi_device {
+	struct device dev;
+	struct spi_controller *controller;
+	u32 max_speed_hz;
+	u32 mode;
+	int irq;
+};
+
+struct spi_transfer {
+	const void *tx_buf;
+	void *rx_buf;
+	unsigned int len;
+	struct list_head transfer_list;
+};
+
+struct spi_message {
+	struct list_head transfers;
+	struct spi_device *spi;
+	int status;
+	unsigned int actual_length;
+};
+
+struct spi_driver {
+	int (*probe)(struct spi_device *spi);
+	void (*remove)(struct spi_device *spi);
+	struct device_driver driver;
+};
+
+static inline void spi_message_init(struct spi_message *m)
+{
+	memset(m, 0, sizeof(*m));
+	INIT_LIST_HEAD(&m->transfers);
+}
+
+static inline void spi_message_add_tail(struct spi_transfer *t, struct spi_message *m)
+{
+	list_add_tail(&t->transfer_list, &m->transfers);
+}
+
+int spi_setup(struct spi_device *spi);
+int spi_sync(struct spi_device *spi, struct spi_message *message);
+int spi_sync_locked(struct spi_device *spi, struct spi_message *message);
+int spi_bus_lock(struct spi_controller *ctlr);
+int spi_bus_unlock(struct spi_controller *ctlr);
+int spi_write_then_read(struct spi_device *spi, const void *txbuf, unsigned int n_tx, void *rxbuf, unsigned int n_rx);
+int spi_register_driver(struct spi_driver *sdrv);
+void spi_unregister_driver(struct spi_driver *sdrv);
+
+static inline int spi_write(struct spi_device *spi, const void *buf, size_t len)
+{
+	return spi_write_then_read(spi, buf, len, NULL, 0);
+}
+
+/* tty and serial core */
+#define TTY_NORMAL  0
+#define TTY_BREAK   1
+#define TTY_FRAME   2
+#define TTY_PARITY  3
+#define TTY_OVERRUN 4
+
+#define NO_POLL_CHAR 0x00ff0000
+
+#define UART_XMIT_SIZE PAGE_SIZE
+#define WAKEUP_CHARS   256
+
+#define UPF_LOW_LATENCY	  (1U << 13)
+#define UPF_FIXED_TYPE	  (1U << 27)
+#define UPIO_PORT	  0
+#define UART_CONFIG_TYPE  (1 << 0)
+#define UART_PM_STATE_ON  0
+#define UART_PM_STATE_OFF 3
+#ifndef PORT_UNKNOWN
+#define PORT_UNKNOWN 0
+#endif
+
+#define CON_PRINTBUFFER 1
+
+#define CIRC_CNT(head, tail, size)   (((head) - (tail)) & ((size) - 1))
+#define CIRC_SPACE(head, tail, size) CIRC_CNT((tail), ((head) + 1), (size))
+
+struct circ_buf {
+	char *buf;
+	int head;
+	int tail;
+};
+
+struct tty_port {
+	struct mutex mutex;
+	bool initialized;
+};
+
+#define tty_port_initialized(port) ((port)->initialized)
+
+struct uart_state {
+	struct tty_port port;
+	struct circ_buf xmit;
+};
+
+struct uart_icount {
+	u32 cts, dsr, rng, dcd;
+	u32 rx, tx;
+	u32 frame, overrun, parity, brk;
+	u32 buf_overrun;
+};
+
+struct uart_port;
+struct console;
+struct tty_driver;
+
+struct uart_ops {
+	unsigned int (*tx_empty)(struct uart_port *);
+	void (*set_mctrl)(struct uart_port *, unsigned int mctrl);
+	unsigned int (*get_mctrl)(struct uart_port *);
+	void (*stop_tx)(struct uart_port *);
+	void (*start_tx)(struct uart_port *);
+	void (*stop_rx)(struct uart_port *);
+	void (*enable_ms)(struct uart_port *);
+	void (*break_ctl)(struct uart_port *, int ctl);
+	int (*startup)(struct uart_port *);
+	void (*shutdown)(struct uart_port *);
+	void (*set_termios)(struct uart_port *, struct ktermios *new, const struct ktermios *old);
+	void (*pm)(struct uart_port *, unsigned int state, unsigned int oldstate);
+	const char *(*type)(struct uart_port *);
+	void (*release_port)(struct uart_port *);
+	int (*request_port)(struct uart_port *);
+	void (*config_port)(struct uart_port *, int);
+	int (*verify_port)(struct uart_port *, struct serial_struct *);
+	int (*ioctl)(struct uart_port *, unsigned int, unsigned long);
+	int (*poll_init)(struct uart_port *);
+	void (*poll_put_char)(struct uart_port *, unsigned char);
+	int (*poll_get_char)(struct uart_port *);
+};
+
+struct uart_port {
+	unsigned int line;
+	struct device *dev;
+	unsigned int irq;
+	unsigned int type;
+	unsigned int fifosize;
+	unsigned long flags;
+	unsigned char iotype;
+	unsigned int uartclk;
+	const struct uart_ops *ops;
+	struct uart_state *state;
+	struct uart_icount icount;
+	struct console *cons;
+	unsigned int read_status_mask;
+	unsigned int ignore_status_mask;
+	unsigned int mctrl;
+	unsigned int timeout;
+	unsigned char x_char;
+	bool hw_stopped;
+};
+
+struct uart_driver {
+	struct module *owner;
+	const char *driver_name;
+	const char *dev_name;
+	int major;
+	int minor;
+	int nr;
+	struct console *cons;
+};
+
+struct console {
+	char name[16];
+	void (*write)(struct console *co, const char *s, unsigned int count);
+	struct tty_driver *(*device)(struct console *co, int *index);
+	int (*setup)(struct console *co, char *options);
+	short flags;
+	short index;
+	void *data;
+};
+
+#define uart_console(port)	      ((port)->cons && (port)->cons->index == (port)->line)
+#define uart_circ_empty(circ)	      ((circ)->head == (circ)->tail)
+#define uart_circ_chars_pending(circ) (CIRC_CNT((circ)->head, (circ)->tail, UART_XMIT_SIZE))
+#define uart_tx_stopped(port)	      ((port)->hw_stopped)
+#define uart_handle_break(port)	      0
+#define uart_handle_sysrq_char(port, ch) 0
+
+int uart_register_driver(struct uart_driver *uart);
+void uart_unregister_driver(struct uart_driver *uart);
+int uart_add_one_port(struct uart_driver *reg, struct uart_port *port);
+void uart_remove_one_port(struct uart_driver *reg, struct uart_port *port);
+void uart_write_wakeup(struct uart_port *port);
+void uart_handle_cts_change(struct uart_port *port, bool active);
+unsigned int uart_get_baud_rate(struct uart_port *port, struct ktermios *termios, const struct ktermios *old,
+				unsigned int min, unsigned int max);
+void uart_update_timeout(struct uart_port *port, unsigned int cflag, unsigned int baud);
+void uart_insert_char(struct uart_port *port, unsigned int status, unsigned int overrun, unsigned int ch,
+		      unsigned int flag);
+void uart_parse_options(const char *options, int *baud, int *parity, int *bits, int *flow);
+int uart_set_options(struct uart_port *port, struct console *co, int baud, int parity, int bits, int flow);
+struct tty_driver *uart_console_device(struct console *co, int *index);
+int tty_insert_flip_char(struct tty_port *port, unsigned char ch, char flag);
+void tty_flip_buffer_push(struct tty_port *port);
+
+/* ida, only used by the perf pmu */
+struct ida {
+	int next;
+};
+
+#define DEFINE_IDA(name) struct ida name
+
+/*
+ * Harness side of the shim, implemented in ch43x_host_kernel.c and called
+ * back into ch43x_host.c.
+ */
+struct ch43x_model;
+
+struct host_spi_stats {
+	u64 msgs;
+	u64 xfers;
+	u64 bytes;
+	u64 ns;
+};
+
+extern struct ch43x_model host_model;
+extern struct host_spi_stats host_spi;
+extern u64 host_spi_hz;	    /* spi clock of the simulated bus */
+extern u32 host_spi_max_frequency; /* spi-max-frequency property, 0 absent */
+extern u64 host_spi_fail_hz; /* reads are corrupted above this clock, 0 never */
+extern u64 host_spi_msg_ns; /* fixed controller cost per message */
+extern u64 host_int_edges;  /* INT edges seen between spi messages */
+
+/* moves the clock and the chip model to now + ns */
+void host_advance(u64 ns);
+/* runs queued work items and expired hrtimers, returns how many ran */
+int host_run_work(void);
+/* raises the interrupt: hard handler, then the thread after latency_ns */
+void host_irq(u64 latency_ns);
+bool host_irq_registered(void);
+/* reads a debugfs file of the driver, path relative to the debugfs root */
+ssize_t host_debugfs_read(const char *path, char *buf, size_t size);
+ssize_t host_debugfs_write(const char *path, const char *buf);
+/* the probed driver of spi_register_driver() */
+struct spi_driver *host_spi_driver(void);
+
+/* implemented by the harness */
+void host_tty_rx(struct tty_port *port, unsigned char ch, char flag);
+void host_tty_push(struct tty_port *port);
+void host_tty_wakeup(struct uart_port *port);
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * userspace stand-in, see ch43x_host_kernel.h. The events compile to empty
+ * inline functions.
+ */
+#include <ch43x_host_kernel.h>
+
+#ifndef CH43X_HOST_TRACEPOINT_H
+#define CH43X_HOST_TRACEPOINT_H
+
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...)  args
+
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args) \
+	static inline void trace_##name(proto)    \
+	{                                         \
+	}
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto)                 \
+	{                                                      \
+	}
+
+#endif
@@ -0,0 +1,2 @@
+/* userspace stand-in, see ch43x_host_kernel.h */
+#include <ch43x_host_kernel.h>
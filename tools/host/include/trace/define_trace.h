@@ -0,0 +1 @@
+/* userspace stand-in, tracepoints are not created on the host */